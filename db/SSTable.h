@@ -1,132 +1,577 @@
+#pragma once
 #include "block.h"
 #include "filter_block.h"
 #include "crc32c.h"
 #include "coding.h"
+#include "dbformat.h"
+#include "tableProperties.h"
+#include "options.h"
+#include "prefixExtractor.h"
+#include <map>
 static const size_t kBlockTrailerSize = 4;
-//用于记录每个写入文件的块（data_block,index_block）的偏移量和大小
-class BlockHandle {
-    public:
-     // Maximum encoding length of a BlockHandle
-     enum { kMaxEncodedLength = 10 + 10 };
-   
-     // The offset of the block in the file.
-     uint64_t offset() const { return offset_; }
-     void set_offset(uint64_t offset) { offset_ = offset; }
-   
-     // The size of the stored block
-     uint64_t size() const { return size_; }
-     void set_size(uint64_t size) { size_ = size; }
-   
-     void EncodeTo(std::string* dst) const{
-        coding::PutFixed64(dst,offset_);
-        coding::PutFixed64(dst,size_);
-     }
-     Status DecodeFrom(slice* input){
-        offset_ = coding::DecodeFixed64(input->data_);
-        size_ = coding::DecodeFixed64(input->data_ + 8);
-     }
-   
-    private:
-     uint64_t offset_;
-     uint64_t size_;
+//校验从文件读出的block（contents为读取结果，buf为读取时的scratch，由new[]分配，文件不需要scratch时为nullptr）
+//并填写result。出错时释放buf；数据来自mmap映射区时释放buf并直接引用映射区
+inline Status ParseBlockRead(const BlockHandle& handle,char* buf,const slice& contents,BlockContents* result){
+    result->data = slice();
+    result->cachable = false;
+    result->heap_allocated = false;
+    size_t n = static_cast<size_t>(handle.size());
+    if(static_cast<size_t>(contents.size()) != n + kBlockTrailerSize){
+        delete[] buf;
+        return Corruption;
+    }
+    const char* data = contents.data();
+    const uint32_t crc = crc32c::Unmask(coding::DecodeFixed32(data + n));
+    if(crc != crc32c::Value(data, n)){
+        delete[] buf;
+        return Corruption;
+    }
+    if(data != buf){
+        //数据来自mmap映射区，直接引用
+        delete[] buf;
+        result->data = slice(data, n);
+        return OK;
+    }
+    result->data = slice(buf, n);
+    result->heap_allocated = true;
+    result->cachable = true;
+    return OK;
+}
+//迭代器读取data block时的预读缓冲区。一次读入一个窗口，之后落在窗口内的block直接从缓冲区拷贝，
+//把顺序扫描中每个block一次的小读取合并成少量的大读取。
+//readahead_size为0时自动检测顺序访问：连续kMinSequentialReads次读取都紧接着上一次时开始预读，
+//窗口从ReadOptions::kInitialReadaheadSize起每次加倍，直到kMaxAutoReadaheadSize；访问不连续时回到初始状态。
+//readahead_size不为0时总是按固定窗口预读，并提示内核提前读入下一个窗口；
+//drop_behind为true时提示内核丢弃已经读过的窗口。
+//mmap实现的文件读取本身没有拷贝，不使用缓冲区，只对预读窗口调用Hint(WILLNEED)
+class FilePrefetchBuffer{
+public:
+    //file_size用于把预读窗口限制在文件之内
+    FilePrefetchBuffer(uint64_t file_size,size_t readahead_size,bool drop_behind)
+        :file_size_(file_size),fixed_(readahead_size > 0),drop_behind_(drop_behind),
+         readahead_size_(fixed_ ? readahead_size : ReadOptions::kInitialReadaheadSize),
+         buffer_offset_(0),buffer_len_(0),hinted_end_(0),prev_end_(0),num_sequential_(0),mmap_(false){}
+    FilePrefetchBuffer(const FilePrefetchBuffer&) = delete;
+    FilePrefetchBuffer& operator=(const FilePrefetchBuffer&) = delete;
+    ~FilePrefetchBuffer(){
+        delete[] buffer_;
+    }
+
+    //读取[offset,offset+n)，结果拷贝到scratch（mmap文件时result指向映射区），语义与RandomAccessFile::Read相同
+    Status Read(RandomAccessFile* file,uint64_t offset,size_t n,slice* result,char* scratch){
+        const bool sequential = (offset == prev_end_);
+        prev_end_ = offset + n;
+        if(!sequential){
+            num_sequential_ = 0;
+            if(!fixed_){
+                readahead_size_ = ReadOptions::kInitialReadaheadSize;
+            }
+        }else if(num_sequential_ < kMinSequentialReads){
+            num_sequential_++;
+        }
+        if(!mmap_ && TryReadFromBuffer(offset,n,result,scratch)){
+            return OK;
+        }
+        if(!fixed_ && num_sequential_ < kMinSequentialReads){
+            return file->Read(offset,result,scratch,n);
+        }
+        const size_t window = static_cast<size_t>(std::min<uint64_t>(std::max(n,readahead_size_),
+                                                                      file_size_ > offset ? file_size_ - offset : n));
+        if(!fixed_){
+            readahead_size_ = std::min(readahead_size_ * 2,ReadOptions::kMaxAutoReadaheadSize);
+        }
+        if(mmap_){
+            return ReadMmap(file,offset,n,window,result,scratch);
+        }
+        Status s = FillBuffer(file,offset,window);
+        if(s != OK){
+            return s;
+        }
+        if(mmap_){
+            return ReadMmap(file,offset,n,window,result,scratch);
+        }
+        if(TryReadFromBuffer(offset,n,result,scratch)){
+            return OK;
+        }
+        //文件在窗口内结束，读到的不足n字节，交给文件本身返回结果
+        return file->Read(offset,result,scratch,n);
+    }
+
+private:
+    static const int kMinSequentialReads = 2;
+
+    bool TryReadFromBuffer(uint64_t offset,size_t n,slice* result,char* scratch){
+        if(offset < buffer_offset_ || offset + n > buffer_offset_ + buffer_len_){
+            return false;
+        }
+        std::memcpy(scratch,buffer_ + (offset - buffer_offset_),n);
+        *result = slice(scratch,n);
+        return true;
+    }
+    Status FillBuffer(RandomAccessFile* file,uint64_t offset,size_t window){
+        if(!file->NeedsScratch()){
+            //mmap实现，之后不再拷贝
+            mmap_ = true;
+            return OK;
+        }
+        if(buffer_ == nullptr || buffer_capacity_ < window){
+            delete[] buffer_;
+            buffer_ = new char[window];
+            buffer_capacity_ = window;
+        }
+        if(drop_behind_ && buffer_len_ > 0){
+            file->Hint(AccessPattern::DONTNEED,buffer_offset_,buffer_len_);
+        }
+        slice contents;
+        Status s = file->Read(offset,&contents,buffer_,window);
+        buffer_len_ = 0;
+        if(s != OK){
+            return s;
+        }
+        if(contents.data() != buffer_){
+            //没有声明NeedsScratch()为false、但结果仍指向自身内存的实现，同样按mmap处理
+            mmap_ = true;
+            delete[] buffer_;
+            buffer_ = nullptr;
+            buffer_capacity_ = 0;
+            return OK;
+        }
+        buffer_offset_ = offset;
+        buffer_len_ = contents.size();
+        if(fixed_){
+            HintNextWindow(file,offset + buffer_len_,window);
+        }
+        return OK;
+    }
+    Status ReadMmap(RandomAccessFile* file,uint64_t offset,size_t n,size_t window,slice* result,char* scratch){
+        if(offset + n > hinted_end_ || offset < buffer_offset_){
+            if(drop_behind_ && hinted_end_ > buffer_offset_){
+                file->Hint(AccessPattern::DONTNEED,buffer_offset_,hinted_end_ - buffer_offset_);
+            }
+            buffer_offset_ = offset;
+            hinted_end_ = offset;
+            HintNextWindow(file,offset,window);
+        }
+        return file->Read(offset,result,scratch,n);
+    }
+    //让内核在后台读入[offset,offset+window)
+    void HintNextWindow(RandomAccessFile* file,uint64_t offset,size_t window){
+        if(offset >= file_size_){
+            return;
+        }
+        const uint64_t len = std::min<uint64_t>(window,file_size_ - offset);
+        file->Hint(AccessPattern::WILLNEED,offset,len);
+        hinted_end_ = offset + len;
+    }
+
+    const uint64_t file_size_;
+    const bool fixed_;
+    const bool drop_behind_;
+    size_t readahead_size_;
+    char* buffer_ = nullptr;
+    size_t buffer_capacity_ = 0;
+    uint64_t buffer_offset_;  //缓冲区（mmap时为已提示的窗口）起点在文件中的偏移
+    size_t buffer_len_;
+    uint64_t hinted_end_;     //已经提示内核预读到的位置
+    uint64_t prev_end_;       //上一次读取的结束位置
+    int num_sequential_;
+    bool mmap_;
 };
+//读取handle指向的block并校验crc，prefetch不为nullptr时经过预读缓冲区读取。
+//file为mmap实现时result->data直接指向映射区，不发生拷贝，此时heap_allocated和cachable都为false，
+//这样的block已经常驻内存，没有必要再拷贝一份放进block cache
+inline Status ReadBlock(RandomAccessFile* file,const BlockHandle& handle,BlockContents* result,
+                        FilePrefetchBuffer* prefetch = nullptr){
+    result->data = slice();
+    result->cachable = false;
+    result->heap_allocated = false;
+    size_t n = static_cast<size_t>(handle.size());
+    char* buf = file->NeedsScratch() ? new char[n + kBlockTrailerSize] : nullptr;
+    slice contents;
+    Status s = (prefetch != nullptr) ? prefetch->Read(file,handle.offset(),n + kBlockTrailerSize,&contents,buf)
+                                     : file->Read(handle.offset(),&contents,buf,n + kBlockTrailerSize);
+    if(s != OK){
+        delete[] buf;
+        return s;
+    }
+    return ParseBlockRead(handle,buf,contents,result);
+}
+//footer位于sstable末尾，长度固定，记录metaindex_block和index_block的位置
+class Footer{
+public:
+    enum { kEncodedLength = 2 * 16 + 8 };
+    const BlockHandle& metaindex_handle() const { return metaindex_handle_; }
+    void set_metaindex_handle(const BlockHandle& h) { metaindex_handle_ = h; }
+    const BlockHandle& index_handle() const { return index_handle_; }
+    void set_index_handle(const BlockHandle& h) { index_handle_ = h; }
+
+    void EncodeTo(std::string* dst) const{
+        metaindex_handle_.EncodeTo(dst);
+        index_handle_.EncodeTo(dst);
+        coding::PutFixed64(dst, kTableMagicNumber);
+    }
+    Status DecodeFrom(slice* input){
+        if(static_cast<size_t>(input->size()) < kEncodedLength){
+            return Corruption;
+        }
+        const char* magic_ptr = input->data() + kEncodedLength - 8;
+        if(coding::DecodeFixed64(magic_ptr) != kTableMagicNumber){
+            return Corruption;
+        }
+        slice metaindex(input->data(), 16);
+        slice index(input->data() + 16, 16);
+        Status s = metaindex_handle_.DecodeFrom(&metaindex);
+        if(s == OK){
+            s = index_handle_.DecodeFrom(&index);
+        }
+        return s;
+    }
+private:
+    static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
+    BlockHandle metaindex_handle_;
+    BlockHandle index_handle_;
+};
+//metaindex_block中properties block对应的key
+static const char kPropertiesBlockName[] = "leveldb.properties";
+//metaindex_block中三种filter布局对应的key前缀，后面接filter policy的名字
+static const char kFilterBlockPrefix[] = "filter.";
+static const char kFullFilterBlockPrefix[] = "fullfilter.";
+static const char kPartitionedFilterBlockPrefix[] = "partitionedfilter.";
+
 class TableBuilder{
     public:
     struct Rep{
-        Rep(WritableFile* file,BloomFilterPolicy * filterPolicy):file(file){
-            filter_block = new FilterBlockBuilder(filterPolicy);
-            num_entries = 0;
+        Rep(const Options& options,WritableFile* file):options(options),file(file),filter_policy(options.filter_policy){
+            filter_block = nullptr;
+            partitioned_filter = nullptr;
+            if(filter_policy != nullptr){
+                switch(options.filter_layout){
+                    case kOffsetFilter:
+                        filter_block = new FilterBlockBuilder(filter_policy);
+                        break;
+                    case kFullFilter:
+                        //只有一个分区的分区filter就是整表filter
+                        partitioned_filter = new PartitionedFilterBlockBuilder(filter_policy,SIZE_MAX);
+                        break;
+                    case kPartitionedFilter:
+                        partitioned_filter = new PartitionedFilterBlockBuilder(filter_policy,options.filter_partition_keys);
+                        break;
+                }
+            }
+            if(partitioned_filter != nullptr && options.prefix_extractor != nullptr){
+                props.prefix_extractor_name = options.prefix_extractor->Name();
+            }
+            props.whole_key_filtering = (filter_block != nullptr || options.whole_key_filtering);
             offset = 0;
+            status = OK;
+            closed = false;
+            pending_index_entry = false;
+        }
+        ~Rep(){
+            delete filter_block;
+            delete partitioned_filter;
         }
+        Options options;
         WritableFile* file;
         uint64_t offset;//当前文件的写入偏移量。用于记录文件中下一个写入位置
         Status status;
         BlockBuilder data_block;
         BlockBuilder index_block;
         std::string last_key;
-        int64_t num_entries;//记录已插入的键值对数量。
+        std::string last_prefix;//上一个加入filter的前缀，相邻相同的前缀只加一次
+        TableProperties props;//边写边统计的表属性，num_entries即已插入的键值对数量
         bool closed;  // 标记 TableBuilder 是否已完成或被放弃。
-        FilterBlockBuilder* filter_block;
+        const FilterPolicy* filter_policy;
+        FilterBlockBuilder* filter_block;  // kOffsetFilter布局时使用
+        PartitionedFilterBlockBuilder* partitioned_filter;  // kFullFilter和kPartitionedFilter布局时使用
       
         // 不变性：仅当 data_block 为空时，r->pending_index_entry 才为 true。
         bool pending_index_entry;//标记是否有尚未写入索引块（Index Block）的数据块（Data Block）。
-        BlockHandle *pending_handle;  //用于存储上一个数据块的元信息（偏移量和大小）。
+        BlockHandle pending_handle;  //用于存储上一个数据块的元信息（偏移量和大小）。
     };
     Rep *rep_;
-    TableBuilder(WritableFile* file,BloomFilterPolicy* filterPolicy): rep_(new Rep(file,filterPolicy)) {
+    TableBuilder(const Options& options,WritableFile* file): rep_(new Rep(options,file)) {
         if (rep_->filter_block != nullptr) {
             rep_->filter_block->StartBlock(0);
         }
     }
-    Status Add(slice &key,slice &value){
+    TableBuilder(WritableFile* file,FilterPolicy* filterPolicy): TableBuilder(PolicyOptions(filterPolicy),file) {}
+    TableBuilder(const TableBuilder&) = delete;
+    TableBuilder& operator=(const TableBuilder&) = delete;
+    ~TableBuilder(){
+        delete rep_;
+    }
+    //key为internal key，必须按递增顺序添加
+    Status Add(const slice &key,const slice &value){
         Rep *r = rep_;
+        assert(!r->closed);
         //每写完一个block就往index_block中添加索引信息
         if(r->pending_index_entry){
             string encodeHandle;
-            r->pending_handle->EncodeTo(&encodeHandle);
+            r->pending_handle.EncodeTo(&encodeHandle);
             r->index_block.Add(rep_->last_key,encodeHandle);
             r->pending_index_entry = false;
         }
-        r->filter_block->AddKey(key);
+        if(r->filter_block != nullptr){
+            r->filter_block->AddKey(ExtractUserKey(key));
+        }else if(r->partitioned_filter != nullptr){
+            AddToPartitionedFilter(key);
+        }
+        UpdateProperties(key,value);
 
         r->last_key.assign(key.data(), key.size());
-        r->num_entries++;
-        r->data_block.Add(string(key.data()),string(value.data()));
+        r->data_block.Add(string(key.data(),key.size()),string(value.data(),value.size()));
         if(r->data_block.CurrentSizeEstimate() >= 1000){
             return Flush();
         }
         return OK;
     }
-    //将未写入的数据写入file，并刷入磁盘
+    //结束当前data block并写入file。block只进入file的用户态缓冲区，缓冲区满时才写出，
+    //sstable使用WritableFileOptions::ForTableFile()的大缓冲区时，多个block合并成一次write
     Status Flush(){
         Rep* r = rep_;
         if(r->data_block.Empty()){
             return OK;
         }
-        WriteBlock(r->data_block,r->pending_handle);
+        Status s = WriteBlock(r->data_block,&r->pending_handle);
+        if(s != OK){
+            return s;
+        }
+        r->props.data_size += r->pending_handle.size() + kBlockTrailerSize;
         r->pending_index_entry = true;
-        r->file->FlushBUffer();
-        r->filter_block->StartBlock(r->offset);
+        if(r->filter_block != nullptr){
+            r->filter_block->StartBlock(r->offset);
+        }else if(r->partitioned_filter != nullptr){
+            r->partitioned_filter->EndBlock(r->last_key);
+        }
         return OK;
     }
     
     Status WriteBlock(BlockBuilder &block,BlockHandle *handle){
+        //写入前调用Finish函数 将restarts数组和restartNum填入block
+        Status s = WriteRawBlock(block.Finish(),handle);
+        block.Reset();
+        return s;
+    }
+    Status WriteRawBlock(const slice& block_contents,BlockHandle *handle){
         Rep* r = rep_;
         //写入block数据
-        //写入前调用Finish函数 将restarts数组和restartNum填入block
-        slice block_contents = block.Finish();
-        r->file->Append(block_contents);
+        Status s = r->file->Append(block_contents);
+        if(s!=OK){
+            return s;
+        }
         //设置该组block在sstable的偏移量和大小
         handle->set_offset(r->offset);
         handle->set_size(block_contents.size());
         //加上crc校验数据
         char trailer[kBlockTrailerSize];
         uint32_t crc = crc32c::Value(block_contents.data(), block_contents.size());
-        crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
         coding::EncodeFixed32(trailer, crc32c::Mask(crc));
-        Status s= r->file->Append(slice(trailer, kBlockTrailerSize));
+        s= r->file->Append(slice(trailer, kBlockTrailerSize));
         if(s!=OK){
             return s;
         }
         //更新偏移量
         r->offset += block_contents.size() + kBlockTrailerSize;
-        r->data_block.Reset();
         return OK;
     }
-    //sstable的收尾阶段，将index_block写入file，然后再加footer写入file
+    //sstable的收尾阶段，依次写入filter_block、properties_block、metaindex_block、index_block，最后写footer
     Status Finish(){
         Rep *r = rep_;
-        Flush();
-        BlockHandle *indexHandle;
+        Status s = Flush();
+        if(s != OK){
+            return s;
+        }
+        assert(!r->closed);
+        r->closed = true;
+        //metaindex_block中的key需要有序，先收集再按序写入
+        std::map<std::string,std::string> meta_entries;
+        BlockBuilder metaindex_block;
+        BlockHandle properties_handle, metaindex_handle, index_handle;
+        s = WriteFilter(&meta_entries);
+        if(s != OK){
+            return s;
+        }
         if(r->pending_index_entry){
-            std::string *handleCoding;
-            r->pending_handle->EncodeTo(handleCoding);
-            r->index_block.Add(r->last_key,*handleCoding);
-            WriteBlock(r->index_block,indexHandle);
+            std::string handleCoding;
+            r->pending_handle.EncodeTo(&handleCoding);
+            r->index_block.Add(r->last_key,handleCoding);
+            r->pending_index_entry = false;
+        }
+        //index_block还未写入，先用估算值记录它的大小
+        r->props.index_size = r->index_block.CurrentSizeEstimate() + kBlockTrailerSize;
+        std::string props_encoding;
+        r->props.EncodeTo(&props_encoding);
+        s = WriteRawBlock(slice(props_encoding),&properties_handle);
+        if(s != OK){
+            return s;
+        }
+        properties_handle.EncodeTo(&meta_entries[kPropertiesBlockName]);
+        for(const auto& entry : meta_entries){
+            metaindex_block.Add(entry.first,entry.second);
+        }
+        s = WriteBlock(metaindex_block,&metaindex_handle);
+        if(s == OK){
+            s = WriteBlock(r->index_block,&index_handle);
+        }
+        if(s != OK){
+            return s;
+        }
+        //加入footer信息：存储着metaindex_block和index_block的偏移量和大小
+        Footer footer;
+        footer.set_metaindex_handle(metaindex_handle);
+        footer.set_index_handle(index_handle);
+        std::string footer_encoding;
+        footer.EncodeTo(&footer_encoding);
+        s = r->file->Append(slice(footer_encoding));
+        if(s == OK){
+            r->offset += footer_encoding.size();
+            s = r->file->FlushBUffer();
+        }
+        return s;
+    }
+    uint64_t NumEntries() const { return rep_->props.num_entries; }
+    uint64_t FileSize() const { return rep_->offset; }
+    const TableProperties& properties() const { return rep_->props; }
+    private:
+    static Options PolicyOptions(const FilterPolicy* filterPolicy){
+        Options options;
+        options.filter_policy = filterPolicy;
+        return options;
+    }
+    //写入filter相关的block，并把它们在metaindex_block中的条目放入meta_entries
+    Status WriteFilter(std::map<std::string,std::string>* meta_entries){
+        Rep* r = rep_;
+        Status s = OK;
+        BlockHandle handle;
+        if(r->filter_block != nullptr){
+            s = WriteRawBlock(r->filter_block->Finish(),&handle);
+            if(s != OK){
+                return s;
+            }
+            r->props.filter_size = handle.size() + kBlockTrailerSize;
+            handle.EncodeTo(&(*meta_entries)[string(kFilterBlockPrefix) + r->filter_policy->Name()]);
+            return OK;
+        }
+        if(r->partitioned_filter == nullptr){
+            return OK;
+        }
+        std::vector<PartitionedFilterBlockBuilder::Partition>* partitions = r->partitioned_filter->Finish();
+        if(partitions->empty()){
+            return OK;
+        }
+        if(partitions->size() == 1){
+            //小表只有一个分区，直接写成整表filter，查询时少读一次分区索引
+            s = WriteRawBlock(slice((*partitions)[0].filter),&handle);
+            if(s != OK){
+                return s;
+            }
+            r->props.filter_size = handle.size() + kBlockTrailerSize;
+            handle.EncodeTo(&(*meta_entries)[string(kFullFilterBlockPrefix) + r->filter_policy->Name()]);
+            return OK;
+        }
+        //各分区连续写在一起，最后写分区索引：key为分区覆盖的最大key，value为分区的handle
+        BlockBuilder partition_index;
+        for(auto& partition : *partitions){
+            s = WriteRawBlock(slice(partition.filter),&handle);
+            if(s != OK){
+                return s;
+            }
+            r->props.filter_size += handle.size() + kBlockTrailerSize;
+            string handle_encoding;
+            handle.EncodeTo(&handle_encoding);
+            partition_index.Add(partition.last_key,handle_encoding);
+        }
+        s = WriteBlock(partition_index,&handle);
+        if(s != OK){
+            return s;
+        }
+        r->props.filter_size += handle.size() + kBlockTrailerSize;
+        handle.EncodeTo(&(*meta_entries)[string(kPartitionedFilterBlockPrefix) + r->filter_policy->Name()]);
+        return OK;
+    }
+    //整表/分区filter中可以放完整的user key，也可以放user key的前缀。
+    //filter中不含sequence，同一user key的多个版本相邻，只加入一次
+    void AddToPartitionedFilter(const slice& key){
+        Rep* r = rep_;
+        const PrefixExtractor* extractor = r->options.prefix_extractor;
+        const slice user_key = ExtractUserKey(key);
+        if(extractor != nullptr){
+            if(extractor->InDomain(user_key)){
+                slice prefix = extractor->Transform(user_key);
+                if(r->props.num_entries == 0 || slice(r->last_prefix) != prefix){
+                    r->last_prefix.assign(prefix.data(),prefix.size());
+                    r->partitioned_filter->AddKey(prefix);
+                }
+            }
+        }
+        if(r->props.whole_key_filtering){
+            r->partitioned_filter->AddKey(user_key);
+        }
+    }
+    void UpdateProperties(const slice& key,const slice& value){
+        TableProperties& props = rep_->props;
+        if(props.num_entries == 0){
+            props.smallest_key.assign(key.data(),key.size());
+        }
+        props.largest_key.assign(key.data(),key.size());
+        props.num_entries++;
+        props.raw_key_size += key.size();
+        props.raw_value_size += value.size();
+        ParsedInternalKey parsed;
+        if(ParseInternalKey(key,&parsed)){
+            if(parsed.type == kTypeDeletion){
+                props.num_deletions++;
+            }
+            if(parsed.sequence < props.smallest_seqno) props.smallest_seqno = parsed.sequence;
+            if(parsed.sequence > props.largest_seqno) props.largest_seqno = parsed.sequence;
         }
-        //加入footer信息：存储着index_block的元数据，index_block的偏移量和大小。这些数据在index_block写入文件后产生。
-        string *indexCoding;
-        indexHandle->EncodeTo(indexCoding);
-        r->file->Append(slice(*indexCoding));
     }
 };
+
+//只读取footer、metaindex_block和properties_block来获取表属性，不会触碰任何data block
+inline Status ReadTableProperties(RandomAccessFile* file,uint64_t file_size,TableProperties* props){
+    if(file_size < Footer::kEncodedLength){
+        return Corruption;
+    }
+    char footer_space[Footer::kEncodedLength];
+    slice footer_input;
+    Status s = file->Read(file_size - Footer::kEncodedLength,&footer_input,footer_space,Footer::kEncodedLength);
+    if(s != OK){
+        return s;
+    }
+    Footer footer;
+    s = footer.DecodeFrom(&footer_input);
+    if(s != OK){
+        return s;
+    }
+    BlockContents contents;
+    s = ReadBlock(file,footer.metaindex_handle(),&contents);
+    if(s != OK){
+        return s;
+    }
+    Block metaindex(contents);
+    Iterator* iter = metaindex.NewIterator();
+    iter->Seek(kPropertiesBlockName);
+    if(!iter->Valid() || iter->key() != kPropertiesBlockName){
+        delete iter;
+        return NotFound;
+    }
+    string handle_value = iter->value();
+    delete iter;
+    slice handle_input(handle_value);
+    BlockHandle properties_handle;
+    s = properties_handle.DecodeFrom(&handle_input);
+    if(s != OK){
+        return s;
+    }
+    s = ReadBlock(file,properties_handle,&contents);
+    if(s != OK){
+        return s;
+    }
+    s = props->DecodeFrom(contents.data);
+    if(contents.heap_allocated){
+        delete[] contents.data.data();
+    }
+    return s;
+}
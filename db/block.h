@@ -2,35 +2,56 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cassert>
 #include "coding.h"
 #include "iterator.h"
 #include "env.h"
 using namespace std;
 static int groupSize = 20;
 
+//从文件中读出的一个block的内容
+struct BlockContents {
+    slice data;           // block的实际内容
+    bool cachable;        // 为true时可以放入block cache
+    bool heap_allocated;  // 为true时data由new[]分配，需要调用者delete[]
+};
+
 class Block{
 public:
+    //contents.heap_allocated为false时（例如数据直接指向mmap映射区），Block不负责释放内存
+    explicit Block(const BlockContents& contents)
+        :data(contents.data.data()),size(contents.data.size()),owned_(contents.heap_allocated){}
     Block(const Block&) = delete;       
     Block& operator=(const Block&) = delete;
-    ~Block() = default;
+    ~Block(){
+        if(owned_){
+            delete[] data;
+        }
+    }
     size_t get_size(){
         return this->size;
     }
+    //block的原始内容（例如filter分区直接按filter解析）
+    slice contents() const{
+        return slice(data,size);
+    }
     uint32_t restartNum(){
         return coding::DecodeFixed32(data+size-sizeof(uint32_t));
     }
+    //返回的迭代器在Block析构前有效，由调用者delete
+    Iterator* NewIterator();
 
 private:
-    char* data;
+    const char* data;
     size_t size;
-    uint32_t result_offset;
+    bool owned_;  // data是否由Block负责释放
 };
 class BlockBuilder{
 public:
-    BlockBuilder();
+    BlockBuilder():counter(0){}
     BlockBuilder(const BlockBuilder&) = delete;
     BlockBuilder& operator=(const BlockBuilder&) = delete;
-    ~BlockBuilder();
+    ~BlockBuilder() = default;
     void Add(const string& key, const string& value){
         //一组的首个元素
         if(counter ==0){
@@ -40,11 +61,11 @@ public:
             uint32_t value_size = value.size();
             char buf[4];
             coding::EncodeFixed32(buf,shared);
-            buffer.append(buf);
+            buffer.append(buf,sizeof(buf));
             coding::EncodeFixed32(buf,non_shared);
-            buffer.append(buf);   
+            buffer.append(buf,sizeof(buf));   
             coding::EncodeFixed32(buf,value_size);
-            buffer.append(buf);
+            buffer.append(buf,sizeof(buf));
             buffer.append(key);
             buffer.append(value);
         }else{
@@ -61,11 +82,11 @@ public:
 
             char buf[4];
             coding::EncodeFixed32(buf,shared);
-            buffer.append(buf);
+            buffer.append(buf,sizeof(buf));
             coding::EncodeFixed32(buf,non_shared);
-            buffer.append(buf);   
+            buffer.append(buf,sizeof(buf));   
             coding::EncodeFixed32(buf,value_size);
-            buffer.append(buf);
+            buffer.append(buf,sizeof(buf));
             buffer.append(key.substr(shared));
             buffer.append(value);
         }
@@ -80,11 +101,11 @@ public:
         for(auto restart : restarts_){
             char buf[4];
             coding::EncodeFixed32(buf,restart);
-            buffer.append(buf);
+            buffer.append(buf,sizeof(buf));
         }
         char buf[4];
         coding::EncodeFixed32(buf,restarts_.size());
-        buffer.append(buf);
+        buffer.append(buf,sizeof(buf));
         finished = true;
         return slice(buffer);
     }
@@ -113,12 +134,21 @@ public:
 };
 
 //迭代器，用于遍历block中的entry
-class blockIter : Iterator{
+class blockIter : public Iterator{
 public:
-    blockIter(char* data, uint32_t restarts_num):data(data),restarts_num(restarts_num),current(0),restart_index(restarts_num-1){
-        restarts = coding::DecodeFixed32(data+size-restarts_num*sizeof(uint32_t)-sizeof(uint32_t));
-        SeekToFirst();
-
+    //data[0,size-1]是BlockBuilder::Finish生成的完整block
+    blockIter(const char* data, size_t size):data(data),restarts_num(0),restart_index(0),restarts(0){
+        if(size >= sizeof(uint32_t)){
+            restarts_num = coding::DecodeFixed32(data+size-sizeof(uint32_t));
+            size_t max_restarts = (size-sizeof(uint32_t))/sizeof(uint32_t);
+            if(restarts_num <= max_restarts){
+                restarts = size-(restarts_num+1)*sizeof(uint32_t);
+            }else{
+                restarts_num = 0;
+            }
+        }
+        current = restarts;
+        next_ = restarts;
     }
     blockIter(const blockIter&) = delete;
     blockIter& operator=(const blockIter&) = delete;
@@ -126,93 +156,75 @@ public:
 
     }
     bool Valid() const{
-
+        return current < restarts;
     }
 
     void SeekToFirst(){
-        current = coding::DecodeFixed32(data+restarts);
-        Next();
+        if(restarts_num == 0){
+            current = restarts;
+            return;
+        }
+        SeekToRestartPoint(0);
+        parseNext();
     }
     void SeekToLast(){
-        restart_index = restarts_num-1;
-        //找到最后一个restarts数组的索引
-        current = coding::DecodeFixed32(data+restarts+(restarts_num-1)*sizeof(uint32_t));
-        char* limit = data+restarts;
-        while(data+current<limit){
-            Next();
+        if(restarts_num == 0){
+            current = restarts;
+            return;
+        }
+        SeekToRestartPoint(restarts_num-1);
+        //从最后一个restart点开始往后解析，直到最后一个键值对
+        while(parseNext() && next_ < restarts){
         }
     }
     void Seek(const string& target){
-        //二分查找
-        int left=0;
-        int right = restarts_num-1;
-        while(left<=right){
-            int mid = (left+right)/2;
-            uint32_t offset = coding::DecodeFixed32(data+restarts+mid*sizeof(uint32_t));
-            char* ptr = data+offset;
-            uint32_t shared = coding::DecodeFixed32(ptr);
+        if(restarts_num == 0){
+            current = restarts;
+            return;
+        }
+        //二分查找最后一个key小于target的restart点
+        uint32_t left = 0;
+        uint32_t right = restarts_num-1;
+        while(left<right){
+            uint32_t mid = (left+right+1)/2;
+            const char* ptr = data+GetRestartPoint(mid);
             uint32_t non_shared = coding::DecodeFixed32(ptr+sizeof(uint32_t));
-            ptr += 3*sizeof(uint32_t);
             //每组的第一个元素没有共享键
-            string key = string(ptr,non_shared);
+            string key = string(ptr+3*sizeof(uint32_t),non_shared);
             if(key<target){
-                left = mid+1;
+                left = mid;
             }else{
                 right = mid-1;
             }
         }
-        //right是我们要找的restarts数组的索引
-        restart_index = right;
-        //找到了restarts数组的索引，接下来要找到target所在的键值对  
-        current = coding::DecodeFixed32(data+restarts+right*sizeof(uint32_t));
+        SeekToRestartPoint(left);
         //在该起始位置开始遍历，直到找到大于等于target的键值对
-        for(;;){
-            Next();
+        while(parseNext()){
             if(key_>=target){
-                break;
+                return;
             }
         }
-
     }
     void Next(){
+        assert(Valid());
         parseNext();
-        current += key_.size()+value_.size()+3*sizeof(uint32_t);
     }
-    void parseNext(){
-        char* ptr = data+current;
-        char* limit = data+restarts;
-        if(ptr>=limit){
-            return;
-        }
-        uint32_t shared = coding::DecodeFixed32(ptr);
-        uint32_t non_shared = coding::DecodeFixed32(ptr+sizeof(uint32_t));
-        uint32_t value_size = coding::DecodeFixed32(ptr+2*sizeof(uint32_t));
-        ptr += 3*sizeof(uint32_t);
-        key_.resize(shared);
-        key_.append(ptr+shared,non_shared);
-        value_ = string(ptr+non_shared,value_size);
-        //更新restart_index
-        while(restart_index+1<restarts_num){
-            if(coding::DecodeFixed32(data+restarts+(restart_index+1)*sizeof(uint32_t))<current){
-                restart_index++;
-            }else{
-                break;
+    void Prev(){
+        assert(Valid());
+        const uint32_t original = current;
+        //找到current之前的restart点
+        while(GetRestartPoint(restart_index) >= original){
+            if(restart_index == 0){
+                current = restarts;
+                next_ = restarts;
+                return;
             }
+            restart_index--;
+        }
+        SeekToRestartPoint(restart_index);
+        while(parseNext() && next_ < original){
         }
     }
-    // void Prev()
-    // {
-    //     string temp_key = key_;
-    //     current= coding::DecodeFixed32(data+restarts+(restart_index-1)*sizeof(uint32_t));
-    //     for(;;){
-    //         parseNext();
-    //         if(key_>=temp_key){
-    //             break;
-    //         }
-    //     }
-
-
-    // }
     string key() const{
         return key_;
 
@@ -220,16 +232,52 @@ public:
     string value() const{
         return value_;
     }
+    string status() const{
+        return string();
+    }
 private:
-    char* data;
-    uint32_t current;//当前键值对在data中的偏移量
+    uint32_t GetRestartPoint(uint32_t index) const{
+        return coding::DecodeFixed32(data+restarts+index*sizeof(uint32_t));
+    }
+    void SeekToRestartPoint(uint32_t index){
+        key_.clear();
+        restart_index = index;
+        next_ = GetRestartPoint(index);
+    }
+    //解析next_处的键值对，成功返回true；到达restarts数组时迭代器失效
+    bool parseNext(){
+        current = next_;
+        if(current >= restarts){
+            current = restarts;
+            return false;
+        }
+        const char* ptr = data+current;
+        uint32_t shared = coding::DecodeFixed32(ptr);
+        uint32_t non_shared = coding::DecodeFixed32(ptr+sizeof(uint32_t));
+        uint32_t value_size = coding::DecodeFixed32(ptr+2*sizeof(uint32_t));
+        ptr += 3*sizeof(uint32_t);
+        key_.resize(shared);
+        key_.append(ptr,non_shared);
+        value_ = string(ptr+non_shared,value_size);
+        next_ = current+3*sizeof(uint32_t)+non_shared+value_size;
+        //更新restart_index
+        while(restart_index+1<restarts_num && GetRestartPoint(restart_index+1)<=current){
+            restart_index++;
+        }
+        return true;
+    }
+    const char* data;
+    uint32_t current;//当前键值对在data中的偏移量，等于restarts时迭代器无效
+    uint32_t next_;//下一个键值对在data中的偏移量
     uint32_t restarts_num;//restarts数组的大小
     uint32_t restart_index;//当前键值对所在restarts数组的索引
-    uint32_t restarts;//restarts数组的首地址
+    uint32_t restarts;//restarts数组在data中的偏移量
     string key_;
     string value_;
-    int size;
 };
+inline Iterator* Block::NewIterator(){
+    return new blockIter(data,size);
+}
 class BlockHandle {
     public:
      // Maximum encoding length of a BlockHandle
@@ -248,8 +296,12 @@ class BlockHandle {
         coding::PutFixed64(dst,size_);
      }
      Status DecodeFrom(slice* input){
+        if(input->size() < 16){
+            return Corruption;
+        }
         offset_ = coding::DecodeFixed64(input->data_);
         size_ = coding::DecodeFixed64(input->data_ + 8);
+        return OK;
      }
    
     private:
@@ -1,51 +1,62 @@
+#pragma once
 #include <stddef.h>
 #include <cstdint>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "env.h"
+#include "filterPolicy.h"
 #include "tableCache.h"
+#include "hash64.h"
 static uint32_t BloomHash(const slice& key) {
 return Hash(key.data(), key.size(), 0xbc9f1d34);
 }
   
-class BloomFilterPolicy {
+class BloomFilterPolicy : public FilterPolicy {
 public:
-explicit BloomFilterPolicy(int bits_per_key) : bits_per_key_(bits_per_key) {
+// format_version 1 hashes keys with the 32-bit Hash().  Version 2 uses
+// Hash64(), whose 64 bits keep the false positive rate of filters with
+// billions of bits at its theoretical value, and maps probes with a
+// multiply instead of a modulo.  The two versions have different names, so
+// a table written with one is read without a filter by the other.
+explicit BloomFilterPolicy(int bits_per_key, int format_version = 1)
+    : bits_per_key_(bits_per_key), format_version_(format_version) {
     // We intentionally round down to reduce probing cost a little bit
     k_ = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
     if (k_ < 1) k_ = 1;
     if (k_ > 30) k_ = 30;
 }
 
-const char* Name() const { return "leveldb.BuiltinBloomFilter2"; }
+const char* Name() const override {
+    return format_version_ >= 2 ? "leveldb.BuiltinBloomFilter64" : "leveldb.BuiltinBloomFilter2";
+}
 
-void CreateFilter(const slice* keys, int n, std::string* dst) const {
-    // Compute bloom filter size (in both bits and bytes)
-    size_t bits = n * bits_per_key_;
+void CreateFilter(const slice* keys, int n, std::string* dst) const override {
+    size_t bits;
+    char* array = InitFilter(n, dst, &bits);
+    for (int i = 0; i < n; i++) {
+        AddHash(HashKey(keys[i]), array, bits);
+    }
+}
 
-    // For small n, we can see a very high false positive rate.  Fix it
-    // by enforcing a minimum bloom filter length.
-    if (bits < 64) bits = 64;
+bool SupportsKeyHashes() const override { return true; }
 
-    size_t bytes = (bits + 7) / 8;
-    bits = bytes * 8;
+uint64_t HashKey(const slice& key) const override {
+    if (format_version_ >= 2) return Hash64(key.data(), key.size(), kBloomSeed);
+    return BloomHash(key);
+}
 
-    const size_t init_size = dst->size();
-    dst->resize(init_size + bytes, 0);
-    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
-    char* array = &(*dst)[init_size];
+void CreateFilterFromHashes(const uint64_t* hashes, int n,
+                            std::string* dst) const override {
+    size_t bits;
+    char* array = InitFilter(n, dst, &bits);
     for (int i = 0; i < n; i++) {
-    // Use double-hashing to generate a sequence of hash values.
-    // See analysis in [Kirsch,Mitzenmacher 2006].
-        uint32_t h = BloomHash(keys[i]);
-        const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
-        for (size_t j = 0; j < k_; j++) {
-            const uint32_t bitpos = h % bits;
-            array[bitpos / 8] |= (1 << (bitpos % 8));
-            h += delta;
-        }
+        AddHash(hashes[i], array, bits);
     }
 }
 
-bool KeyMayMatch(const slice& key, const slice& bloom_filter) const {
+bool KeyMayMatch(const slice& key, const slice& bloom_filter) const override {
     const size_t len = bloom_filter.size();
     if (len < 2) return false;
 
@@ -61,6 +72,9 @@ bool KeyMayMatch(const slice& key, const slice& bloom_filter) const {
         return true;
     }
 
+    if (format_version_ >= 2) {
+        return HashMayMatch64(Hash64(key.data(), key.size(), kBloomSeed), array, bits, k);
+    }
     uint32_t h = BloomHash(key);
     const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
     for (size_t j = 0; j < k; j++) {
@@ -71,7 +85,302 @@ bool KeyMayMatch(const slice& key, const slice& bloom_filter) const {
     return true;
 }
 
-private:
+void KeysMayMatch(const slice* keys, int n, const slice& bloom_filter,
+                  bool* results) const override {
+    const size_t len = bloom_filter.size();
+    const char* array = bloom_filter.data();
+    if (len < 2 || static_cast<size_t>(array[len - 1]) > 30) {
+        FilterPolicy::KeysMayMatch(keys, n, bloom_filter, results);
+        return;
+    }
+    const size_t bits = (len - 1) * 8;
+    const size_t k = array[len - 1];
+    if (format_version_ >= 2) {
+        uint64_t hashes[kFilterBatchSize];
+        for (int start = 0; start < n; start += kFilterBatchSize) {
+            const int count = std::min(n - start, kFilterBatchSize);
+            for (int i = 0; i < count; i++) {
+                hashes[i] = Hash64(keys[start + i].data(), keys[start + i].size(), kBloomSeed);
+                PrefetchForRead(array + FastRange64(hashes[i], bits) / 8);
+            }
+            for (int i = 0; i < count; i++) {
+                results[start + i] = HashMayMatch64(hashes[i], array, bits, k);
+            }
+        }
+        return;
+    }
+    uint32_t hashes[kFilterBatchSize];
+    for (int start = 0; start < n; start += kFilterBatchSize) {
+        const int count = std::min(n - start, kFilterBatchSize);
+        // Probes are spread over the whole filter, so only the first probe
+        // of each key can be prefetched; it is also the one most likely to
+        // reject the key.
+        for (int i = 0; i < count; i++) {
+            hashes[i] = BloomHash(keys[start + i]);
+            PrefetchForRead(array + (hashes[i] % bits) / 8);
+        }
+        for (int i = 0; i < count; i++) {
+            uint32_t h = hashes[i];
+            const uint32_t delta = (h >> 17) | (h << 15);
+            bool match = true;
+            for (size_t j = 0; j < k; j++) {
+                const uint32_t bitpos = h % bits;
+                if ((array[bitpos / 8] & (1 << (bitpos % 8))) == 0) {
+                    match = false;
+                    break;
+                }
+                h += delta;
+            }
+            results[start + i] = match;
+        }
+    }
+}
+
+protected:
+static const uint64_t kBloomSeed = 0xbc9f1d34;
+
 size_t bits_per_key_;
 size_t k_;
+int format_version_;
+
+private:
+// Appends a zeroed filter sized for n keys plus its probe count to *dst
+// and returns the bit array; *bits is its size in bits.
+char* InitFilter(int n, std::string* dst, size_t* bits) const {
+    // Compute bloom filter size (in both bits and bytes)
+    *bits = n * bits_per_key_;
+
+    // For small n, we can see a very high false positive rate.  Fix it
+    // by enforcing a minimum bloom filter length.
+    if (*bits < 64) *bits = 64;
+
+    size_t bytes = (*bits + 7) / 8;
+    *bits = bytes * 8;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + bytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    return &(*dst)[init_size];
+}
+
+void AddHash(uint64_t hash, char* array, size_t bits) const {
+    // Use double-hashing to generate a sequence of hash values.
+    // See analysis in [Kirsch,Mitzenmacher 2006].
+    if (format_version_ >= 2) {
+        uint64_t h = hash;
+        const uint64_t delta = (h >> 33) | (h << 31);  // Rotate right 33 bits
+        for (size_t j = 0; j < k_; j++) {
+            const uint64_t bitpos = FastRange64(h, bits);
+            array[bitpos / 8] |= (1 << (bitpos % 8));
+            h += delta;
+        }
+        return;
+    }
+    uint32_t h = static_cast<uint32_t>(hash);
+    const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+    for (size_t j = 0; j < k_; j++) {
+        const uint32_t bitpos = h % bits;
+        array[bitpos / 8] |= (1 << (bitpos % 8));
+        h += delta;
+    }
+}
+
+static bool HashMayMatch64(uint64_t h, const char* array, size_t bits, size_t k) {
+    const uint64_t delta = (h >> 33) | (h << 31);  // Rotate right 33 bits
+    for (size_t j = 0; j < k; j++) {
+        const uint64_t bitpos = FastRange64(h, bits);
+        if ((array[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+        h += delta;
+    }
+    return true;
+}
+};
+
+// A Bloom filter that confines all probes of a key to one 64-byte cache
+// line, so a negative lookup costs a single memory access instead of k
+// scattered ones.  The hash picks the line, a remixed hash generates up to
+// 16 probe positions of 9 bits each inside the 512-bit line.  With AVX2
+// eight probes are computed and tested at once.
+//
+// Filter layout: num_lines * 64 bytes of bits, followed by one byte holding
+// the number of probes.  It has its own name so it can coexist with
+// "leveldb.BuiltinBloomFilter2".
+class CacheLocalBloomFilterPolicy : public BloomFilterPolicy {
+public:
+static const size_t kCacheLineSize = 64;
+static const size_t kMaxProbes = 16;
+
+explicit CacheLocalBloomFilterPolicy(int bits_per_key, int format_version = 1)
+    : BloomFilterPolicy(bits_per_key, format_version) {
+    if (k_ > kMaxProbes) k_ = kMaxProbes;
+}
+
+const char* Name() const override {
+    return format_version_ >= 2 ? "leveldb.CacheLocalBloomFilter64" : "leveldb.CacheLocalBloomFilter";
+}
+
+void CreateFilter(const slice* keys, int n, std::string* dst) const override {
+    size_t num_lines;
+    char* array = InitFilter(n, dst, &num_lines);
+    for (int i = 0; i < n; i++) {
+        AddHash(HashKey(keys[i]), array, num_lines);
+    }
+}
+
+void CreateFilterFromHashes(const uint64_t* hashes, int n,
+                            std::string* dst) const override {
+    size_t num_lines;
+    char* array = InitFilter(n, dst, &num_lines);
+    for (int i = 0; i < n; i++) {
+        AddHash(hashes[i], array, num_lines);
+    }
+}
+
+bool KeyMayMatch(const slice& key, const slice& bloom_filter) const override {
+    const size_t len = bloom_filter.size();
+    if (len < kCacheLineSize + 1 || (len - 1) % kCacheLineSize != 0) {
+        return true;  // Not a filter we wrote; consider it a match.
+    }
+    const char* array = bloom_filter.data();
+    const size_t k = static_cast<uint8_t>(array[len - 1]);
+    if (k > kMaxProbes) return true;
+    const size_t num_lines = (len - 1) / kCacheLineSize;
+
+    size_t line_index;
+    uint32_t h2;
+    LocateKey(key, num_lines, &line_index, &h2);
+    return LineMayMatch(array + line_index * kCacheLineSize, h2, k);
+}
+
+void KeysMayMatch(const slice* keys, int n, const slice& bloom_filter,
+                  bool* results) const override {
+    const size_t len = bloom_filter.size();
+    const char* array = bloom_filter.data();
+    if (len < kCacheLineSize + 1 || (len - 1) % kCacheLineSize != 0 ||
+        static_cast<uint8_t>(array[len - 1]) > kMaxProbes) {
+        FilterPolicy::KeysMayMatch(keys, n, bloom_filter, results);
+        return;
+    }
+    const size_t k = static_cast<uint8_t>(array[len - 1]);
+    const size_t num_lines = (len - 1) / kCacheLineSize;
+    const char* lines[kFilterBatchSize];
+    uint32_t probe_hashes[kFilterBatchSize];
+    for (int start = 0; start < n; start += kFilterBatchSize) {
+        const int count = std::min(n - start, kFilterBatchSize);
+        for (int i = 0; i < count; i++) {
+            size_t line_index;
+            LocateKey(keys[start + i], num_lines, &line_index, &probe_hashes[i]);
+            lines[i] = array + line_index * kCacheLineSize;
+            // The filter is not 64-byte aligned in memory, so a line may
+            // straddle two hardware cache lines.
+            PrefetchForRead(lines[i]);
+            PrefetchForRead(lines[i] + kCacheLineSize - 1);
+        }
+        for (int i = 0; i < count; i++) {
+            results[start + i] = LineMayMatch(lines[i], probe_hashes[i], k);
+        }
+    }
+}
+
+private:
+static const uint32_t kGoldenRatio = 0x9e3779b9;
+
+// Maps h onto [0, num_lines) using its high bits, which are not used by
+// the probe positions.
+static size_t LineIndex(uint32_t h, size_t num_lines) {
+    return static_cast<size_t>((static_cast<uint64_t>(h) * num_lines) >> 32);
+}
+
+char* InitFilter(int n, std::string* dst, size_t* num_lines) const {
+    size_t bits = n * bits_per_key_;
+    *num_lines = (bits + kCacheLineSize * 8 - 1) / (kCacheLineSize * 8);
+    if (*num_lines == 0) *num_lines = 1;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + *num_lines * kCacheLineSize, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    return &(*dst)[init_size];
+}
+
+void AddHash(uint64_t hash, char* array, size_t num_lines) const {
+    size_t line_index;
+    uint32_t h2;
+    LocateHash(hash, num_lines, &line_index, &h2);
+    char* line = array + line_index * kCacheLineSize;
+    for (size_t j = 0; j < k_; j++) {
+        const uint32_t bitpos = h2 >> (32 - 9);
+        line[bitpos / 8] |= (1 << (bitpos % 8));
+        h2 *= kGoldenRatio;
+    }
+}
+
+void LocateKey(const slice& key, size_t num_lines, size_t* line_index,
+               uint32_t* probe_hash) const {
+    LocateHash(HashKey(key), num_lines, line_index, probe_hash);
+}
+
+// Picks the line of a key and the hash its probe positions are drawn from.
+// Version 2 takes both from one Hash64(): the line from the high bits (via
+// FastRange64) and the probes from the low 32 bits.
+void LocateHash(uint64_t hash, size_t num_lines, size_t* line_index,
+                uint32_t* probe_hash) const {
+    if (format_version_ >= 2) {
+        *line_index = FastRange64(hash, num_lines);
+        *probe_hash = static_cast<uint32_t>(hash);
+        return;
+    }
+    const uint32_t h = static_cast<uint32_t>(hash);
+    *line_index = LineIndex(h, num_lines);
+    *probe_hash = ProbeHash(h);
+}
+
+// Remixes h (murmur3 finalizer) so probe positions within a line are
+// independent of the line choice.
+static uint32_t ProbeHash(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+#ifdef __AVX2__
+static bool LineMayMatch(const char* line, uint32_t h2, size_t k) {
+    // kGoldenRatio^0..7, so lane i holds the same value as the scalar
+    // loop after i multiplications.
+    const __m256i multipliers = _mm256_setr_epi32(
+        0x00000001, 0x9e3779b9, 0xe35e67b1, 0x734297e9,
+        0x35fbe861, 0xdeb7c719, 0x0448b211, 0x3459b749);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i ones = _mm256_set1_epi32(1);
+    const int* words = reinterpret_cast<const int*>(line);
+    for (size_t done = 0; done < k; done += 8) {
+        __m256i hashes = _mm256_mullo_epi32(_mm256_set1_epi32(h2), multipliers);
+        // Top 4 bits select the 32-bit word, the next 5 the bit within it.
+        __m256i word_index = _mm256_srli_epi32(hashes, 28);
+        __m256i bit_index = _mm256_and_si256(_mm256_srli_epi32(hashes, 23),
+                                             _mm256_set1_epi32(31));
+        __m256i bits = _mm256_sllv_epi32(ones, bit_index);
+        // Lanes past the k-th probe test nothing.
+        __m256i active = _mm256_cmpgt_epi32(
+            _mm256_set1_epi32(static_cast<int>(k - done)), lane);
+        bits = _mm256_and_si256(bits, active);
+        __m256i values = _mm256_i32gather_epi32(words, word_index, 4);
+        if (!_mm256_testc_si256(values, bits)) return false;
+        // kGoldenRatio^8
+        h2 *= 0xab25f4c1;
+    }
+    return true;
+}
+#else
+static bool LineMayMatch(const char* line, uint32_t h2, size_t k) {
+    for (size_t j = 0; j < k; j++) {
+        const uint32_t bitpos = h2 >> (32 - 9);
+        if ((line[bitpos / 8] & (1 << (bitpos % 8))) == 0) return false;
+        h2 *= kGoldenRatio;
+    }
+    return true;
+}
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "env.h"
+//缓存的抽象接口，把key映射到value，按charge之和限制容量。
+//ShardedLRUCache（tableCache.h）和ClockCache（clockCache.h）实现了该接口，
+//使用者只依赖Cache，可以在两种实现之间切换。实现必须是线程安全的
+class Cache {
+public:
+    //缓存条目的不透明句柄
+    struct Handle {};
+
+    //HIGH优先级的条目（index/filter block）保存在高优先级池中，
+    //只有低优先级的条目都被淘汰、或高优先级池超出其容量时才会被淘汰，
+    //因此大范围扫描读入的大量data block不会把它们挤出缓存
+    enum class Priority { HIGH, LOW };
+
+    Cache() = default;
+    Cache(const Cache&) = delete;
+    Cache& operator=(const Cache&) = delete;
+    //调用所有剩余条目的deleter
+    virtual ~Cache() = default;
+
+    //插入key->value并返回该条目的句柄，调用者用完后必须调用Release。
+    //条目被淘汰或移除且不再被引用时，调用deleter(key, value)
+    virtual Handle* Insert(const slice& key, void* value, size_t charge,
+                           void (*deleter)(const slice& key, void* value),
+                           Priority priority = Priority::LOW) = 0;
+    //没有key对应的条目时返回nullptr，否则返回句柄，用完后必须调用Release
+    virtual Handle* Lookup(const slice& key) = 0;
+    //释放Insert或Lookup返回的句柄
+    virtual void Release(Handle* handle) = 0;
+    //返回句柄对应的value，句柄必须尚未Release
+    virtual void* Value(Handle* handle) = 0;
+    //移除key对应的条目，已有的句柄在Release之前仍然有效
+    virtual void Erase(const slice& key) = 0;
+    //返回一个新的数字id，共享同一个缓存的多个使用者用它作为key的前缀来区分各自的key
+    virtual uint64_t NewId() = 0;
+    //移除所有未被引用的条目
+    virtual void Prune() {}
+    //缓存中所有条目的charge之和
+    virtual size_t TotalCharge() const = 0;
+};
@@ -0,0 +1,290 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include "env.h"
+#include "cache.h"
+#include "hash64.h"
+//基于CLOCK淘汰的无锁缓存，接口与ShardedLRUCache相同。
+//ShardedLRUCache每次Lookup都要加锁，把条目在lru_和in_use_两个链表之间移动；
+//被所有读线程访问的热点index/filter block会让这把锁成为瓶颈。
+//ClockCache使用开放寻址的哈希表，每个槽位的状态、引用计数和CLOCK计数打包在一个原子变量中，
+//Lookup/Release只需要一次CAS或原子减，不加任何锁。
+//
+//槽位数在构造时按capacity/estimated_value_charge确定且不再扩容，
+//表满时Insert返回的句柄不进入缓存（与capacity为0时的LRUCache相同）。
+//同一个key被并发Insert时可能短暂存在两个条目，Lookup返回其中任意一个
+class ClockCache : public Cache {
+public:
+    ClockCache(size_t capacity, size_t estimated_value_charge)
+        : capacity_(capacity), usage_(0), clock_hand_(0), last_id_(0) {
+        if (estimated_value_charge == 0) {
+            estimated_value_charge = 1;
+        }
+        //负载因子不超过0.7，保证探测序列较短
+        const size_t wanted = static_cast<size_t>(capacity / estimated_value_charge / 0.7) + 1;
+        size_t length = 16;
+        while (length < wanted) {
+            length *= 2;
+        }
+        mask_ = length - 1;
+        table_ = new ClockHandle[length];
+    }
+    ~ClockCache() override {
+        for (size_t i = 0; i <= mask_; i++) {
+            ClockHandle* e = &table_[i];
+            const uint64_t state = StateOf(e->meta.load(std::memory_order_relaxed));
+            if (state == kVisible || state == kInvisible) {
+                assert(RefsOf(e->meta.load(std::memory_order_relaxed)) == 0);  // 调用者有未释放的句柄
+                (*e->deleter)(e->key(), e->value);
+                free(e->key_data);
+            }
+        }
+        delete[] table_;
+    }
+
+    //CLOCK没有独立的高优先级池，HIGH优先级的条目以最大的CLOCK计数插入，需要多转几圈才会被淘汰
+    Handle* Insert(const slice& key, void* value, size_t charge,
+                   void (*deleter)(const slice& key, void* value),
+                   Priority priority = Priority::LOW) override {
+        const uint64_t h = Hash64(key.data(), key.size(), 0);
+        Erase(key, h);  // 与LRUCache一样，新条目替换旧条目
+        if (capacity_ > 0) {
+            EvictFor(charge);
+            for (size_t i = 0; i <= mask_; i++) {
+                const size_t index = ProbeIndex(h, i);
+                ClockHandle* e = &table_[index];
+                uint64_t m = e->meta.load(std::memory_order_acquire);
+                if (StateOf(m) == kEmpty &&
+                    e->meta.compare_exchange_strong(m, MakeMeta(kConstruction, 0, 0),
+                                                    std::memory_order_acq_rel)) {
+                    Fill(e, key, value, charge, deleter);
+                    e->hash.store(h, std::memory_order_relaxed);
+                    usage_.fetch_add(charge, std::memory_order_relaxed);
+                    //发布条目：一个引用属于返回的句柄
+                    const uint64_t clock = priority == Priority::HIGH ? kMaxClock : kInitialClock;
+                    e->meta.store(MakeMeta(kVisible, clock, 1), std::memory_order_release);
+                    return reinterpret_cast<Handle*>(e);
+                }
+                //记录有条目越过了这个槽位，Lookup不能在这里停止探测
+                e->displacements.fetch_add(1, std::memory_order_release);
+            }
+            //表已满，撤销所有槽位上的displacements
+            for (size_t i = 0; i <= mask_; i++) {
+                table_[i].displacements.fetch_sub(1, std::memory_order_release);
+            }
+        }
+        //不缓存，返回一个独立的句柄，Release时直接释放
+        ClockHandle* e = new ClockHandle;
+        Fill(e, key, value, charge, deleter);
+        e->detached = true;
+        e->meta.store(MakeMeta(kInvisible, 0, 1), std::memory_order_release);
+        return reinterpret_cast<Handle*>(e);
+    }
+
+    Handle* Lookup(const slice& key) override {
+        const uint64_t h = Hash64(key.data(), key.size(), 0);
+        for (size_t i = 0; i <= mask_; i++) {
+            ClockHandle* e = &table_[ProbeIndex(h, i)];
+            if (e->hash.load(std::memory_order_relaxed) == h && TryRef(e)) {
+                //持有引用后条目不会被释放或重用，可以安全地比较key
+                if (e->hash.load(std::memory_order_relaxed) == h && key == e->key()) {
+                    return reinterpret_cast<Handle*>(e);
+                }
+                Unref(e);
+            }
+            if (e->displacements.load(std::memory_order_acquire) == 0) {
+                break;
+            }
+        }
+        return nullptr;
+    }
+
+    void Release(Handle* handle) override {
+        Unref(reinterpret_cast<ClockHandle*>(handle));
+    }
+
+    void* Value(Handle* handle) override {
+        return reinterpret_cast<ClockHandle*>(handle)->value;
+    }
+
+    void Erase(const slice& key) override {
+        Erase(key, Hash64(key.data(), key.size(), 0));
+    }
+
+    uint64_t NewId() override {
+        return last_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    void Prune() override {
+        for (size_t i = 0; i <= mask_; i++) {
+            ClockHandle* e = &table_[i];
+            uint64_t m = e->meta.load(std::memory_order_acquire);
+            if (StateOf(m) == kVisible && RefsOf(m) == 0 &&
+                e->meta.compare_exchange_strong(m, MakeMeta(kConstruction, 0, 0),
+                                                std::memory_order_acq_rel)) {
+                FreeEntry(e);
+            }
+        }
+    }
+
+    size_t TotalCharge() const override {
+        return usage_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void Erase(const slice& key, uint64_t h) {
+        for (size_t i = 0; i <= mask_; i++) {
+            ClockHandle* e = &table_[ProbeIndex(h, i)];
+            if (e->hash.load(std::memory_order_relaxed) == h && TryRef(e)) {
+                if (e->hash.load(std::memory_order_relaxed) == h && key == e->key()) {
+                    //标记为不可见，最后一个引用释放时回收
+                    uint64_t m = e->meta.load(std::memory_order_acquire);
+                    while (StateOf(m) == kVisible &&
+                           !e->meta.compare_exchange_weak(m, WithState(m, kInvisible),
+                                                          std::memory_order_acq_rel)) {
+                    }
+                }
+                Unref(e);
+            }
+            if (e->displacements.load(std::memory_order_acquire) == 0) {
+                break;
+            }
+        }
+    }
+
+    //meta的布局：低32位为引用计数，32-33位为CLOCK计数，34-35位为状态
+    enum State : uint64_t {
+        kEmpty = 0,         // 空槽位
+        kConstruction = 1,  // 正在被某个线程写入或回收，其他线程不能访问
+        kVisible = 2,       // 在缓存中，可以被Lookup找到
+        kInvisible = 3,     // 已被Erase（或不在缓存中的独立句柄），等待最后一个引用释放
+    };
+    static const uint64_t kRefMask = 0xffffffffull;
+    static const int kClockShift = 32;
+    static const uint64_t kClockMask = 3ull << kClockShift;
+    static const int kStateShift = 34;
+    static const uint64_t kMaxClock = 3;      // Lookup命中后设置的CLOCK计数
+    static const uint64_t kInitialClock = 1;  // 新插入的条目只被访问过一次，更容易被淘汰
+
+    //按cache line对齐，不同槽位的meta不会互相干扰
+    struct alignas(64) ClockHandle {
+        std::atomic<uint64_t> meta{0};
+        //探测序列越过该槽位的条目数，为0时Lookup可以停止探测
+        std::atomic<uint32_t> displacements{0};
+        std::atomic<uint64_t> hash{0};
+        void* value = nullptr;
+        void (*deleter)(const slice& key, void* value) = nullptr;
+        size_t charge = 0;
+        char* key_data = nullptr;
+        size_t key_length = 0;
+        bool detached = false;  // 不在表中的独立句柄
+
+        slice key() const { return slice(key_data, key_length); }
+    };
+
+    static uint64_t StateOf(uint64_t m) { return m >> kStateShift; }
+    static uint64_t RefsOf(uint64_t m) { return m & kRefMask; }
+    static uint64_t ClockOf(uint64_t m) { return (m & kClockMask) >> kClockShift; }
+    static uint64_t MakeMeta(uint64_t state, uint64_t clock, uint64_t refs) {
+        return (state << kStateShift) | (clock << kClockShift) | refs;
+    }
+    static uint64_t WithState(uint64_t m, uint64_t state) {
+        return (m & ~(3ull << kStateShift)) | (state << kStateShift);
+    }
+
+    //双重哈希的探测序列，步长为奇数，能遍历2的幂大小的整张表
+    size_t ProbeIndex(uint64_t h, size_t i) const {
+        return static_cast<size_t>(h + i * ((h >> 32) | 1)) & mask_;
+    }
+
+    static void Fill(ClockHandle* e, const slice& key, void* value, size_t charge,
+                     void (*deleter)(const slice& key, void* value)) {
+        e->value = value;
+        e->deleter = deleter;
+        e->charge = charge;
+        e->key_length = key.size();
+        e->key_data = static_cast<char*>(malloc(key.size() > 0 ? key.size() : 1));
+        memcpy(e->key_data, key.data(), key.size());
+        e->detached = false;
+    }
+
+    //条目可见时增加一个引用并把CLOCK计数设为最大，否则返回false
+    static bool TryRef(ClockHandle* e) {
+        uint64_t m = e->meta.load(std::memory_order_acquire);
+        while (StateOf(m) == kVisible) {
+            const uint64_t desired = ((m & ~kClockMask) | (kMaxClock << kClockShift)) + 1;
+            if (e->meta.compare_exchange_weak(m, desired, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Unref(ClockHandle* e) {
+        const uint64_t old = e->meta.fetch_sub(1, std::memory_order_acq_rel);
+        assert(RefsOf(old) > 0);
+        if (RefsOf(old) == 1 && StateOf(old) == kInvisible) {
+            uint64_t m = MakeMeta(kInvisible, ClockOf(old), 0);
+            //可能有其他线程同时完成了回收，只有CAS成功的线程负责释放
+            if (e->meta.compare_exchange_strong(m, MakeMeta(kConstruction, 0, 0),
+                                                std::memory_order_acq_rel)) {
+                FreeEntry(e);
+            }
+        }
+    }
+
+    //REQUIRES: 调用者已把e置为kConstruction
+    void FreeEntry(ClockHandle* e) {
+        (*e->deleter)(e->key(), e->value);
+        free(e->key_data);
+        e->key_data = nullptr;
+        if (e->detached) {
+            delete e;
+            return;
+        }
+        usage_.fetch_sub(e->charge, std::memory_order_relaxed);
+        //撤销插入时在探测序列前面各槽位上增加的displacements
+        const uint64_t h = e->hash.load(std::memory_order_relaxed);
+        const size_t index = static_cast<size_t>(e - table_);
+        for (size_t i = 0; ProbeIndex(h, i) != index; i++) {
+            table_[ProbeIndex(h, i)].displacements.fetch_sub(1, std::memory_order_release);
+        }
+        e->meta.store(MakeMeta(kEmpty, 0, 0), std::memory_order_release);
+    }
+
+    //转动时钟指针，回收CLOCK计数为0且没有引用的条目，直到能容纳charge。
+    //所有条目都被引用时允许超出容量
+    void EvictFor(size_t charge) {
+        const size_t max_steps = (kMaxClock + 1) * (mask_ + 1);
+        for (size_t step = 0; step < max_steps; step++) {
+            if (usage_.load(std::memory_order_relaxed) + charge <= capacity_) {
+                return;
+            }
+            ClockHandle* e = &table_[clock_hand_.fetch_add(1, std::memory_order_relaxed) & mask_];
+            uint64_t m = e->meta.load(std::memory_order_acquire);
+            if (StateOf(m) != kVisible || RefsOf(m) != 0) {
+                continue;
+            }
+            if (ClockOf(m) > 0) {
+                e->meta.compare_exchange_strong(m, m - (1ull << kClockShift),
+                                                std::memory_order_acq_rel);
+            } else if (e->meta.compare_exchange_strong(m, MakeMeta(kConstruction, 0, 0),
+                                                       std::memory_order_acq_rel)) {
+                FreeEntry(e);
+            }
+        }
+    }
+
+    const size_t capacity_;
+    size_t mask_;
+    ClockHandle* table_;
+    std::atomic<size_t> usage_;
+    std::atomic<uint64_t> clock_hand_;
+    std::atomic<uint64_t> last_id_;
+};
+
+inline ClockCache* NewClockCache(size_t capacity, size_t estimated_value_charge) {
+    return new ClockCache(capacity, estimated_value_charge);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include "env.h"
+#include "coding.h"
+//internal key的格式：user_key + 8字节tag，tag = (sequence << 8) | type
+enum ValueType { kTypeDeletion = 0x0, kTypeValue = 0x1 };
+typedef uint64_t SequenceNumber;
+//sequence只占tag的高56位
+static const SequenceNumber kMaxSequenceNumber = ((0x1ull << 56) - 1);
+
+struct ParsedInternalKey {
+    slice user_key;
+    SequenceNumber sequence;
+    ValueType type;
+};
+
+//解析失败（长度不足8字节或type非法）时返回false
+inline bool ParseInternalKey(const slice& internal_key, ParsedInternalKey* result) {
+    const size_t n = internal_key.size();
+    if (n < 8) return false;
+    uint64_t tag = coding::DecodeFixed64(internal_key.data() + n - 8);
+    uint8_t c = tag & 0xff;
+    result->sequence = tag >> 8;
+    result->type = static_cast<ValueType>(c);
+    result->user_key = slice(internal_key.data(), n - 8);
+    return (c <= static_cast<uint8_t>(kTypeValue));
+}
+
+inline slice ExtractUserKey(const slice& internal_key) {
+    assert(internal_key.size() >= 8);
+    return slice(internal_key.data(), internal_key.size() - 8);
+}
+
+inline uint64_t PackSequenceAndType(SequenceNumber seq, ValueType t) {
+    assert(seq <= kMaxSequenceNumber);
+    return (seq << 8) | t;
+}
+
+//把user_key、sequence和type编码成internal key追加到result
+inline void AppendInternalKey(std::string* result, const ParsedInternalKey& key) {
+    result->append(key.user_key.data(), key.user_key.size());
+    coding::PutFixed64(result, PackSequenceAndType(key.sequence, key.type));
+}
@@ -1,5 +1,8 @@
 //该文件封装了关于文件系统操作的函数，包括文件的读写，文件的创建，删除，文件夹的创建，删除等操作。同时包括哦了线程的操作，包括线程的创建，销毁，线程的锁等操作。
+#pragma once
 #include "status.h"
+#include "rateLimiter.h"
+#include "ioUring.h"
 #include <string>
 #include <unistd.h>
 #include <string.h>
@@ -7,11 +10,15 @@
 #include <vector>
 #include <dirent.h>
 #include <sys/stat.h>
-#define MAX_BUFFER_SIZE 1024
+#include <sys/mman.h>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
 #include <queue>
 #include <thread>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
+#include <chrono>
 class slice{
 public:
     const char* data_;
@@ -37,15 +44,31 @@ public:
     bool operator!=(const slice& other) const { return !(*this == other); }
 
 };
+//顺序读文件的接口
 class SequentialFile{
+public:
+    SequentialFile() = default;
+    SequentialFile(const SequentialFile&) = delete;
+    SequentialFile& operator=(const SequentialFile&) = delete;
+    virtual ~SequentialFile() = default;
+    //最多读取n字节，result可能指向scratch。读到文件末尾时result为空
+    virtual Status Read(size_t n, slice* result, char* scratch) = 0;
+    virtual Status Skip(uint64_t n) = 0;
+};
+class PosixSequentialFile : public SequentialFile{
     public:
-    SequentialFile(const std::string& fname, int fd)
-    : filename_(std::move(fname)), fd(fd) { }
-    ~SequentialFile() { close(fd); }
-    Status Read(size_t n, slice result, char* scratch) {
+    //顺序读取，让内核加大预读窗口
+    PosixSequentialFile(const std::string& fname, int fd)
+    : filename_(std::move(fname)), fd(fd) {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+    ~PosixSequentialFile() override { close(fd); }
+    Status Read(size_t n, slice* result, char* scratch) override {
         Status s;
         while(true){
-            size_t read_size = read(fd,scratch,n);
+            ssize_t read_size = read(fd,scratch,n);
             if(read_size<0){
                 if(errno == EINTR){
                     continue;
@@ -53,14 +76,14 @@ class SequentialFile{
                 s = IOError;
                 break;
             }
-            slice(scratch,read_size);
+            *result = slice(scratch,read_size);
             s=OK;
             break;
         }
         return s;
     }
-    Status Skip(uint64_t n) {
-        if (lseek(fd, n, SEEK_CUR)) {
+    Status Skip(uint64_t n) override {
+        if (lseek(fd, n, SEEK_CUR) == static_cast<off_t>(-1)) {
             return IOError;
         }
         return OK;
@@ -69,73 +92,317 @@ class SequentialFile{
     std::string filename_;
     int fd;
 };
+//MultiRead中的一个读取请求，offset、len和scratch由调用者填写，result和status由MultiRead填写
+struct ReadRequest{
+    uint64_t offset;
+    size_t len;
+    char* scratch;  //至少len字节
+    slice result;
+    Status status;
+};
+//告诉内核文件的访问模式，对应posix_fadvise/madvise的advice
+enum class AccessPattern { NORMAL, RANDOM, SEQUENTIAL, WILLNEED, DONTNEED };
+#ifdef POSIX_FADV_NORMAL
+inline int FadviseAdvice(AccessPattern pattern){
+    switch(pattern){
+        case AccessPattern::RANDOM: return POSIX_FADV_RANDOM;
+        case AccessPattern::SEQUENTIAL: return POSIX_FADV_SEQUENTIAL;
+        case AccessPattern::WILLNEED: return POSIX_FADV_WILLNEED;
+        case AccessPattern::DONTNEED: return POSIX_FADV_DONTNEED;
+        default: return POSIX_FADV_NORMAL;
+    }
+}
+#endif
+//随机读文件的接口，Read返回的result可能指向scratch，也可能直接指向文件的mmap映射区
 class RandomAccessFile{
 public:
-    RandomAccessFile(const std::string fimename,const int fd):filename(std::move(filename)),fd(fd){}
-    ~RandomAccessFile(){
+    RandomAccessFile() = default;
+    RandomAccessFile(const RandomAccessFile&) = delete;
+    RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+    virtual ~RandomAccessFile() = default;
+    virtual Status Read(uint64_t offset,slice* result,char* scratch,size_t n) const = 0;
+    //一次执行n个读取请求，各请求的结果在reqs[i].result和reqs[i].status中。
+    //实现可以让这些读取并发进行；默认实现逐个调用Read。
+    //返回值只表示批量读取本身是否出错，单个请求是否成功要看reqs[i].status
+    virtual Status MultiRead(ReadRequest* reqs,size_t n) const{
+        for(size_t i = 0;i < n;i++){
+            reqs[i].status = Read(reqs[i].offset,&reqs[i].result,reqs[i].scratch,reqs[i].len);
+        }
+        return OK;
+    }
+    //对[offset,offset+length)给出访问模式的提示，length为0表示到文件末尾。
+    //只是提示，不支持时忽略；默认实现什么也不做
+    virtual void Hint(AccessPattern,uint64_t = 0,uint64_t = 0) const{}
+    //Read是否需要调用者提供scratch。返回false时result直接指向文件自身的内存，
+    //scratch不会被使用，可以传入nullptr
+    virtual bool NeedsScratch() const{ return true; }
+};
+//基于pread的实现，每次读取都是一次系统调用加一次拷贝
+class PosixRandomAccessFile : public RandomAccessFile{
+public:
+    PosixRandomAccessFile(const std::string filename,const int fd):fd(fd),filename(std::move(filename)){}
+    ~PosixRandomAccessFile() override{
         close(fd);
     }
-    Status Read(uint32_t offset,slice* result,char* scracth,int n){
+    Status Read(uint64_t offset,slice* result,char* scratch,size_t n) const override{
         Status s;
         while(true){
-            size_t read_size = pread(fd,scracth,n,offset);
+            ssize_t read_size = pread(fd,scratch,n,static_cast<off_t>(offset));
             if(read_size<0){
                 if(errno == EINTR){
                     continue;
                 }
+                *result = slice(scratch,0);
                 s = IOError;
                 break;
             }
-            *result = slice(scracth,read_size);
+            *result = slice(scratch,read_size);
             s=OK;
             break;
         }
         return s;
     }
+    //优先用io_uring一次提交所有请求；io_uring不可用时把请求分给pread线程池并发执行
+    Status MultiRead(ReadRequest* reqs,size_t n) const override;
+    void Hint(AccessPattern pattern,uint64_t offset = 0,uint64_t length = 0) const override{
+#ifdef POSIX_FADV_NORMAL
+        posix_fadvise(fd,static_cast<off_t>(offset),static_cast<off_t>(length),FadviseAdvice(pattern));
+#endif
+    }
 private:
     int fd;
     std::string filename;
-    bool has_permanent_fd;
 };
+//限制同时映射的文件数量，防止mmap耗尽虚拟地址空间
+class Limiter{
+public:
+    explicit Limiter(int max_acquires):acquires_allowed_(max_acquires){}
+    Limiter(const Limiter&) = delete;
+    Limiter& operator=(const Limiter&) = delete;
+    //成功获取返回true，之后必须调用Release归还
+    bool Acquire(){
+        int old = acquires_allowed_.fetch_sub(1,std::memory_order_relaxed);
+        if(old>0){
+            return true;
+        }
+        acquires_allowed_.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    void Release(){
+        acquires_allowed_.fetch_add(1,std::memory_order_relaxed);
+    }
+private:
+    std::atomic<int> acquires_allowed_;
+};
+//基于mmap的实现，Read不拷贝数据，result直接指向映射区，scratch不会被使用
+//映射区在文件对象析构前一直有效
+class PosixMmapReadableFile : public RandomAccessFile{
+public:
+    //mmap_base[0,length-1]是文件内容的映射，limiter中的名额由调用者预先获取
+    PosixMmapReadableFile(const std::string filename,char* mmap_base,size_t length,Limiter* limiter)
+    :mmap_base_(mmap_base),length_(length),limiter_(limiter),filename_(std::move(filename)){}
+    ~PosixMmapReadableFile() override{
+        ::munmap(static_cast<void*>(mmap_base_),length_);
+        limiter_->Release();
+    }
+    Status Read(uint64_t offset,slice* result,char*,size_t n) const override{
+        if(offset+n>length_){
+            *result = slice();
+            return IOError;
+        }
+        *result = slice(mmap_base_+offset,n);
+        return OK;
+    }
+    //映射区的缺页读取不受fadvise影响，改用madvise，范围需要按页对齐
+    void Hint(AccessPattern pattern,uint64_t offset = 0,uint64_t length = 0) const override{
+        if(offset >= length_){
+            return;
+        }
+        if(length == 0 || length > length_ - offset){
+            length = length_ - offset;
+        }
+        static const uint64_t page_size = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        const uint64_t begin = offset & ~(page_size - 1);
+        int advice = MADV_NORMAL;
+        switch(pattern){
+            case AccessPattern::RANDOM: advice = MADV_RANDOM; break;
+            case AccessPattern::SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+            case AccessPattern::WILLNEED: advice = MADV_WILLNEED; break;
+            case AccessPattern::DONTNEED: advice = MADV_DONTNEED; break;
+            default: break;
+        }
+        ::madvise(mmap_base_ + begin,offset + length - begin,advice);
+    }
+    bool NeedsScratch() const override{ return false; }
+private:
+    char* const mmap_base_;
+    const size_t length_;
+    Limiter* const limiter_;
+    const std::string filename_;
+};
+//O_DIRECT要求缓冲区地址、文件偏移和读写长度都按逻辑块大小对齐
+static const size_t kDirectIOAlignment = 4096;
+//O_DIRECT读：把[offset,offset+n)扩展到对齐边界读入对齐缓冲区，再把需要的部分拷贝到scratch。
+//绕过page cache，compaction的大量读取不会把前台读需要的热数据挤出去
+class PosixDirectRandomAccessFile : public RandomAccessFile{
+public:
+    PosixDirectRandomAccessFile(const std::string filename,const int fd):fd(fd),filename(std::move(filename)){}
+    ~PosixDirectRandomAccessFile() override{
+        close(fd);
+    }
+    Status Read(uint64_t offset,slice* result,char* scratch,size_t n) const override{
+        const uint64_t aligned_offset = offset & ~(static_cast<uint64_t>(kDirectIOAlignment)-1);
+        const size_t prefix = offset - aligned_offset;
+        const size_t aligned_len = (prefix + n + kDirectIOAlignment - 1) & ~(kDirectIOAlignment-1);
+        void* buf = nullptr;
+        if(posix_memalign(&buf,kDirectIOAlignment,aligned_len) != 0){
+            *result = slice(scratch,0);
+            return IOError;
+        }
+        size_t read_total = 0;
+        Status s = OK;
+        while(read_total < aligned_len){
+            ssize_t read_size = pread(fd,static_cast<char*>(buf)+read_total,aligned_len-read_total,
+                                      static_cast<off_t>(aligned_offset+read_total));
+            if(read_size<0){
+                if(errno == EINTR){
+                    continue;
+                }
+                s = IOError;
+                break;
+            }
+            if(read_size == 0){
+                break;  //到达文件末尾
+            }
+            read_total += read_size;
+        }
+        size_t copied = 0;
+        if(s == OK && read_total > prefix){
+            copied = std::min(n,read_total-prefix);
+            memcpy(scratch,static_cast<char*>(buf)+prefix,copied);
+        }
+        free(buf);
+        *result = slice(scratch,copied);
+        return s;
+    }
+private:
+    int fd;
+    std::string filename;
+};
+//顺序写文件的接口
 class WritableFile{
     public:
-    WritableFile(const std::string& fname,int fd):filename(std::move(fname)),fd(fd){
+    WritableFile() = default;
+    WritableFile(const WritableFile&) = delete;
+    WritableFile& operator=(const WritableFile&) = delete;
+    virtual ~WritableFile() = default;
+    virtual Status Append(const slice& data) = 0;
+    //把用户态缓冲区中的数据交给内核
+    virtual Status FlushBUffer() = 0;
+    virtual Status Fsync() = 0;
+    //写出剩余数据并关闭文件，之后不能再写入
+    virtual Status Close() = 0;
+    //设置写入的限速器和优先级。flush和compaction的输出文件分别设为HIGH和LOW，
+    //默认的USER不受限速；rate_limiter为nullptr时不限速
+    void SetRateLimiter(RateLimiter* rate_limiter){ rate_limiter_ = rate_limiter; }
+    void SetIOPriority(IOPriority pri){ io_priority_ = pri; }
+    IOPriority GetIOPriority() const { return io_priority_; }
+protected:
+    //写入n字节前从限速器获取令牌，超过单次上限时分多次获取
+    void RateLimit(size_t n){
+        if(rate_limiter_ == nullptr || io_priority_ == IOPriority::USER){
+            return;
+        }
+        const int64_t burst = rate_limiter_->GetSingleBurstBytes();
+        int64_t left = static_cast<int64_t>(n);
+        while(left > 0){
+            const int64_t bytes = std::min(left,burst);
+            rate_limiter_->Request(bytes,io_priority_);
+            left -= bytes;
+        }
+    }
+private:
+    RateLimiter* rate_limiter_ = nullptr;
+    IOPriority io_priority_ = IOPriority::USER;
+};
+//WritableFile的缓冲和刷盘配置，按文件类型选择
+struct WritableFileOptions{
+    //用户态缓冲区的大小，攒满后一次write写出；大于它的Append直接写出
+    size_t buffer_size = 64 << 10;
+    //不为0时每写出这么多字节，用sync_file_range让内核开始回写已写出的部分（不等待完成），
+    //脏页不会积压到最后，关闭文件时的fsync只需处理最后一段
+    uint64_t bytes_per_sync = 0;
+
+    //sstable：一个文件几十MB，大缓冲区减少write次数，边写边回写
+    static WritableFileOptions ForTableFile(){
+        WritableFileOptions options;
+        options.buffer_size = 1 << 20;
+        options.bytes_per_sync = 1 << 20;
+        return options;
+    }
+    //WAL和MANIFEST：每条记录都可能需要立即写出和sync，缓冲区不必太大
+    static WritableFileOptions ForLogFile(){
+        return WritableFileOptions();
+    }
+};
+class PosixWritableFile : public WritableFile{
+    public:
+    PosixWritableFile(const std::string& fname,int fd,const WritableFileOptions& options = WritableFileOptions(),
+                      uint64_t file_offset = 0)
+    :filename(std::move(fname)),fd(fd),
+     buffer_size(std::max<size_t>(options.buffer_size,1)),buffer(new char[buffer_size]),has_buffer_size(0),
+     bytes_per_sync(options.bytes_per_sync),file_offset(file_offset),synced_offset(file_offset),is_manifest(false){
         getDirAndBase(filename);
         if(basename == "MANIFEST"){
             is_manifest = true;
         }
     }
-    ~WritableFile(){
-        close(fd);
+    ~PosixWritableFile() override{
+        Close();
+        delete[] buffer;
+    }
+    Status Close() override{
+        if(fd < 0){
+            return OK;
+        }
+        Status s = FlushBUffer();
+        if(close(fd) != 0 && s == OK){
+            s = IOError;
+        }
+        fd = -1;
+        return s;
     }
-    Status Append(const slice& data){
-        if(has_buffer_size + data.size()< MAX_BUFFER_SIZE){
+    Status Append(const slice& data) override{
+        if(has_buffer_size + data.size() <= buffer_size){
             memcpy(buffer+has_buffer_size,data.data_,data.size());
             has_buffer_size+=data.size();
             return OK;
         }
-        FlushBUffer();
-        if(data.size() > MAX_BUFFER_SIZE){
+        Status s = FlushBUffer();
+        if(s != OK){
+            return s;
+        }
+        if(static_cast<size_t>(data.size()) >= buffer_size){
             return WriteToFile(data);
         }
         memcpy(buffer,data.data_,data.size());
         has_buffer_size = data.size();
         return OK;
     }
-    Status FlushBUffer(){
+    Status FlushBUffer() override{
         if(has_buffer_size>0){
             Status s = WriteToFile(slice(buffer,has_buffer_size));
             has_buffer_size = 0;
-            memset(buffer,0,MAX_BUFFER_SIZE);
             return s;
-        }else{
-            return IOError;
         }
+        return OK;
     }
     Status WriteToFile(const slice& data){
+        const size_t size = static_cast<size_t>(data.size());
+        RateLimit(size);
         size_t offset = 0;
-        while(offset < data.size()){
-            size_t write_size = write(fd,data.data_+offset,data.size()-offset);
+        while(offset < size){
+            ssize_t write_size = write(fd,data.data_+offset,size-offset);
             if(write_size<0){
                 if(errno == EINTR){
                     continue;
@@ -143,15 +410,18 @@ class WritableFile{
                 return IOError;
             }
             offset+=write_size;
-            if(offset >= data.size()){
-                break;
-            }
         }
-        return OK;
+        file_offset += size;
+        return RangeSync();
     }
 
-    Status Fsync(){
-        Status s = syncManifest();
+    //先写出用户态缓冲区，否则已经Append的数据可能还没有进入内核
+    Status Fsync() override{
+        Status s = FlushBUffer();
+        if(s != OK){
+            return s;
+        }
+        s = syncManifest();
         if(s == IOError){
             return s;
         }
@@ -161,6 +431,20 @@ class WritableFile{
         return OK;
     }
 private:
+    //已写出但未开始回写的部分达到bytes_per_sync时，让内核开始回写，不等待完成
+    Status RangeSync(){
+#ifdef __linux__
+        if(bytes_per_sync == 0 || file_offset - synced_offset < bytes_per_sync){
+            return OK;
+        }
+        if(sync_file_range(fd,static_cast<off_t>(synced_offset),static_cast<off_t>(file_offset - synced_offset),
+                           SYNC_FILE_RANGE_WRITE) != 0){
+            return IOError;
+        }
+        synced_offset = file_offset;
+#endif
+        return OK;
+    }
     Status syncManifest(){
         if(!is_manifest){
             return OK;
@@ -195,64 +479,434 @@ private:
     
     std::string filename;
     int fd;
-    char buffer[MAX_BUFFER_SIZE];
-    int has_buffer_size;
+    const size_t buffer_size;
+    char* buffer;
+    size_t has_buffer_size;
+    const uint64_t bytes_per_sync;
+    uint64_t file_offset;    //已写出到文件的字节数（包括打开前已有的内容）
+    uint64_t synced_offset;  //[0, synced_offset)已经调用过sync_file_range
     bool is_manifest;
     std::string dirname;
     std::string basename;
 };
+//O_DIRECT写：数据先攒在对齐的堆缓冲区里，只按整块写出。
+//Fsync/Close时把不足一块的尾部补零写出，再ftruncate回真实长度；尾部仍留在缓冲区中，
+//之后的Append会在同一偏移处把这一块重写一遍
+static const size_t kDirectIOBufferSize = 1 << 20;
+class PosixDirectWritableFile : public WritableFile{
+    public:
+    PosixDirectWritableFile(const std::string& fname,int fd)
+    :filename_(std::move(fname)),fd_(fd),buffer_(nullptr),buffered_(0),file_offset_(0){
+        void* buf = nullptr;
+        if(posix_memalign(&buf,kDirectIOAlignment,kDirectIOBufferSize) == 0){
+            buffer_ = static_cast<char*>(buf);
+        }
+    }
+    ~PosixDirectWritableFile() override{
+        Close();
+        free(buffer_);
+    }
+    Status Append(const slice& data) override{
+        if(buffer_ == nullptr){
+            return IOError;
+        }
+        const char* src = data.data();
+        size_t left = data.size();
+        while(left > 0){
+            size_t n = std::min(left,kDirectIOBufferSize-buffered_);
+            memcpy(buffer_+buffered_,src,n);
+            buffered_ += n;
+            src += n;
+            left -= n;
+            if(buffered_ == kDirectIOBufferSize){
+                Status s = FlushBUffer();
+                if(s != OK){
+                    return s;
+                }
+            }
+        }
+        return OK;
+    }
+    //只写出缓冲区中按块对齐的部分，不足一块的尾部留到下次
+    Status FlushBUffer() override{
+        size_t aligned = buffered_ & ~(kDirectIOAlignment-1);
+        if(aligned == 0){
+            return OK;
+        }
+        Status s = PositionedWrite(buffer_,aligned,file_offset_);
+        if(s != OK){
+            return s;
+        }
+        file_offset_ += aligned;
+        buffered_ -= aligned;
+        memmove(buffer_,buffer_+aligned,buffered_);
+        return OK;
+    }
+    Status Fsync() override{
+        Status s = FlushTail();
+        if(s != OK){
+            return s;
+        }
+        if(fsync(fd_) == -1){
+            return IOError;
+        }
+        return OK;
+    }
+    Status Close() override{
+        if(fd_ < 0){
+            return OK;
+        }
+        Status s = FlushTail();
+        if(close(fd_) != 0 && s == OK){
+            s = IOError;
+        }
+        fd_ = -1;
+        return s;
+    }
+    private:
+    //写出补零后的尾块，再把文件截断到真实长度
+    Status FlushTail(){
+        Status s = FlushBUffer();
+        if(s != OK || buffered_ == 0){
+            return s;
+        }
+        size_t padded = (buffered_ + kDirectIOAlignment - 1) & ~(kDirectIOAlignment-1);
+        memset(buffer_+buffered_,0,padded-buffered_);
+        s = PositionedWrite(buffer_,padded,file_offset_);
+        if(s != OK){
+            return s;
+        }
+        if(ftruncate(fd_,static_cast<off_t>(file_offset_+buffered_)) != 0){
+            return IOError;
+        }
+        return OK;
+    }
+    Status PositionedWrite(const char* data,size_t n,uint64_t offset){
+        RateLimit(n);
+        while(n > 0){
+            ssize_t write_size = pwrite(fd_,data,n,static_cast<off_t>(offset));
+            if(write_size<0){
+                if(errno == EINTR){
+                    continue;
+                }
+                return IOError;
+            }
+            data += write_size;
+            offset += write_size;
+            n -= write_size;
+        }
+        return OK;
+    }
+    std::string filename_;
+    int fd_;
+    char* buffer_;          // 按kDirectIOAlignment对齐的缓冲区
+    size_t buffered_;       // 缓冲区中尚未写出的字节数
+    uint64_t file_offset_;  // 缓冲区首字节对应的文件偏移，总是块对齐的
+};
+//MultiRead的pread线程池的线程数，io_uring不可用时决定同时进行的读取数
+static const int kMultiReadThreads = 8;
+//线程池的运行统计
+struct ThreadPoolStats {
+    size_t queue_len = 0;             //排队等待执行的任务数
+    int running = 0;                  //正在执行的任务数
+    int threads = 0;                  //线程数
+    uint64_t scheduled = 0;           //累计提交的任务数
+    uint64_t completed = 0;           //累计完成的任务数
+    size_t max_queue_len = 0;         //排队任务数的历史最大值
+    uint64_t queue_wait_nanos = 0;    //已开始执行的任务在队列中等待的总时间
+};
+//固定数量线程的后台线程池，任务按提交顺序执行。
+//执行任务时不持有锁，一个长时间运行的任务只占用一个线程，不影响其他线程取任务
+class ThreadPool{
+public:
+    ThreadPool() = default;
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool(){
+        JoinAll();
+    }
+    //把线程数增加到num，只增不减。线程在第一次Schedule时才启动
+    void SetBackgroundThreads(int num){
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(num > num_threads_){
+            num_threads_ = num;
+            if(!threads_.empty()){
+                StartThreadsLocked();
+            }
+        }
+    }
+    int GetBackgroundThreads(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_threads_;
+    }
+    //提交任务，JoinAll之后提交的任务被丢弃
+    void Schedule(void (*function)(void* arg),void* arg){
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(exit_){
+            return;
+        }
+        queue_.push(WorkItem{function,arg,std::chrono::steady_clock::now()});
+        stats_.scheduled++;
+        stats_.max_queue_len = std::max(stats_.max_queue_len,queue_.size());
+        StartThreadsLocked();
+        cv_.notify_one();
+    }
+    //执行完所有已提交的任务后结束所有线程并等待它们退出，之后线程池不再接受任务
+    void JoinAll(){
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            exit_ = true;
+            threads.swap(threads_);
+        }
+        cv_.notify_all();
+        for(std::thread& t : threads){
+            t.join();
+        }
+    }
+    size_t GetQueueLen(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+    ThreadPoolStats GetStats(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        ThreadPoolStats stats = stats_;
+        stats.queue_len = queue_.size();
+        stats.threads = static_cast<int>(threads_.size());
+        return stats;
+    }
+private:
+    struct WorkItem{
+        void (*function)(void*);
+        void* arg;
+        std::chrono::steady_clock::time_point enqueue_time;
+    };
+    //REQUIRES: 持有mutex_
+    void StartThreadsLocked(){
+        while(static_cast<int>(threads_.size()) < num_threads_){
+            threads_.emplace_back(&ThreadPool::ThreadMain,this);
+        }
+    }
+    void ThreadMain(){
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(true){
+            cv_.wait(lock,[this]{ return exit_ || !queue_.empty(); });
+            if(queue_.empty()){
+                break;  //exit_且队列已空
+            }
+            WorkItem item = queue_.front();
+            queue_.pop();
+            stats_.running++;
+            stats_.queue_wait_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - item.enqueue_time).count();
+            lock.unlock();
+            item.function(item.arg);
+            lock.lock();
+            stats_.running--;
+            stats_.completed++;
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::queue<WorkItem> queue_;
+    std::vector<std::thread> threads_;
+    int num_threads_ = 1;
+    bool exit_ = false;
+    ThreadPoolStats stats_;
+};
+//MultiRead在io_uring不可用时使用的pread线程池，所有文件共享
+inline ThreadPool* MultiReadThreadPool(){
+    static ThreadPool* pool = []{
+        ThreadPool* p = new ThreadPool;  //不析构，避免进程退出时与仍在读取的线程竞争
+        p->SetBackgroundThreads(kMultiReadThreads);
+        return p;
+    }();
+    return pool;
+}
+inline Status PosixRandomAccessFile::MultiRead(ReadRequest* reqs,size_t n) const{
+    if(n == 0){
+        return OK;
+    }
+    if(n > 1){
+        IoUring* ring = IoUring::ThreadLocal();
+        if(ring != nullptr){
+            std::vector<uint64_t> offsets(n);
+            std::vector<size_t> lens(n);
+            std::vector<char*> bufs(n);
+            std::vector<ssize_t> results(n);
+            for(size_t i = 0;i < n;i++){
+                offsets[i] = reqs[i].offset;
+                lens[i] = reqs[i].len;
+                bufs[i] = reqs[i].scratch;
+            }
+            if(ring->Read(fd,offsets.data(),lens.data(),bufs.data(),results.data(),n)){
+                for(size_t i = 0;i < n;i++){
+                    //EINVAL/EOPNOTSUPP表示内核不支持这种读取（例如文件系统不支持），改用pread重试
+                    if(results[i] == -EINTR || results[i] == -EAGAIN || results[i] == -EINVAL ||
+                       results[i] == -EOPNOTSUPP){
+                        reqs[i].status = Read(reqs[i].offset,&reqs[i].result,reqs[i].scratch,reqs[i].len);
+                    }else if(results[i] < 0){
+                        reqs[i].result = slice(reqs[i].scratch,0);
+                        reqs[i].status = IOError;
+                    }else{
+                        reqs[i].result = slice(reqs[i].scratch,static_cast<size_t>(results[i]));
+                        reqs[i].status = OK;
+                    }
+                }
+                return OK;
+            }
+        }
+    }
+    //pread线程池：前n-1个请求交给线程池，最后一个在当前线程执行，然后等待其余完成
+    struct Batch{
+        const PosixRandomAccessFile* file;
+        ReadRequest* reqs;
+        std::mutex mu;
+        std::condition_variable cv;
+        size_t pending;
+    };
+    struct Task{
+        Batch* batch;
+        size_t index;
+        static void Run(void* arg){
+            Task* t = static_cast<Task*>(arg);
+            ReadRequest& r = t->batch->reqs[t->index];
+            r.status = t->batch->file->Read(r.offset,&r.result,r.scratch,r.len);
+            std::lock_guard<std::mutex> lock(t->batch->mu);
+            if(--t->batch->pending == 0){
+                t->batch->cv.notify_one();
+            }
+        }
+    };
+    Batch batch;
+    batch.file = this;
+    batch.reqs = reqs;
+    batch.pending = n - 1;
+    std::vector<Task> tasks(n - 1);
+    for(size_t i = 0;i + 1 < n;i++){
+        tasks[i].batch = &batch;
+        tasks[i].index = i;
+        MultiReadThreadPool()->Schedule(&Task::Run,&tasks[i]);
+    }
+    ReadRequest& last = reqs[n - 1];
+    last.status = Read(last.offset,&last.result,last.scratch,last.len);
+    std::unique_lock<std::mutex> lock(batch.mu);
+    batch.cv.wait(lock,[&batch]{ return batch.pending == 0; });
+    return OK;
+}
+//64位系统上默认最多同时mmap 1000个只读文件，32位系统地址空间紧张则不使用mmap
+static const int kDefaultMmapLimit = (sizeof(void*) >= 8) ? 1000 : 0;
+//文件系统和后台线程的抽象。默认实现直接使用POSIX接口；
+//文件和目录操作都是虚函数，MemEnv（memEnv.h）把它们换成内存实现，
+//FaultInjectionEnv（faultInjectionEnv.h）在其它env之上注入错误。
+//子类重写带默认参数的函数时必须保持相同的默认值，默认值按静态类型绑定
 class env{
 public:
+    //max_mmaps为mmap预算，即同时映射的文件数上限，传0则关闭mmap读
+    explicit env(int max_mmaps = kDefaultMmapLimit):mmap_limiter_(max_mmaps){}
+    env(const env&) = delete;
+    env& operator=(const env&) = delete;
 
-    Status NewSequentialFile(const std::string& filename,
+    virtual Status NewSequentialFile(const std::string& filename,
         SequentialFile** result) {
         int fd = ::open(filename.c_str(), O_RDONLY);
         if (fd < 0) {
             *result = nullptr;
             return IOError;
         }
-        *result = new SequentialFile(filename, fd);
+        *result = new PosixSequentialFile(filename, fd);
         return OK;
     }   
 
-    Status NewRandomAccessFile(const std::string& filename,
-            RandomAccessFile** result) {
-    *result = nullptr;
-    int fd = ::open(filename.c_str(), O_RDONLY );
+    //use_direct_io为true时用O_DIRECT打开，供flush和compaction读写使用；
+    //文件系统不支持O_DIRECT（open返回EINVAL，例如tmpfs）时退回到普通读写
+    static int OpenMaybeDirect(const std::string& filename,int flags,bool use_direct_io,bool* is_direct){
+        *is_direct = false;
+#ifdef O_DIRECT
+        if(use_direct_io){
+            int fd = ::open(filename.c_str(),flags | O_DIRECT,0644);
+            if(fd >= 0 || errno != EINVAL){
+                *is_direct = (fd >= 0);
+                return fd;
+            }
+        }
+#endif
+        return ::open(filename.c_str(),flags,0644);
+    }
+
+    //mmap名额未用完时返回PosixMmapReadableFile，否则退回到pread实现
+    virtual Status NewRandomAccessFile(const std::string& filename,
+            RandomAccessFile** result,bool use_direct_io = false) {
+        *result = nullptr;
+        bool is_direct;
+        int fd = OpenMaybeDirect(filename,O_RDONLY,use_direct_io,&is_direct);
         if (fd < 0) {
             return IOError;
         }
-    *result = new RandomAccessFile(filename, fd);
-    return OK;
+        if(is_direct){
+            *result = new PosixDirectRandomAccessFile(filename, fd);
+            return OK;
+        }
+        if(!mmap_limiter_.Acquire()){
+            *result = new PosixRandomAccessFile(filename, fd);
+            return OK;
+        }
+        uint64_t file_size;
+        Status s = GetFileSize(filename,&file_size);
+        if(s == OK && file_size > 0){
+            void* mmap_base = ::mmap(nullptr,file_size,PROT_READ,MAP_SHARED,fd,0);
+            if(mmap_base != MAP_FAILED){
+                *result = new PosixMmapReadableFile(filename,reinterpret_cast<char*>(mmap_base),
+                                                    file_size,&mmap_limiter_);
+                ::close(fd);
+                return OK;
+            }
+        }
+        //映射失败或空文件，归还名额后使用pread
+        mmap_limiter_.Release();
+        *result = new PosixRandomAccessFile(filename, fd);
+        return OK;
     }
 
-    Status NewWritableFile(const std::string& filename,
-        WritableFile** result){
-        int fd = ::open(filename.c_str(),
-        O_TRUNC | O_WRONLY | O_CREAT, 0644);
+    //options决定缓冲区大小和边写边回写的间隔，sstable应使用WritableFileOptions::ForTableFile()。
+    //O_DIRECT写入绕过page cache，使用自己的对齐缓冲区，options不生效
+    virtual Status NewWritableFile(const std::string& filename,
+        WritableFile** result,bool use_direct_io = false,
+        const WritableFileOptions& options = WritableFileOptions()){
+        bool is_direct;
+        int fd = OpenMaybeDirect(filename,O_TRUNC | O_WRONLY | O_CREAT,use_direct_io,&is_direct);
         if (fd < 0) {
             *result = nullptr;
             return IOError;
         }
-        *result = new WritableFile(filename, fd);
+        if(is_direct){
+            *result = new PosixDirectWritableFile(filename, fd);
+        }else{
+            *result = new PosixWritableFile(filename, fd, options);
+        }
+        (*result)->SetRateLimiter(rate_limiter_);
         return OK;
     }
-    Status NewAppendableFile(const std::string& filename,
-        WritableFile** result) {
+    virtual Status NewAppendableFile(const std::string& filename,
+        WritableFile** result,const WritableFileOptions& options = WritableFileOptions::ForLogFile()) {
         int fd = ::open(filename.c_str(),
         O_APPEND | O_WRONLY | O_CREAT , 0644);
         if (fd < 0) {
             *result = nullptr;
             return IOError;
         }
-        *result = new WritableFile(filename, fd);
+        struct ::stat st;
+        const uint64_t file_size = ::fstat(fd,&st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+        *result = new PosixWritableFile(filename, fd, options, file_size);
+        (*result)->SetRateLimiter(rate_limiter_);
         return OK;
     }
-    bool FileExists(const std::string& filename) {
+    virtual bool FileExists(const std::string& filename) {
         return ::access(filename.c_str(), F_OK) == 0;
     }
     
-    Status GetChildren(const std::string& directory_path,
+    virtual Status GetChildren(const std::string& directory_path,
                         std::vector<std::string>* result){
         result->clear();
         ::DIR* dir = ::opendir(directory_path.c_str());
@@ -267,28 +921,28 @@ public:
         return OK;
     }
     
-    Status RemoveFile(const std::string& filename) {
+    virtual Status RemoveFile(const std::string& filename) {
         if (::unlink(filename.c_str()) != 0) {
             return IOError;
         }
         return OK;
     }
     
-    Status CreateDir(const std::string& dirname) {
+    virtual Status CreateDir(const std::string& dirname) {
         if (::mkdir(dirname.c_str(), 0755) != 0) {
             return IOError;
         }
         return OK;
     }
 
-    Status RemoveDir(const std::string& dirname) {
+    virtual Status RemoveDir(const std::string& dirname) {
         if (::rmdir(dirname.c_str()) != 0) {
             return IOError;
         }
         return OK;
     }
     
-    Status GetFileSize(const std::string& filename, uint64_t* size) {
+    virtual Status GetFileSize(const std::string& filename, uint64_t* size) {
         struct ::stat file_stat;
         if (::stat(filename.c_str(), &file_stat) != 0) {
             *size = 0;
@@ -298,52 +952,59 @@ public:
         return OK;
     }
 
-    Status RenameFile(const std::string& from, const std::string& to) {
+    virtual Status RenameFile(const std::string& from, const std::string& to) {
         if (std::rename(from.c_str(), to.c_str()) != 0) {
             return IOError;
         }
         return OK;
     }
-//后台线程相关函数
-    struct BackgroundWorkItem {
-        explicit BackgroundWorkItem(void (*function)(void* arg), void* arg)
-            : function(function), arg(arg) {}
-    
-        void (*const function)(void*);
-        void* const arg;
-    };
-    bool is_background_thread_started = false;
-    void BackgroundThreadMain(){
-        while(true){
-            
-            sem_wait(&bg_queue_semaphore);
-            std::lock_guard<std::mutex> lock(bg_queue_mutex);
-            BackgroundWorkItem item = bg_queue.front();
-            bg_queue.pop();
-            item.function(item.arg);
+
+    //为from创建硬链接to，两者不在同一文件系统时失败
+    virtual Status LinkFile(const std::string& from, const std::string& to) {
+        if (::link(from.c_str(), to.c_str()) != 0) {
+            return IOError;
         }
-    };
-    static void run(void * arg){
-        env * e = (env*)arg;
-        e->BackgroundThreadMain();
+        return OK;
     }
-    void Schedule(void (*function)(void* arg),void* arg){
-        {
-            std::lock_guard<std::mutex> lock(bg_queue_mutex);
-            bg_queue.push(BackgroundWorkItem(function, arg));
-            sem_post(&bg_queue_semaphore);
-        }
-        if(is_background_thread_started == false){
-            is_background_thread_started = true;
-            std::thread t(run,this);
-            t.detach();
+    //后台任务的优先级：HIGH用于flush，LOW用于compaction。
+    //两种优先级各有独立的线程池，flush不会排在长时间运行的compaction之后
+    enum class Priority { HIGH = 0, LOW = 1 };
+
+    //在pri对应的线程池中异步执行function(arg)
+    void Schedule(void (*function)(void* arg),void* arg,Priority pri = Priority::LOW){
+        thread_pools_[static_cast<int>(pri)].Schedule(function,arg);
+    }
+    //把pri对应线程池的线程数增加到num，默认各1个线程
+    void SetBackgroundThreads(int num,Priority pri = Priority::LOW){
+        thread_pools_[static_cast<int>(pri)].SetBackgroundThreads(num);
+    }
+    int GetBackgroundThreads(Priority pri = Priority::LOW){
+        return thread_pools_[static_cast<int>(pri)].GetBackgroundThreads();
+    }
+    //pri对应线程池中排队等待执行的任务数
+    size_t GetThreadPoolQueueLen(Priority pri = Priority::LOW){
+        return thread_pools_[static_cast<int>(pri)].GetQueueLen();
+    }
+    ThreadPoolStats GetThreadPoolStats(Priority pri = Priority::LOW){
+        return thread_pools_[static_cast<int>(pri)].GetStats();
+    }
+    //此后创建的WritableFile使用rate_limiter限速（只限制SetIOPriority为HIGH或LOW的文件），
+    //nullptr表示不限速。rate_limiter由调用者持有，必须比env和所有文件存活更久
+    void SetRateLimiter(RateLimiter* rate_limiter){
+        rate_limiter_ = rate_limiter;
+    }
+    RateLimiter* GetRateLimiter() const { return rate_limiter_; }
+    //执行完所有已提交的后台任务并结束后台线程，之后提交的任务被丢弃。析构时自动调用
+    void JoinAllThreads(){
+        for(ThreadPool& pool : thread_pools_){
+            pool.JoinAll();
         }
     }
-    std::mutex bg_queue_mutex; // 保护 bg_queue 的互斥锁
-    std::queue<BackgroundWorkItem> bg_queue;
-    sem_t bg_queue_semaphore;  // 信号量，用于通知后台线程有任务需要处理
-    ~env(){
-        sem_destroy(&bg_queue_semaphore);
+    Limiter mmap_limiter_;     // mmap只读文件的名额
+    ThreadPool thread_pools_[2];  // 按Priority索引
+    RateLimiter* rate_limiter_ = nullptr;
+    virtual ~env(){
+        JoinAllThreads();
     }
 
 };
\ No newline at end of file
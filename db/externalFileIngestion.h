@@ -0,0 +1,123 @@
+#pragma once
+#include <string>
+#include "env.h"
+#include "dbformat.h"
+#include "filename.h"
+#include "SSTable.h"
+#include "version.h"
+#include "versionEdit.h"
+//把SstFileWriter生成的文件直接导入数据库，不经过memtable和WAL。
+//调用者需要保证导入期间memtable中没有与该文件重叠的key（例如先flush），
+//并在成功后把edit应用到当前Version上
+
+struct IngestExternalFileOptions {
+    //为true时硬链接外部文件，失败再退回到拷贝；为false时总是拷贝
+    bool move_files = true;
+};
+
+//把from的内容拷贝到to
+static Status CopyFile(env* e, const std::string& from, const std::string& to) {
+    SequentialFile* src;
+    Status s = e->NewSequentialFile(from, &src);
+    if (s != OK) {
+        return s;
+    }
+    WritableFile* dst;
+    s = e->NewWritableFile(to, &dst, false, WritableFileOptions::ForTableFile());
+    if (s != OK) {
+        delete src;
+        return s;
+    }
+    const size_t kBufferSize = 64 * 1024;
+    char* buffer = new char[kBufferSize];
+    while (true) {
+        slice fragment;
+        s = src->Read(kBufferSize, &fragment, buffer);
+        if (s != OK || fragment.size() == 0) {
+            break;
+        }
+        s = dst->Append(fragment);
+        if (s != OK) {
+            break;
+        }
+    }
+    if (s == OK) {
+        s = dst->FlushBUffer();
+    }
+    if (s == OK) {
+        s = dst->Fsync();
+    }
+    delete[] buffer;
+    delete dst;
+    delete src;
+    if (s != OK) {
+        e->RemoveFile(to);
+    }
+    return s;
+}
+
+//导入external_file：
+//1.读取properties校验文件（非空、由SstFileWriter生成、key范围合法）
+//2.从L0往下找，选择最深的、且它和它之上各层都与文件key范围不重叠的层
+//3.把文件链接（或拷贝）为dbname下编号为file_number的sstable
+//4.分配新的global sequence，并把文件记录到edit中
+static Status IngestExternalFile(env* e, const IngestExternalFileOptions& ingest_options,
+                                 const std::string& dbname, const std::string& external_file,
+                                 const Version& current, uint64_t file_number,
+                                 SequenceNumber* last_sequence, VersionEdit* edit) {
+    uint64_t file_size;
+    Status s = e->GetFileSize(external_file, &file_size);
+    if (s != OK) {
+        return s;
+    }
+    RandomAccessFile* file;
+    s = e->NewRandomAccessFile(external_file, &file);
+    if (s != OK) {
+        return s;
+    }
+    TableProperties props;
+    s = ReadTableProperties(file, file_size, &props);
+    delete file;
+    if (s != OK) {
+        return s;
+    }
+    if (props.num_entries == 0 || props.largest_seqno != 0 ||
+        props.smallest_key.size() < 8 || props.largest_key.size() < 8) {
+        return InvalidArgument;
+    }
+    slice smallest_user_key = ExtractUserKey(slice(props.smallest_key));
+    slice largest_user_key = ExtractUserKey(slice(props.largest_key));
+    if (std::string(smallest_user_key.data(), smallest_user_key.size()) >
+        std::string(largest_user_key.data(), largest_user_key.size())) {
+        return Corruption;
+    }
+
+    int level = 0;
+    for (int l = 0; l < kNumLevels; l++) {
+        if (current.OverlapInLevel(l, smallest_user_key, largest_user_key)) {
+            break;
+        }
+        level = l;
+    }
+
+    const std::string fname = TableFileName(dbname, file_number);
+    s = IOError;
+    if (ingest_options.move_files) {
+        s = e->LinkFile(external_file, fname);
+    }
+    if (s != OK) {
+        s = CopyFile(e, external_file, fname);
+        if (s != OK) {
+            return s;
+        }
+    }
+
+    FileMetaData meta;
+    meta.number = file_number;
+    meta.file_size = file_size;
+    meta.smallest = props.smallest_key;
+    meta.largest = props.largest_key;
+    meta.global_seqno = ++(*last_sequence);
+    edit->AddFile(level, meta);
+    return OK;
+}
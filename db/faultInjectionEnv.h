@@ -0,0 +1,346 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include "env.h"
+//包装另一个env并注入故障，用于测试崩溃恢复和I/O错误处理：
+//  - 记录每个写入文件已Fsync的长度（Fsync会先写出用户态缓冲区），
+//    DropUnsyncedFileData()把文件截断到该长度，模拟掉电丢失page cache；
+//  - SetFilesystemActive(false)之后所有写入、Fsync和目录修改都返回IOError，模拟进程在此刻崩溃；
+//  - SetIOErrorOneIn(n)使每次读、写、Fsync以1/n的概率返回IOError，随机数种子固定，结果可重复。
+//只追踪通过本env打开的写入文件，新建后从未Fsync的文件截断为空文件。
+//后台线程池和限速器使用本env自己的（不转发给base），base只提供文件系统
+class FaultInjectionEnv : public env {
+public:
+    //base由调用者持有，必须比本env存活更久
+    explicit FaultInjectionEnv(env* base, uint32_t seed = 301) : env(0), base_(base), random_(seed) {}
+    ~FaultInjectionEnv() override {
+        JoinAllThreads();
+    }
+
+    //active为false时写入类操作全部失败，直到重新设为true
+    void SetFilesystemActive(bool active) {
+        std::lock_guard<std::mutex> l(mutex_);
+        filesystem_active_ = active;
+    }
+    bool IsFilesystemActive() const {
+        std::lock_guard<std::mutex> l(mutex_);
+        return filesystem_active_;
+    }
+    //n为0时关闭随机错误
+    void SetIOErrorOneIn(uint32_t n) {
+        std::lock_guard<std::mutex> l(mutex_);
+        io_error_one_in_ = n;
+    }
+    //累计注入的随机错误数
+    uint64_t InjectedErrors() const {
+        std::lock_guard<std::mutex> l(mutex_);
+        return injected_errors_;
+    }
+
+    //把所有追踪的文件截断到最后一次Fsync时的长度。
+    //调用前应关闭（或停止使用）这些文件，否则之后的写入会接在被截断的位置之前
+    Status DropUnsyncedFileData() {
+        std::map<std::string, FileState> files;
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            files = files_;
+        }
+        for (const auto& entry : files) {
+            if (entry.second.pos > entry.second.synced) {
+                Status s = Truncate(entry.first, entry.second.synced);
+                if (s != OK) {
+                    return s;
+                }
+                std::lock_guard<std::mutex> l(mutex_);
+                auto it = files_.find(entry.first);
+                if (it != files_.end()) {
+                    it->second.pos = entry.second.synced;
+                }
+            }
+        }
+        return OK;
+    }
+
+    Status NewSequentialFile(const std::string& filename, SequentialFile** result) override {
+        SequentialFile* file;
+        Status s = base_->NewSequentialFile(filename, &file);
+        *result = (s == OK) ? new FaultSequentialFile(this, file) : nullptr;
+        return s;
+    }
+    Status NewRandomAccessFile(const std::string& filename, RandomAccessFile** result,
+                               bool use_direct_io = false) override {
+        RandomAccessFile* file;
+        Status s = base_->NewRandomAccessFile(filename, &file, use_direct_io);
+        *result = (s == OK) ? new FaultRandomAccessFile(this, file) : nullptr;
+        return s;
+    }
+    Status NewWritableFile(const std::string& filename, WritableFile** result, bool use_direct_io = false,
+                           const WritableFileOptions& options = WritableFileOptions()) override {
+        *result = nullptr;
+        if (!IsFilesystemActive()) {
+            return IOError;
+        }
+        WritableFile* file;
+        Status s = base_->NewWritableFile(filename, &file, use_direct_io, options);
+        if (s != OK) {
+            return s;
+        }
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            files_[filename] = FileState();
+        }
+        *result = WrapWritableFile(filename, file);
+        return OK;
+    }
+    //打开前已有的内容视为已经持久化
+    Status NewAppendableFile(const std::string& filename, WritableFile** result,
+                             const WritableFileOptions& options = WritableFileOptions::ForLogFile()) override {
+        *result = nullptr;
+        if (!IsFilesystemActive()) {
+            return IOError;
+        }
+        uint64_t size = 0;
+        if (base_->FileExists(filename) && base_->GetFileSize(filename, &size) != OK) {
+            return IOError;
+        }
+        WritableFile* file;
+        Status s = base_->NewAppendableFile(filename, &file, options);
+        if (s != OK) {
+            return s;
+        }
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            FileState& state = files_[filename];
+            state.pos = state.synced = size;
+        }
+        *result = WrapWritableFile(filename, file);
+        return OK;
+    }
+
+    bool FileExists(const std::string& filename) override {
+        return base_->FileExists(filename);
+    }
+    Status GetChildren(const std::string& directory_path, std::vector<std::string>* result) override {
+        return base_->GetChildren(directory_path, result);
+    }
+    Status RemoveFile(const std::string& filename) override {
+        if (!IsFilesystemActive()) {
+            return IOError;
+        }
+        Status s = base_->RemoveFile(filename);
+        if (s == OK) {
+            std::lock_guard<std::mutex> l(mutex_);
+            files_.erase(filename);
+        }
+        return s;
+    }
+    Status CreateDir(const std::string& dirname) override {
+        return IsFilesystemActive() ? base_->CreateDir(dirname) : IOError;
+    }
+    Status RemoveDir(const std::string& dirname) override {
+        return IsFilesystemActive() ? base_->RemoveDir(dirname) : IOError;
+    }
+    Status GetFileSize(const std::string& filename, uint64_t* size) override {
+        return base_->GetFileSize(filename, size);
+    }
+    Status RenameFile(const std::string& from, const std::string& to) override {
+        if (!IsFilesystemActive()) {
+            return IOError;
+        }
+        Status s = base_->RenameFile(from, to);
+        if (s == OK) {
+            std::lock_guard<std::mutex> l(mutex_);
+            auto it = files_.find(from);
+            files_.erase(to);
+            if (it != files_.end()) {
+                files_[to] = it->second;
+                files_.erase(it);
+            }
+        }
+        return s;
+    }
+    Status LinkFile(const std::string& from, const std::string& to) override {
+        return IsFilesystemActive() ? base_->LinkFile(from, to) : IOError;
+    }
+
+private:
+    //一个写入文件的状态：pos为已写入的长度，synced为最后一次Fsync时的长度
+    struct FileState {
+        uint64_t pos = 0;
+        uint64_t synced = 0;
+    };
+
+    class FaultSequentialFile : public SequentialFile {
+    public:
+        FaultSequentialFile(FaultInjectionEnv* env, SequentialFile* base) : env_(env), base_(base) {}
+        Status Read(size_t n, slice* result, char* scratch) override {
+            if (env_->ShouldInjectError()) {
+                *result = slice(scratch, 0);
+                return IOError;
+            }
+            return base_->Read(n, result, scratch);
+        }
+        Status Skip(uint64_t n) override {
+            return base_->Skip(n);
+        }
+
+    private:
+        FaultInjectionEnv* const env_;
+        std::unique_ptr<SequentialFile> base_;
+    };
+
+    class FaultRandomAccessFile : public RandomAccessFile {
+    public:
+        FaultRandomAccessFile(FaultInjectionEnv* env, RandomAccessFile* base) : env_(env), base_(base) {}
+        Status Read(uint64_t offset, slice* result, char* scratch, size_t n) const override {
+            if (env_->ShouldInjectError()) {
+                *result = slice(scratch, 0);
+                return IOError;
+            }
+            return base_->Read(offset, result, scratch, n);
+        }
+        void Hint(AccessPattern pattern, uint64_t offset = 0, uint64_t length = 0) const override {
+            base_->Hint(pattern, offset, length);
+        }
+        bool NeedsScratch() const override { return base_->NeedsScratch(); }
+
+    private:
+        FaultInjectionEnv* const env_;
+        std::unique_ptr<RandomAccessFile> base_;
+    };
+
+    //限速在包装层进行，SetIOPriority作用于包装后的文件
+    class FaultWritableFile : public WritableFile {
+    public:
+        FaultWritableFile(FaultInjectionEnv* env, const std::string& filename, WritableFile* base)
+            : env_(env), filename_(filename), base_(base) {}
+        ~FaultWritableFile() override {
+            Close();
+        }
+        Status Append(const slice& data) override {
+            if (!env_->IsFilesystemActive() || env_->ShouldInjectError()) {
+                return IOError;
+            }
+            RateLimit(data.size());
+            Status s = base_->Append(data);
+            if (s == OK) {
+                env_->OnAppend(filename_, data.size());
+            }
+            return s;
+        }
+        Status FlushBUffer() override {
+            return env_->IsFilesystemActive() ? base_->FlushBUffer() : IOError;
+        }
+        Status Fsync() override {
+            if (!env_->IsFilesystemActive() || env_->ShouldInjectError()) {
+                return IOError;
+            }
+            Status s = base_->Fsync();
+            if (s == OK) {
+                env_->OnSync(filename_);
+            }
+            return s;
+        }
+        //文件系统不可用时不再写出缓冲区中的数据
+        Status Close() override {
+            if (base_ == nullptr) {
+                return OK;
+            }
+            Status s = env_->IsFilesystemActive() ? base_->Close() : IOError;
+            base_.reset();
+            return s;
+        }
+
+    private:
+        FaultInjectionEnv* const env_;
+        const std::string filename_;
+        std::unique_ptr<WritableFile> base_;
+    };
+
+    WritableFile* WrapWritableFile(const std::string& filename, WritableFile* file) {
+        //包装层负责限速，base的文件不再重复限速
+        file->SetRateLimiter(nullptr);
+        WritableFile* wrapped = new FaultWritableFile(this, filename, file);
+        wrapped->SetRateLimiter(rate_limiter_);
+        return wrapped;
+    }
+
+    bool ShouldInjectError() {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (io_error_one_in_ == 0 || random_() % io_error_one_in_ != 0) {
+            return false;
+        }
+        injected_errors_++;
+        return true;
+    }
+    void OnAppend(const std::string& filename, size_t n) {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto it = files_.find(filename);
+        if (it != files_.end()) {
+            it->second.pos += n;
+        }
+    }
+    void OnSync(const std::string& filename) {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto it = files_.find(filename);
+        if (it != files_.end()) {
+            it->second.synced = it->second.pos;
+        }
+    }
+
+    //env没有截断接口，读出前size字节后重写文件
+    Status Truncate(const std::string& filename, uint64_t size) {
+        SequentialFile* src;
+        Status s = base_->NewSequentialFile(filename, &src);
+        if (s != OK) {
+            return s;
+        }
+        std::string contents;
+        std::unique_ptr<char[]> scratch(new char[kTruncateBufferSize]);
+        while (s == OK && contents.size() < size) {
+            slice fragment;
+            const size_t n = static_cast<size_t>(std::min<uint64_t>(kTruncateBufferSize, size - contents.size()));
+            s = src->Read(n, &fragment, scratch.get());
+            if (s == OK && fragment.size() == 0) {
+                break;
+            }
+            contents.append(fragment.data(), fragment.size());
+        }
+        delete src;
+        if (s != OK) {
+            return s;
+        }
+        WritableFile* dst;
+        s = base_->NewWritableFile(filename, &dst);
+        if (s != OK) {
+            return s;
+        }
+        dst->SetRateLimiter(nullptr);
+        s = dst->Append(slice(contents.data(), contents.size()));
+        if (s == OK) {
+            s = dst->FlushBUffer();
+        }
+        if (s == OK) {
+            s = dst->Fsync();
+        }
+        if (s == OK) {
+            s = dst->Close();
+        }
+        delete dst;
+        return s;
+    }
+
+    static constexpr size_t kTruncateBufferSize = 64 * 1024;
+
+    env* const base_;
+    mutable std::mutex mutex_;
+    bool filesystem_active_ = true;
+    uint32_t io_error_one_in_ = 0;
+    uint64_t injected_errors_ = 0;
+    std::minstd_rand random_;
+    std::map<std::string, FileState> files_;  //通过本env打开过的写入文件
+};
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+//数据库目录中各类文件的命名
+
+//sstable文件名：dbname/000123.ldb
+inline std::string TableFileName(const std::string& dbname, uint64_t number) {
+    char buf[100];
+    std::snprintf(buf, sizeof(buf), "/%06llu.%s",
+                  static_cast<unsigned long long>(number), "ldb");
+    return dbname + buf;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "env.h"
+
+// A FilterPolicy creates a small filter from a set of keys that is stored
+// in a Table and used to skip disk reads for keys that are not present.
+// FilterBlockBuilder and FilterBlockReader only talk to this interface, so
+// any filter implementation can be plugged in through Options.
+class FilterPolicy {
+public:
+virtual ~FilterPolicy() = default;
+
+// Return the name of this policy.  The name is recorded in the table's
+// metaindex, so changing the encoding of a policy must change its name,
+// otherwise old filters would be passed to the new code.
+virtual const char* Name() const = 0;
+
+// keys[0,n-1] contains a list of keys (potentially with duplicates).
+// Append a filter that summarizes keys[0,n-1] to *dst.
+virtual void CreateFilter(const slice* keys, int n, std::string* dst) const = 0;
+
+// Policies whose filters depend on a key only through a 64-bit hash of it
+// return true here.  Builders then call HashKey() as keys arrive and keep
+// only the hashes, and build the filter with CreateFilterFromHashes(),
+// instead of buffering every key until the filter is generated.
+virtual bool SupportsKeyHashes() const { return false; }
+
+// REQUIRES: SupportsKeyHashes().
+virtual uint64_t HashKey(const slice&) const { return 0; }
+
+// REQUIRES: SupportsKeyHashes().  Appends the same filter CreateFilter()
+// would for keys whose HashKey() values are hashes[0,n-1].
+virtual void CreateFilterFromHashes(const uint64_t*, int,
+                                    std::string*) const {}
+
+// "filter" contains the data appended by a preceding call to
+// CreateFilter() on this class.  Must return true if the key was in the
+// list passed to CreateFilter(); may return true or false otherwise, but
+// should aim to return false with a high probability.
+virtual bool KeyMayMatch(const slice& key, const slice& filter) const = 0;
+
+// Batched KeyMayMatch: results[i] = KeyMayMatch(keys[i], filter).
+// Implementations hash every key and prefetch the memory each one will
+// probe before testing any bits, so the cache misses of a batch overlap
+// instead of being paid one after another.
+virtual void KeysMayMatch(const slice* keys, int n, const slice& filter,
+                          bool* results) const {
+    for (int i = 0; i < n; i++) {
+        results[i] = KeyMayMatch(keys[i], filter);
+    }
+}
+};
+
+// Number of keys hashed and prefetched ahead of testing in KeysMayMatch.
+static const int kFilterBatchSize = 16;
+
+inline void PrefetchForRead(const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr, 0 /* read */, 1 /* low temporal locality */);
+#else
+    (void)addr;
+#endif
+}
@@ -4,6 +4,8 @@
 
 #include "filter_block.h"
 
+#include <cstring>
+
 
 // See doc/table_format.md for an explanation of the filter block format.
 
@@ -11,8 +13,8 @@
 static const size_t kFilterBaseLg = 11;
 static const size_t kFilterBase = 1 << kFilterBaseLg;
 
-FilterBlockBuilder::FilterBlockBuilder(const BloomFilterPolicy* policy)
-    : policy_(policy) {}
+FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy)
+    : policy_(policy), hash_keys_(policy->SupportsKeyHashes()) {}
 
 void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
   uint64_t filter_index = (block_offset / kFilterBase);
@@ -23,13 +25,26 @@ void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
 }
 
 void FilterBlockBuilder::AddKey(const slice& key) {
-  slice k = key;
+  if (hash_keys_) {
+    // Equal hashes set the same bits, so consecutive duplicates (and the
+    // rare consecutive collision) can be dropped.
+    const uint64_t h = policy_->HashKey(key);
+    if (hashes_.empty() || hashes_.back() != h) {
+      hashes_.push_back(h);
+    }
+    return;
+  }
+  if (!start_.empty() &&
+      keys_.size() - start_.back() == static_cast<size_t>(key.size()) &&
+      memcmp(keys_.data() + start_.back(), key.data(), key.size()) == 0) {
+    return;  // Same as the previous key
+  }
   start_.push_back(keys_.size());
-  keys_.append(k.data(), k.size());
+  keys_.append(key.data(), key.size());
 }
 
 slice FilterBlockBuilder::Finish() {
-  if (!start_.empty()) {
+  if (!start_.empty() || !hashes_.empty()) {
     GenerateFilter();
   }
 
@@ -49,13 +64,21 @@ slice FilterBlockBuilder::Finish() {
 }
 
 void FilterBlockBuilder::GenerateFilter() {
-  const size_t num_keys = start_.size();
+  const size_t num_keys = hash_keys_ ? hashes_.size() : start_.size();
   if (num_keys == 0) {
     // Fast path if there are no keys for this filter
     filter_offsets_.push_back(result_.size());
     return;
   }
 
+  if (hash_keys_) {
+    filter_offsets_.push_back(result_.size());
+    policy_->CreateFilterFromHashes(hashes_.data(), static_cast<int>(num_keys),
+                                    &result_);
+    hashes_.clear();
+    return;
+  }
+
   // Make list of keys from flattened key structure
   start_.push_back(keys_.size());  // Simplify length computation
   tmp_keys_.resize(num_keys);
@@ -74,7 +97,7 @@ void FilterBlockBuilder::GenerateFilter() {
   start_.clear();
 }
 
-FilterBlockReader::FilterBlockReader(const BloomFilterPolicy* policy,
+FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
                                      const slice& contents)
     : policy_(policy), data_(nullptr), offset_(nullptr), num_(0), base_lg_(0) {
   size_t n = contents.size();
@@ -88,18 +111,146 @@ FilterBlockReader::FilterBlockReader(const BloomFilterPolicy* policy,
 }
 
 bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const slice& key) {
+  slice filter;
+  bool result;
+  if (!GetFilter(block_offset, &filter, &result)) return result;
+  return policy_->KeyMayMatch(key, filter);
+}
+
+void FilterBlockReader::KeysMayMatch(const uint64_t* block_offsets,
+                                     const slice* keys, int n, bool* results) {
+  int i = 0;
+  while (i < n) {
+    const uint64_t index = block_offsets[i] >> base_lg_;
+    int j = i + 1;
+    while (j < n && (block_offsets[j] >> base_lg_) == index) j++;
+    slice filter;
+    bool result;
+    if (GetFilter(block_offsets[i], &filter, &result)) {
+      policy_->KeysMayMatch(keys + i, j - i, filter, results + i);
+    } else {
+      for (int k = i; k < j; k++) results[k] = result;
+    }
+    i = j;
+  }
+}
+
+bool FilterBlockReader::GetFilter(uint64_t block_offset, slice* filter,
+                                  bool* result) const {
   uint64_t index = block_offset >> base_lg_;
   if (index < num_) {
     uint32_t start = coding::DecodeFixed32(offset_ + index * 4);
     uint32_t limit = coding::DecodeFixed32(offset_ + index * 4 + 4);
     if (start <= limit && limit <= static_cast<size_t>(offset_ - data_)) {
-      slice filter = slice(data_ + start, limit - start);
-      return policy_->KeyMayMatch(key, filter);
+      *filter = slice(data_ + start, limit - start);
+      return true;
     } else if (start == limit) {
       // Empty filters do not match any keys
+      *result = false;
       return false;
     }
   }
-  return true;  // Errors are treated as potential matches
+  *result = true;  // Errors are treated as potential matches
+  return false;
 }
 
+
+FullFilterBlockBuilder::FullFilterBlockBuilder(const FilterPolicy* policy)
+    : policy_(policy), hash_keys_(policy->SupportsKeyHashes()) {}
+
+void FullFilterBlockBuilder::AddKey(const slice& key) {
+  if (hash_keys_) {
+    const uint64_t h = policy_->HashKey(key);
+    if (hashes_.empty() || hashes_.back() != h) {
+      hashes_.push_back(h);
+    }
+    return;
+  }
+  if (!start_.empty() &&
+      keys_.size() - start_.back() == static_cast<size_t>(key.size()) &&
+      memcmp(keys_.data() + start_.back(), key.data(), key.size()) == 0) {
+    return;  // Same as the previous key
+  }
+  start_.push_back(keys_.size());
+  keys_.append(key.data(), key.size());
+}
+
+slice FullFilterBlockBuilder::Finish() {
+  result_.clear();
+  const size_t num_keys = NumKeys();
+  if (num_keys == 0) {
+    return slice(result_);
+  }
+
+  if (hash_keys_) {
+    policy_->CreateFilterFromHashes(hashes_.data(), static_cast<int>(num_keys),
+                                    &result_);
+    hashes_.clear();
+    return slice(result_);
+  }
+
+  start_.push_back(keys_.size());  // Simplify length computation
+  tmp_keys_.resize(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    const char* base = keys_.data() + start_[i];
+    size_t length = start_[i + 1] - start_[i];
+    tmp_keys_[i] = slice(base, length);
+  }
+  policy_->CreateFilter(&tmp_keys_[0], static_cast<int>(num_keys), &result_);
+
+  tmp_keys_.clear();
+  keys_.clear();
+  start_.clear();
+  return slice(result_);
+}
+
+PartitionedFilterBlockBuilder::PartitionedFilterBlockBuilder(
+    const FilterPolicy* policy, size_t keys_per_partition)
+    : partition_builder_(policy), keys_per_partition_(keys_per_partition) {}
+
+void PartitionedFilterBlockBuilder::AddKey(const slice& key) {
+  partition_builder_.AddKey(key);
+}
+
+void PartitionedFilterBlockBuilder::EndBlock(const slice& last_key) {
+  last_key_.assign(last_key.data(), last_key.size());
+  if (partition_builder_.NumKeys() >= keys_per_partition_) {
+    CutPartition();
+  }
+}
+
+std::vector<PartitionedFilterBlockBuilder::Partition>*
+PartitionedFilterBlockBuilder::Finish() {
+  if (partition_builder_.NumKeys() > 0) {
+    CutPartition();
+  }
+  return &partitions_;
+}
+
+void PartitionedFilterBlockBuilder::CutPartition() {
+  slice filter = partition_builder_.Finish();
+  Partition partition;
+  partition.last_key = last_key_;
+  partition.filter.assign(filter.data(), filter.size());
+  partitions_.push_back(std::move(partition));
+}
+
+PartitionedFilterBlockReader::PartitionedFilterBlockReader(
+    const BlockContents& index_contents)
+    : index_(new Block(index_contents)) {}
+
+PartitionedFilterBlockReader::~PartitionedFilterBlockReader() { delete index_; }
+
+bool PartitionedFilterBlockReader::FindPartition(const slice& key,
+                                                 BlockHandle* handle) const {
+  Iterator* iter = index_->NewIterator();
+  iter->Seek(std::string(key.data(), key.size()));
+  if (!iter->Valid()) {
+    delete iter;
+    return false;
+  }
+  std::string encoding = iter->value();
+  delete iter;
+  slice input(encoding);
+  return handle->DecodeFrom(&input) == OK;
+}
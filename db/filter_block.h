@@ -7,7 +7,8 @@
 #include <vector>
 
 #include "env.h"
-#include "bloom.h"
+#include "filterPolicy.h"
+#include "block.h"
 #include "coding.h"
 
 // A FilterBlockBuilder is used to construct all of the filters for a
@@ -18,7 +19,7 @@
 //      (StartBlock AddKey*)* Finish
 class FilterBlockBuilder {
  public:
-  explicit FilterBlockBuilder(const BloomFilterPolicy*);
+  explicit FilterBlockBuilder(const FilterPolicy*);
 
   FilterBlockBuilder(const FilterBlockBuilder&) = delete;
   FilterBlockBuilder& operator=(const FilterBlockBuilder&) = delete;
@@ -30,8 +31,10 @@ class FilterBlockBuilder {
  private:
   void GenerateFilter();
 
-  const BloomFilterPolicy* policy_;
-  std::string keys_;             // Flattened key contents
+  const FilterPolicy* policy_;
+  const bool hash_keys_;         // policy_->SupportsKeyHashes()
+  std::vector<uint64_t> hashes_; // Hashes of the keys, if hash_keys_
+  std::string keys_;             // Flattened key contents, if !hash_keys_
   std::vector<size_t> start_;    // Starting index in keys_ of each key
   std::string result_;           // Filter data computed so far
   std::vector<slice> tmp_keys_;  // policy_->CreateFilter() argument
@@ -41,16 +44,133 @@ class FilterBlockBuilder {
 class FilterBlockReader {
  public:
   // REQUIRES: "contents" and *policy must stay live while *this is live.
-  FilterBlockReader(const BloomFilterPolicy* policy, const slice& contents);
+  FilterBlockReader(const FilterPolicy* policy, const slice& contents);
   bool KeyMayMatch(uint64_t block_offset, const slice& key);
+  // results[i] = KeyMayMatch(block_offsets[i], keys[i]).  Consecutive keys
+  // that fall under the same filter are probed as one batch.
+  void KeysMayMatch(const uint64_t* block_offsets, const slice* keys, int n,
+                    bool* results);
 
  private:
-  const BloomFilterPolicy* policy_;
+  // Stores the filter covering "block_offset" in *filter.  Returns false
+  // if there is none, in which case *result holds the answer for any key.
+  bool GetFilter(uint64_t block_offset, slice* filter, bool* result) const;
+
+  const FilterPolicy* policy_;
   const char* data_;    // Pointer to filter data (at block-start)
   const char* offset_;  // Pointer to beginning of offset array (at block-end)
   size_t num_;          // Number of entries in offset array
   size_t base_lg_;      // Encoding parameter (see kFilterBaseLg in .cc file)
 };
 
+// A FullFilterBlockBuilder builds a single filter over every key of a
+// Table, so a lookup probes exactly one filter and the false positive
+// rate is that of one large filter instead of many tiny ones.
+//
+// The sequence of calls must match the regexp:
+//      AddKey* Finish
+class FullFilterBlockBuilder {
+ public:
+  explicit FullFilterBlockBuilder(const FilterPolicy*);
+
+  FullFilterBlockBuilder(const FullFilterBlockBuilder&) = delete;
+  FullFilterBlockBuilder& operator=(const FullFilterBlockBuilder&) = delete;
+
+  void AddKey(const slice& key);
+  size_t NumKeys() const { return hash_keys_ ? hashes_.size() : start_.size(); }
+  // Returns the filter for the keys added since the last Finish() and
+  // resets the builder so it can be reused for another filter.  The
+  // returned slice stays valid until the next call to AddKey().
+  slice Finish();
+
+ private:
+  const FilterPolicy* policy_;
+  const bool hash_keys_;         // policy_->SupportsKeyHashes()
+  std::vector<uint64_t> hashes_; // Hashes of the keys, if hash_keys_
+  std::string keys_;             // Flattened key contents, if !hash_keys_
+  std::vector<size_t> start_;    // Starting index in keys_ of each key
+  std::string result_;           // Last filter returned by Finish()
+  std::vector<slice> tmp_keys_;  // policy_->CreateFilter() argument
+};
+
+// A PartitionedFilterBlockBuilder splits the keys of a large Table into
+// partitions that end on data block boundaries.  Each partition gets its
+// own full filter which the TableBuilder writes as a separate block, plus
+// a partition index block mapping the last key of every partition to the
+// handle of its filter.  A lookup reads the small index and exactly one
+// partition, and each partition can be cached on its own.
+//
+// The sequence of calls must match the regexp:
+//      (AddKey* EndBlock)* Finish
+class PartitionedFilterBlockBuilder {
+ public:
+  struct Partition {
+    std::string last_key;  // Largest key covered by the partition
+    std::string filter;    // Full filter over the partition's keys
+  };
+
+  PartitionedFilterBlockBuilder(const FilterPolicy*,
+                                size_t keys_per_partition);
+
+  PartitionedFilterBlockBuilder(const PartitionedFilterBlockBuilder&) = delete;
+  PartitionedFilterBlockBuilder& operator=(
+      const PartitionedFilterBlockBuilder&) = delete;
+
+  void AddKey(const slice& key);
+  // Called after each data block; "last_key" is the last key of that block.
+  // Cuts a partition once it holds at least keys_per_partition keys.
+  void EndBlock(const slice& last_key);
+  // Returns every partition in key order.  The caller decides whether to
+  // write them partitioned or, for a single partition, as a full filter.
+  std::vector<Partition>* Finish();
+
+ private:
+  void CutPartition();
+
+  FullFilterBlockBuilder partition_builder_;
+  const size_t keys_per_partition_;
+  std::string last_key_;
+  std::vector<Partition> partitions_;
+};
+
+class FullFilterBlockReader {
+ public:
+  // REQUIRES: "contents" and *policy must stay live while *this is live.
+  FullFilterBlockReader(const FilterPolicy* policy, const slice& contents)
+      : policy_(policy), contents_(contents) {}
+  bool KeyMayMatch(const slice& key) const {
+    return policy_->KeyMayMatch(key, contents_);
+  }
+  void KeysMayMatch(const slice* keys, int n, bool* results) const {
+    policy_->KeysMayMatch(keys, n, contents_, results);
+  }
+
+ private:
+  const FilterPolicy* policy_;
+  slice contents_;
+};
+
+// Reads the partition index written for a partitioned filter.  Loading
+// the partition itself is left to the caller, which owns the file and
+// any block cache.
+class PartitionedFilterBlockReader {
+ public:
+  // Takes ownership of index_contents.data if index_contents.heap_allocated
+  // is true and frees it on destruction.  Otherwise the data (e.g. a region
+  // of an mmap'd file) must stay live while *this is live.
+  explicit PartitionedFilterBlockReader(const BlockContents& index_contents);
+  ~PartitionedFilterBlockReader();
+
+  PartitionedFilterBlockReader(const PartitionedFilterBlockReader&) = delete;
+  PartitionedFilterBlockReader& operator=(
+      const PartitionedFilterBlockReader&) = delete;
+
+  // Stores the handle of the partition that may contain "key".  Returns
+  // false if "key" is past the last partition, i.e. cannot be in the table.
+  bool FindPartition(const slice& key, BlockHandle* handle) const;
+
+ private:
+  Block* index_;
+};
 
 #endif  // STORAGE_LEVELDB_TABLE_FILTER_BLOCK_H_
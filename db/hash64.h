@@ -0,0 +1,291 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "coding.h"
+
+// A 64-bit non-cryptographic hash in the style of XXH3.  Short keys (up to
+// 240 bytes) are handled by a few 64x64->128 multiplies; long keys are
+// consumed in 64-byte stripes by eight independent 64-bit accumulators,
+// which the SSE2/AVX2 paths update two or four at a time.  All paths
+// produce the same value, so it can be stored in files (filters).
+//
+// It is not bit-compatible with XXH3: the secret and the seeding are our
+// own.  Compared with the 32-bit Hash() in tableCache.h it is several
+// times faster on long keys and its 64 bits keep very large filters from
+// being limited by hash collisions.
+
+namespace hash64_internal {
+
+static const uint64_t kPrime32_1 = 0x9e3779b1u;
+static const uint64_t kPrime32_2 = 0x85ebca77u;
+static const uint64_t kPrime32_3 = 0xc2b2ae3du;
+static const uint64_t kPrime64_1 = 0x9e3779b185ebca87ull;
+static const uint64_t kPrime64_2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t kPrime64_3 = 0x165667b19e3779f9ull;
+static const uint64_t kPrime64_4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t kPrime64_5 = 0x27d4eb2f165667c5ull;
+
+static const size_t kSecretSize = 192;
+static const size_t kStripeLen = 64;
+static const size_t kSecretConsumeRate = 8;
+static const size_t kStripesPerBlock = (kSecretSize - kStripeLen) / kSecretConsumeRate;
+static const size_t kMidSizeMax = 240;
+
+// splitmix64 output, read as little-endian bytes at arbitrary offsets.
+alignas(64) static const uint64_t kSecretWords[kSecretSize / 8] = {
+    0x2cb0f69f4abea221ull, 0x9417034723148989ull, 0xdd555950609dfe03ull,
+    0xdbafb150deb12800ull, 0x7e789b2e6c442cb6ull, 0xf41e5636c7e4f8c4ull,
+    0x0959d150f8fba7e4ull, 0xa97316f13cdb9eeaull, 0x74cd8258f9520068ull,
+    0x55c74a62e116868bull, 0xd2f4c799a2023cbdull, 0xdf98cb79a37b51b9ull,
+    0x396f5885524f3905ull, 0xaf1d56386ca3b276ull, 0xa9ffbe6b5104e85aull,
+    0x6bd0c51b9fd533b3ull, 0x980ce91c50ab4b56ull, 0x28ac395780fe62c5ull,
+    0x768912e3a6bcedc7ull, 0x50b3e8c9332c7c88ull, 0xce3bbfe520bd47daull,
+    0xcba6c8e8e0bb7c4full, 0xbf194db8434a346dull, 0x7d8f2a7b60416d7full,
+};
+
+inline const char* Secret() { return reinterpret_cast<const char*>(kSecretWords); }
+
+inline uint64_t Read64(const char* p) { return coding::DecodeFixed64(p); }
+inline uint32_t Read32(const char* p) { return coding::DecodeFixed32(p); }
+
+inline uint64_t Rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t Swap64(uint64_t x) { return __builtin_bswap64(x); }
+
+// 64x64->128 multiply, folded to 64 bits by XORing the halves.
+inline uint64_t Mul128Fold64(uint64_t lhs, uint64_t rhs) {
+  unsigned __int128 product = static_cast<unsigned __int128>(lhs) * rhs;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+inline uint64_t Avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= 0x165667919e3779f9ull;
+  h ^= h >> 32;
+  return h;
+}
+
+// XXH64's finalizer, used for the weakest (1 to 3 byte) inputs.
+inline uint64_t Avalanche64(uint64_t h) {
+  h ^= h >> 33;
+  h *= kPrime64_2;
+  h ^= h >> 29;
+  h *= kPrime64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t Rrmxmx(uint64_t h, uint64_t len) {
+  h ^= Rotl64(h, 49) ^ Rotl64(h, 24);
+  h *= 0x9fb21c651e98df25ull;
+  h ^= (h >> 35) + len;
+  h *= 0x9fb21c651e98df25ull;
+  return h ^ (h >> 28);
+}
+
+inline uint64_t Len1To3(const char* p, size_t len, const char* secret, uint64_t seed) {
+  const uint8_t c1 = p[0];
+  const uint8_t c2 = p[len >> 1];
+  const uint8_t c3 = p[len - 1];
+  const uint32_t combined = (static_cast<uint32_t>(c1) << 16) |
+                            (static_cast<uint32_t>(c2) << 24) |
+                            (static_cast<uint32_t>(c3) << 0) |
+                            (static_cast<uint32_t>(len) << 8);
+  const uint64_t bitflip = (Read32(secret) ^ Read32(secret + 4)) + seed;
+  return Avalanche64(static_cast<uint64_t>(combined) ^ bitflip);
+}
+
+inline uint64_t Len4To8(const char* p, size_t len, const char* secret, uint64_t seed) {
+  seed ^= static_cast<uint64_t>(__builtin_bswap32(static_cast<uint32_t>(seed))) << 32;
+  const uint32_t input1 = Read32(p);
+  const uint32_t input2 = Read32(p + len - 4);
+  const uint64_t bitflip = (Read64(secret + 8) ^ Read64(secret + 16)) - seed;
+  const uint64_t input64 = input2 + (static_cast<uint64_t>(input1) << 32);
+  return Rrmxmx(input64 ^ bitflip, len);
+}
+
+inline uint64_t Len9To16(const char* p, size_t len, const char* secret, uint64_t seed) {
+  const uint64_t bitflip1 = (Read64(secret + 24) ^ Read64(secret + 32)) + seed;
+  const uint64_t bitflip2 = (Read64(secret + 40) ^ Read64(secret + 48)) - seed;
+  const uint64_t input_lo = Read64(p) ^ bitflip1;
+  const uint64_t input_hi = Read64(p + len - 8) ^ bitflip2;
+  const uint64_t acc = len + Swap64(input_lo) + input_hi + Mul128Fold64(input_lo, input_hi);
+  return Avalanche(acc);
+}
+
+inline uint64_t Mix16B(const char* p, const char* secret, uint64_t seed) {
+  return Mul128Fold64(Read64(p) ^ (Read64(secret) + seed),
+                      Read64(p + 8) ^ (Read64(secret + 8) - seed));
+}
+
+inline uint64_t Len17To128(const char* p, size_t len, const char* secret, uint64_t seed) {
+  uint64_t acc = len * kPrime64_1;
+  if (len > 32) {
+    if (len > 64) {
+      if (len > 96) {
+        acc += Mix16B(p + 48, secret + 96, seed);
+        acc += Mix16B(p + len - 64, secret + 112, seed);
+      }
+      acc += Mix16B(p + 32, secret + 64, seed);
+      acc += Mix16B(p + len - 48, secret + 80, seed);
+    }
+    acc += Mix16B(p + 16, secret + 32, seed);
+    acc += Mix16B(p + len - 32, secret + 48, seed);
+  }
+  acc += Mix16B(p, secret, seed);
+  acc += Mix16B(p + len - 16, secret + 16, seed);
+  return Avalanche(acc);
+}
+
+inline uint64_t Len129To240(const char* p, size_t len, const char* secret, uint64_t seed) {
+  const size_t kStartOffset = 3;
+  const size_t kLastOffset = 17;
+  uint64_t acc = len * kPrime64_1;
+  const size_t rounds = len / 16;
+  for (size_t i = 0; i < 8; i++) {
+    acc += Mix16B(p + 16 * i, secret + 16 * i, seed);
+  }
+  acc = Avalanche(acc);
+  for (size_t i = 8; i < rounds; i++) {
+    acc += Mix16B(p + 16 * i, secret + 16 * (i - 8) + kStartOffset, seed);
+  }
+  acc += Mix16B(p + len - 16, secret + kSecretSize - kLastOffset, seed);
+  return Avalanche(acc);
+}
+
+// One 64-byte stripe: acc[i] += lo32(d ^ s) * hi32(d ^ s) + d[i ^ 1].
+#if defined(__AVX2__)
+inline void Accumulate512(uint64_t* acc, const char* p, const char* secret) {
+  __m256i* xacc = reinterpret_cast<__m256i*>(acc);
+  for (int i = 0; i < 2; i++) {
+    const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p) + i);
+    const __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i);
+    const __m256i data_key = _mm256_xor_si256(data, key);
+    const __m256i data_key_hi = _mm256_srli_epi64(data_key, 32);
+    const __m256i product = _mm256_mul_epu32(data_key, data_key_hi);
+    const __m256i data_swap = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    const __m256i sum = _mm256_add_epi64(_mm256_loadu_si256(xacc + i), data_swap);
+    _mm256_storeu_si256(xacc + i, _mm256_add_epi64(product, sum));
+  }
+}
+
+inline void ScrambleAcc(uint64_t* acc, const char* secret) {
+  __m256i* xacc = reinterpret_cast<__m256i*>(acc);
+  const __m256i prime = _mm256_set1_epi32(static_cast<int>(kPrime32_1));
+  for (int i = 0; i < 2; i++) {
+    __m256i a = _mm256_loadu_si256(xacc + i);
+    a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+    a = _mm256_xor_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+    // 64-bit multiply by a 32-bit constant from two 32x32->64 products.
+    const __m256i lo = _mm256_mul_epu32(a, prime);
+    const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+    _mm256_storeu_si256(xacc + i, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+  }
+}
+#elif defined(__SSE2__)
+inline void Accumulate512(uint64_t* acc, const char* p, const char* secret) {
+  __m128i* xacc = reinterpret_cast<__m128i*>(acc);
+  for (int i = 0; i < 4; i++) {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i);
+    const __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i);
+    const __m128i data_key = _mm_xor_si128(data, key);
+    const __m128i data_key_hi = _mm_srli_epi64(data_key, 32);
+    const __m128i product = _mm_mul_epu32(data_key, data_key_hi);
+    const __m128i data_swap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    const __m128i sum = _mm_add_epi64(_mm_loadu_si128(xacc + i), data_swap);
+    _mm_storeu_si128(xacc + i, _mm_add_epi64(product, sum));
+  }
+}
+
+inline void ScrambleAcc(uint64_t* acc, const char* secret) {
+  __m128i* xacc = reinterpret_cast<__m128i*>(acc);
+  const __m128i prime = _mm_set1_epi32(static_cast<int>(kPrime32_1));
+  for (int i = 0; i < 4; i++) {
+    __m128i a = _mm_loadu_si128(xacc + i);
+    a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+    a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i));
+    const __m128i lo = _mm_mul_epu32(a, prime);
+    const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+    _mm_storeu_si128(xacc + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+  }
+}
+#else
+inline void Accumulate512(uint64_t* acc, const char* p, const char* secret) {
+  for (int i = 0; i < 8; i++) {
+    const uint64_t data = Read64(p + 8 * i);
+    const uint64_t data_key = data ^ Read64(secret + 8 * i);
+    acc[i ^ 1] += data;
+    acc[i] += (data_key & 0xffffffffu) * (data_key >> 32);
+  }
+}
+
+inline void ScrambleAcc(uint64_t* acc, const char* secret) {
+  for (int i = 0; i < 8; i++) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= Read64(secret + 8 * i);
+    acc[i] = a * kPrime32_1;
+  }
+}
+#endif
+
+inline uint64_t MergeAccs(const uint64_t* acc, const char* secret, uint64_t start) {
+  uint64_t result = start;
+  for (int i = 0; i < 4; i++) {
+    result += Mul128Fold64(acc[2 * i] ^ Read64(secret + 16 * i),
+                           acc[2 * i + 1] ^ Read64(secret + 16 * i + 8));
+  }
+  return Avalanche(result);
+}
+
+inline uint64_t HashLong(const char* p, size_t len, const char* secret, uint64_t seed) {
+  alignas(32) uint64_t acc[8] = {kPrime32_3, kPrime64_1, kPrime64_2, kPrime64_3,
+                                 kPrime64_4, kPrime32_2, kPrime64_5, kPrime32_1};
+  // The seed perturbs the lanes instead of deriving a new secret.
+  for (int i = 0; i < 8; i++) {
+    acc[i] += (i & 1) ? -seed : seed;
+  }
+  const size_t block_len = kStripeLen * kStripesPerBlock;
+  const size_t num_blocks = (len - 1) / block_len;
+  for (size_t n = 0; n < num_blocks; n++) {
+    const char* block = p + n * block_len;
+    for (size_t s = 0; s < kStripesPerBlock; s++) {
+      Accumulate512(acc, block + s * kStripeLen, secret + s * kSecretConsumeRate);
+    }
+    ScrambleAcc(acc, secret + kSecretSize - kStripeLen);
+  }
+  // Remaining full stripes, then the last 64 bytes (which may overlap).
+  const size_t nb_stripes = ((len - 1) - block_len * num_blocks) / kStripeLen;
+  const char* tail = p + num_blocks * block_len;
+  for (size_t s = 0; s < nb_stripes; s++) {
+    Accumulate512(acc, tail + s * kStripeLen, secret + s * kSecretConsumeRate);
+  }
+  Accumulate512(acc, p + len - kStripeLen, secret + kSecretSize - kStripeLen - 7);
+  return MergeAccs(acc, secret + 11, len * kPrime64_1);
+}
+
+}  // namespace hash64_internal
+
+inline uint64_t Hash64(const char* data, size_t n, uint64_t seed) {
+  using namespace hash64_internal;
+  const char* secret = Secret();
+  if (n <= 16) {
+    if (n > 8) return Len9To16(data, n, secret, seed);
+    if (n >= 4) return Len4To8(data, n, secret, seed);
+    if (n > 0) return Len1To3(data, n, secret, seed);
+    return Avalanche64(seed ^ Read64(secret + 56) ^ Read64(secret + 64));
+  }
+  if (n <= 128) return Len17To128(data, n, secret, seed);
+  if (n <= kMidSizeMax) return Len129To240(data, n, secret, seed);
+  return HashLong(data, n, secret, seed);
+}
+
+// Maps a 64-bit hash uniformly onto [0, n) without a division.
+inline uint64_t FastRange64(uint64_t hash, uint64_t n) {
+  return static_cast<uint64_t>((static_cast<unsigned __int128>(hash) * n) >> 64);
+}
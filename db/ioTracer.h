@@ -0,0 +1,724 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "env.h"
+#include "coding.h"
+//I/O的观测：按文件类型（WAL、sstable、MANIFEST）和操作统计次数、字节数和延迟分布（p50/p99/p99.9），
+//并可以把每次操作写入二进制trace文件，之后用ReplayIOTrace在另一个env上重放。
+//用于判断延迟尖刺来自磁盘还是CPU：对比引擎层的延迟和这里记录的I/O延迟即可。
+
+enum class IOFileType { WAL = 0, TABLE = 1, MANIFEST = 2, OTHER = 3 };
+static const int kNumIOFileTypes = 4;
+//READ为顺序读，RANDOM_READ为pread/mmap读，MULTI_READ按批统计，
+//APPEND和FLUSH分别为写入用户态缓冲区（满时包含write）和把缓冲区写出
+enum class IOOp { READ = 0, RANDOM_READ = 1, MULTI_READ = 2, APPEND = 3, FLUSH = 4, SYNC = 5, CLOSE = 6 };
+static const int kNumIOOps = 7;
+
+inline const char* IOFileTypeName(IOFileType type) {
+    static const char* const kNames[kNumIOFileTypes] = {"wal", "table", "manifest", "other"};
+    return kNames[static_cast<int>(type)];
+}
+inline const char* IOOpName(IOOp op) {
+    static const char* const kNames[kNumIOOps] = {"read", "pread", "multiread", "append", "flush", "sync", "close"};
+    return kNames[static_cast<int>(op)];
+}
+//按文件名判断类型：*.ldb和*.sst为sstable，*.log为WAL，MANIFEST*为MANIFEST
+inline IOFileType IOFileTypeFromName(const std::string& filename) {
+    const size_t slash = filename.rfind('/');
+    const std::string base = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+    auto ends_with = [&](const char* suffix) {
+        const size_t n = std::char_traits<char>::length(suffix);
+        return base.size() >= n && base.compare(base.size() - n, n, suffix) == 0;
+    };
+    if (base.compare(0, 8, "MANIFEST") == 0) {
+        return IOFileType::MANIFEST;
+    }
+    if (ends_with(".ldb") || ends_with(".sst")) {
+        return IOFileType::TABLE;
+    }
+    if (ends_with(".log")) {
+        return IOFileType::WAL;
+    }
+    return IOFileType::OTHER;
+}
+
+//延迟直方图（纳秒），记录无锁。每个2的幂区间再均分为4个桶，相对误差不超过25%，
+//百分位在桶内线性插值
+class LatencyHistogram {
+public:
+    LatencyHistogram() { Clear(); }
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Add(uint64_t nanos) {
+        buckets_[BucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(nanos, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (nanos > max && !max_.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+        }
+    }
+    void Clear() {
+        for (std::atomic<uint64_t>& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+    uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+    double Average() const {
+        const uint64_t count = Count();
+        return count == 0 ? 0 : static_cast<double>(sum_.load(std::memory_order_relaxed)) / count;
+    }
+    //p为[0, 100]，返回纳秒
+    double Percentile(double p) const {
+        uint64_t counts[kNumBuckets];
+        uint64_t total = 0;
+        for (int i = 0; i < kNumBuckets; i++) {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0) {
+            return 0;
+        }
+        const double threshold = total * (p / 100.0);
+        uint64_t cumulative = 0;
+        for (int i = 0; i < kNumBuckets; i++) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            if (cumulative + counts[i] >= threshold) {
+                const double lower = static_cast<double>(BucketLower(i));
+                const double upper = std::min(static_cast<double>(BucketLower(i + 1)), static_cast<double>(Max()) + 1);
+                const double fraction = (threshold - cumulative) / counts[i];
+                return lower + (std::max(upper, lower) - lower) * fraction;
+            }
+            cumulative += counts[i];
+        }
+        return static_cast<double>(Max());
+    }
+
+private:
+    //0-3各占一个桶，之后每个[2^b, 2^(b+1))分为4个桶
+    static const int kNumBuckets = 4 + 62 * 4;
+
+    static int BucketIndex(uint64_t v) {
+        if (v < 4) {
+            return static_cast<int>(v);
+        }
+        const int b = 63 - __builtin_clzll(v);
+        return (b - 1) * 4 + static_cast<int>((v >> (b - 2)) & 3);
+    }
+    static uint64_t BucketLower(int index) {
+        if (index < 4) {
+            return index;
+        }
+        if (index >= kNumBuckets) {
+            return UINT64_MAX;
+        }
+        const int b = index / 4 + 1;
+        return static_cast<uint64_t>(4 + index % 4) << (b - 2);
+    }
+
+    std::atomic<uint64_t> buckets_[kNumBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+//trace文件的格式：
+//    magic(fixed64) 之后是一串记录，每条记录以1字节的类型开头
+//    OPEN:  file_id(fixed32) | mode(1) | name长度(fixed32) | name
+//    OP:    file_id(fixed32) | op(1) | ok(1) | 开始时间(fixed64, 相对trace开始的纳秒) | 耗时(fixed64, 纳秒)
+//           | offset(fixed64) | length(fixed64)
+//读操作的length为请求的字节数，APPEND为写入的字节数，其它操作为0
+enum class IOTraceOpenMode { SEQUENTIAL = 0, RANDOM_ACCESS = 1, WRITABLE = 2, APPENDABLE = 3 };
+
+struct IOTraceRecord {
+    enum Type { OPEN = 0, OP = 1 };
+    Type type;
+    uint32_t file_id;
+    //OPEN
+    IOTraceOpenMode mode;
+    std::string filename;
+    //OP
+    IOOp op;
+    bool ok;
+    uint64_t start_nanos;
+    uint64_t latency_nanos;
+    uint64_t offset;
+    uint64_t length;
+};
+
+static const uint64_t kIOTraceMagic = 0x3145434152544f49ull;  // "IOTRACE1"
+static const size_t kIOTraceOpRecordSize = 1 + 4 + 1 + 1 + 8 * 4;
+
+//顺序读取trace文件
+class IOTraceReader {
+public:
+    //file由reader持有
+    explicit IOTraceReader(SequentialFile* file)
+        : file_(file), buffer_(new char[kBufferSize]), checked_magic_(false) {}
+
+    //返回OK并填写*record；trace结束返回NotFound；格式错误返回Corruption
+    Status Next(IOTraceRecord* record) {
+        if (!checked_magic_) {
+            char buf[8];
+            Status s = ReadExactly(8, buf);
+            if (s == OK && coding::DecodeFixed64(buf) != kIOTraceMagic) {
+                s = Corruption;
+            }
+            if (s != OK) {
+                return s == NotFound ? Corruption : s;
+            }
+            checked_magic_ = true;
+        }
+        char type;
+        Status s = ReadExactly(1, &type);
+        if (s != OK) {
+            return s;
+        }
+        char buf[kIOTraceOpRecordSize];
+        if (type == IOTraceRecord::OPEN) {
+            s = ReadExactly(9, buf);
+            if (s != OK) {
+                return s == NotFound ? Corruption : s;
+            }
+            record->type = IOTraceRecord::OPEN;
+            record->file_id = coding::DecodeFixed32(buf);
+            record->mode = static_cast<IOTraceOpenMode>(buf[4]);
+            const uint32_t name_size = coding::DecodeFixed32(buf + 5);
+            record->filename.resize(name_size);
+            s = ReadExactly(name_size, &record->filename[0]);
+            return s == NotFound ? Corruption : s;
+        }
+        if (type != IOTraceRecord::OP) {
+            return Corruption;
+        }
+        s = ReadExactly(kIOTraceOpRecordSize - 1, buf);
+        if (s != OK) {
+            return s == NotFound ? Corruption : s;
+        }
+        record->type = IOTraceRecord::OP;
+        record->file_id = coding::DecodeFixed32(buf);
+        record->op = static_cast<IOOp>(buf[4]);
+        record->ok = buf[5] != 0;
+        record->start_nanos = coding::DecodeFixed64(buf + 6);
+        record->latency_nanos = coding::DecodeFixed64(buf + 14);
+        record->offset = coding::DecodeFixed64(buf + 22);
+        record->length = coding::DecodeFixed64(buf + 30);
+        if (static_cast<int>(record->op) >= kNumIOOps) {
+            return Corruption;
+        }
+        return OK;
+    }
+
+private:
+    //读满n字节，文件在开头就结束时返回NotFound
+    Status ReadExactly(size_t n, char* dst) {
+        size_t read = 0;
+        while (read < n) {
+            if (available_.size() == 0) {
+                Status s = file_->Read(kBufferSize, &available_, buffer_.get());
+                if (s != OK) {
+                    return s;
+                }
+                if (available_.size() == 0) {
+                    return read == 0 ? NotFound : Corruption;
+                }
+            }
+            const size_t bytes = std::min(n - read, static_cast<size_t>(available_.size()));
+            std::memcpy(dst + read, available_.data(), bytes);
+            available_ = slice(available_.data() + bytes, available_.size() - bytes);
+            read += bytes;
+        }
+        return OK;
+    }
+
+    static const size_t kBufferSize = 64 * 1024;
+
+    std::unique_ptr<SequentialFile> file_;
+    std::unique_ptr<char[]> buffer_;
+    slice available_;  //buffer_中尚未解析的部分
+    bool checked_magic_;
+};
+
+//包装另一个env，统计通过它打开的文件上的每次I/O，并可选地写入trace。
+//统计按文件名判断文件类型。后台线程池和限速器使用本env自己的，base只提供文件系统
+class IOTracingEnv : public env {
+public:
+    //base由调用者持有，必须比本env存活更久
+    explicit IOTracingEnv(env* base) : env(0), base_(base), next_file_id_(0), trace_file_(nullptr) {}
+    ~IOTracingEnv() override {
+        JoinAllThreads();
+        EndTrace();
+    }
+
+    const LatencyHistogram& GetHistogram(IOFileType type, IOOp op) const {
+        return stats_[static_cast<int>(type)][static_cast<int>(op)].latency;
+    }
+    uint64_t GetBytes(IOFileType type, IOOp op) const {
+        return stats_[static_cast<int>(type)][static_cast<int>(op)].bytes.load(std::memory_order_relaxed);
+    }
+    uint64_t GetErrors(IOFileType type, IOOp op) const {
+        return stats_[static_cast<int>(type)][static_cast<int>(op)].errors.load(std::memory_order_relaxed);
+    }
+    void ResetStats() {
+        for (auto& ops : stats_) {
+            for (OpStats& stats : ops) {
+                stats.latency.Clear();
+                stats.bytes.store(0, std::memory_order_relaxed);
+                stats.errors.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+    //每个有记录的(文件类型, 操作)一行，延迟单位为微秒
+    std::string Report() const {
+        std::string result;
+        char buf[256];
+        for (int t = 0; t < kNumIOFileTypes; t++) {
+            for (int o = 0; o < kNumIOOps; o++) {
+                const OpStats& stats = stats_[t][o];
+                const LatencyHistogram& h = stats.latency;
+                if (h.Count() == 0) {
+                    continue;
+                }
+                std::snprintf(buf, sizeof(buf),
+                              "%-8s %-9s count=%llu bytes=%llu errors=%llu avg=%.1f p50=%.1f p99=%.1f "
+                              "p99.9=%.1f max=%.1f\n",
+                              IOFileTypeName(static_cast<IOFileType>(t)), IOOpName(static_cast<IOOp>(o)),
+                              static_cast<unsigned long long>(h.Count()),
+                              static_cast<unsigned long long>(stats.bytes.load(std::memory_order_relaxed)),
+                              static_cast<unsigned long long>(stats.errors.load(std::memory_order_relaxed)),
+                              h.Average() / 1000, h.Percentile(50) / 1000, h.Percentile(99) / 1000,
+                              h.Percentile(99.9) / 1000, h.Max() / 1000.0);
+                result += buf;
+            }
+        }
+        return result;
+    }
+
+    //开始把之后的每次I/O写入trace_path（通过base创建）。已在trace时先结束之前的trace。
+    //只记录之后打开的文件，已打开的文件的操作不写入trace
+    Status StartTrace(const std::string& trace_path) {
+        EndTrace();
+        WritableFile* file;
+        Status s = base_->NewWritableFile(trace_path, &file);
+        if (s != OK) {
+            return s;
+        }
+        std::lock_guard<std::mutex> l(trace_mutex_);
+        trace_file_ = file;
+        trace_start_ = std::chrono::steady_clock::now();
+        trace_buffer_.clear();
+        coding::PutFixed64(&trace_buffer_, kIOTraceMagic);
+        trace_generation_++;
+        return OK;
+    }
+    //写出剩余的记录并关闭trace文件
+    Status EndTrace() {
+        std::lock_guard<std::mutex> l(trace_mutex_);
+        if (trace_file_ == nullptr) {
+            return OK;
+        }
+        Status s = FlushTraceLocked();
+        if (s == OK) {
+            s = trace_file_->Close();
+        }
+        delete trace_file_;
+        trace_file_ = nullptr;
+        return s;
+    }
+
+    Status NewSequentialFile(const std::string& filename, SequentialFile** result) override {
+        SequentialFile* file;
+        Status s = base_->NewSequentialFile(filename, &file);
+        *result = (s == OK) ? new TracedSequentialFile(this, NewFileInfo(filename, IOTraceOpenMode::SEQUENTIAL), file)
+                            : nullptr;
+        return s;
+    }
+    Status NewRandomAccessFile(const std::string& filename, RandomAccessFile** result,
+                               bool use_direct_io = false) override {
+        RandomAccessFile* file;
+        Status s = base_->NewRandomAccessFile(filename, &file, use_direct_io);
+        *result = (s == OK)
+                      ? new TracedRandomAccessFile(this, NewFileInfo(filename, IOTraceOpenMode::RANDOM_ACCESS), file)
+                      : nullptr;
+        return s;
+    }
+    Status NewWritableFile(const std::string& filename, WritableFile** result, bool use_direct_io = false,
+                           const WritableFileOptions& options = WritableFileOptions()) override {
+        WritableFile* file;
+        Status s = base_->NewWritableFile(filename, &file, use_direct_io, options);
+        *result = (s == OK) ? WrapWritableFile(NewFileInfo(filename, IOTraceOpenMode::WRITABLE), file, 0) : nullptr;
+        return s;
+    }
+    Status NewAppendableFile(const std::string& filename, WritableFile** result,
+                             const WritableFileOptions& options = WritableFileOptions::ForLogFile()) override {
+        uint64_t size = 0;
+        if (base_->FileExists(filename)) {
+            base_->GetFileSize(filename, &size);
+        }
+        WritableFile* file;
+        Status s = base_->NewAppendableFile(filename, &file, options);
+        *result = (s == OK) ? WrapWritableFile(NewFileInfo(filename, IOTraceOpenMode::APPENDABLE), file, size)
+                            : nullptr;
+        return s;
+    }
+    bool FileExists(const std::string& filename) override { return base_->FileExists(filename); }
+    Status GetChildren(const std::string& directory_path, std::vector<std::string>* result) override {
+        return base_->GetChildren(directory_path, result);
+    }
+    Status RemoveFile(const std::string& filename) override { return base_->RemoveFile(filename); }
+    Status CreateDir(const std::string& dirname) override { return base_->CreateDir(dirname); }
+    Status RemoveDir(const std::string& dirname) override { return base_->RemoveDir(dirname); }
+    Status GetFileSize(const std::string& filename, uint64_t* size) override {
+        return base_->GetFileSize(filename, size);
+    }
+    Status RenameFile(const std::string& from, const std::string& to) override {
+        return base_->RenameFile(from, to);
+    }
+    Status LinkFile(const std::string& from, const std::string& to) override {
+        return base_->LinkFile(from, to);
+    }
+
+private:
+    struct OpStats {
+        LatencyHistogram latency;
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> errors{0};
+    };
+    //打开的文件在trace中的编号；generation与当前trace不同时（打开时没有trace）不写入trace
+    struct FileInfo {
+        IOFileType type;
+        uint32_t id;
+        uint64_t generation;
+    };
+    using Clock = std::chrono::steady_clock;
+
+    //计时一次操作，析构时记录
+    class OpTimer {
+    public:
+        OpTimer(IOTracingEnv* env, const FileInfo& file, IOOp op, uint64_t offset)
+            : env_(env), file_(file), op_(op), offset_(offset), start_(Clock::now()) {}
+        //length写入trace，bytes计入统计（读到的或写入的字节数）
+        void Done(Status s, uint64_t length, uint64_t bytes) {
+            env_->Record(file_, op_, s, start_, Clock::now(), offset_, length, bytes);
+        }
+
+    private:
+        IOTracingEnv* const env_;
+        const FileInfo& file_;
+        const IOOp op_;
+        const uint64_t offset_;
+        const Clock::time_point start_;
+    };
+
+    class TracedSequentialFile : public SequentialFile {
+    public:
+        TracedSequentialFile(IOTracingEnv* env, FileInfo info, SequentialFile* base)
+            : env_(env), info_(info), base_(base), pos_(0) {}
+        Status Read(size_t n, slice* result, char* scratch) override {
+            OpTimer timer(env_, info_, IOOp::READ, pos_);
+            Status s = base_->Read(n, result, scratch);
+            timer.Done(s, n, result->size());
+            if (s == OK) {
+                pos_ += result->size();
+            }
+            return s;
+        }
+        Status Skip(uint64_t n) override {
+            Status s = base_->Skip(n);
+            if (s == OK) {
+                pos_ += n;
+            }
+            return s;
+        }
+
+    private:
+        IOTracingEnv* const env_;
+        const FileInfo info_;
+        std::unique_ptr<SequentialFile> base_;
+        uint64_t pos_;
+    };
+
+    class TracedRandomAccessFile : public RandomAccessFile {
+    public:
+        TracedRandomAccessFile(IOTracingEnv* env, FileInfo info, RandomAccessFile* base)
+            : env_(env), info_(info), base_(base) {}
+        Status Read(uint64_t offset, slice* result, char* scratch, size_t n) const override {
+            OpTimer timer(env_, info_, IOOp::RANDOM_READ, offset);
+            Status s = base_->Read(offset, result, scratch, n);
+            timer.Done(s, n, result->size());
+            return s;
+        }
+        //转发给base，保留批量读取的并发；直方图按批记录，trace中每个请求一条记录
+        Status MultiRead(ReadRequest* reqs, size_t n) const override {
+            const Clock::time_point start = Clock::now();
+            Status s = base_->MultiRead(reqs, n);
+            const Clock::time_point end = Clock::now();
+            uint64_t bytes = 0;
+            for (size_t i = 0; i < n; i++) {
+                bytes += reqs[i].status == OK ? reqs[i].result.size() : 0;
+                env_->AppendTraceRecord(info_, IOOp::MULTI_READ, s == OK && reqs[i].status == OK, start, end,
+                                        reqs[i].offset, reqs[i].len);
+            }
+            env_->RecordStats(info_, IOOp::MULTI_READ, s, end - start, bytes);
+            return s;
+        }
+        void Hint(AccessPattern pattern, uint64_t offset = 0, uint64_t length = 0) const override {
+            base_->Hint(pattern, offset, length);
+        }
+        bool NeedsScratch() const override { return base_->NeedsScratch(); }
+
+    private:
+        IOTracingEnv* const env_;
+        const FileInfo info_;
+        std::unique_ptr<RandomAccessFile> base_;
+    };
+
+    //限速在包装层进行，SetIOPriority作用于包装后的文件
+    class TracedWritableFile : public WritableFile {
+    public:
+        TracedWritableFile(IOTracingEnv* env, FileInfo info, WritableFile* base, uint64_t pos)
+            : env_(env), info_(info), base_(base), pos_(pos) {}
+        ~TracedWritableFile() override { Close(); }
+        Status Append(const slice& data) override {
+            RateLimit(data.size());
+            OpTimer timer(env_, info_, IOOp::APPEND, pos_);
+            Status s = base_->Append(data);
+            timer.Done(s, data.size(), data.size());
+            if (s == OK) {
+                pos_ += data.size();
+            }
+            return s;
+        }
+        Status FlushBUffer() override { return Timed(IOOp::FLUSH, [this] { return base_->FlushBUffer(); }); }
+        Status Fsync() override { return Timed(IOOp::SYNC, [this] { return base_->Fsync(); }); }
+        Status Close() override {
+            if (base_ == nullptr) {
+                return OK;
+            }
+            Status s = Timed(IOOp::CLOSE, [this] { return base_->Close(); });
+            base_.reset();
+            return s;
+        }
+
+    private:
+        template <typename F>
+        Status Timed(IOOp op, F f) {
+            OpTimer timer(env_, info_, op, pos_);
+            Status s = f();
+            timer.Done(s, 0, 0);
+            return s;
+        }
+
+        IOTracingEnv* const env_;
+        const FileInfo info_;
+        std::unique_ptr<WritableFile> base_;
+        uint64_t pos_;
+    };
+
+    WritableFile* WrapWritableFile(const FileInfo& info, WritableFile* file, uint64_t pos) {
+        file->SetRateLimiter(nullptr);
+        WritableFile* wrapped = new TracedWritableFile(this, info, file, pos);
+        wrapped->SetRateLimiter(rate_limiter_);
+        return wrapped;
+    }
+
+    FileInfo NewFileInfo(const std::string& filename, IOTraceOpenMode mode) {
+        FileInfo info;
+        info.type = IOFileTypeFromName(filename);
+        info.id = next_file_id_.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> l(trace_mutex_);
+        info.generation = trace_file_ != nullptr ? trace_generation_ : 0;
+        if (trace_file_ != nullptr) {
+            trace_buffer_.push_back(static_cast<char>(IOTraceRecord::OPEN));
+            coding::PutFixed32(&trace_buffer_, info.id);
+            trace_buffer_.push_back(static_cast<char>(mode));
+            coding::PutFixed32(&trace_buffer_, static_cast<uint32_t>(filename.size()));
+            trace_buffer_.append(filename);
+            MaybeFlushTraceLocked();
+        }
+        return info;
+    }
+
+    void Record(const FileInfo& file, IOOp op, Status s, Clock::time_point start, Clock::time_point end,
+                uint64_t offset, uint64_t length, uint64_t bytes) {
+        RecordStats(file, op, s, end - start, bytes);
+        AppendTraceRecord(file, op, s == OK, start, end, offset, length);
+    }
+    void RecordStats(const FileInfo& file, IOOp op, Status s, Clock::duration latency, uint64_t bytes) {
+        OpStats& stats = stats_[static_cast<int>(file.type)][static_cast<int>(op)];
+        stats.latency.Add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+        if (s == OK) {
+            stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        } else {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void AppendTraceRecord(const FileInfo& file, IOOp op, bool ok, Clock::time_point start, Clock::time_point end,
+                           uint64_t offset, uint64_t length) {
+        if (file.generation == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> l(trace_mutex_);
+        if (trace_file_ == nullptr || file.generation != trace_generation_) {
+            return;
+        }
+        auto nanos = [](Clock::duration d) {
+            return static_cast<uint64_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), 0));
+        };
+        trace_buffer_.push_back(static_cast<char>(IOTraceRecord::OP));
+        coding::PutFixed32(&trace_buffer_, file.id);
+        trace_buffer_.push_back(static_cast<char>(op));
+        trace_buffer_.push_back(ok ? 1 : 0);
+        coding::PutFixed64(&trace_buffer_, nanos(start - trace_start_));
+        coding::PutFixed64(&trace_buffer_, nanos(end - start));
+        coding::PutFixed64(&trace_buffer_, offset);
+        coding::PutFixed64(&trace_buffer_, length);
+        MaybeFlushTraceLocked();
+    }
+    //REQUIRES: 持有trace_mutex_
+    void MaybeFlushTraceLocked() {
+        if (trace_buffer_.size() >= kTraceBufferSize) {
+            FlushTraceLocked();
+        }
+    }
+    //trace写入失败时丢弃记录，不影响被观测的I/O。REQUIRES: 持有trace_mutex_
+    Status FlushTraceLocked() {
+        Status s = trace_file_->Append(slice(trace_buffer_.data(), trace_buffer_.size()));
+        if (s == OK) {
+            s = trace_file_->FlushBUffer();
+        }
+        trace_buffer_.clear();
+        return s;
+    }
+
+    static const size_t kTraceBufferSize = 64 * 1024;
+
+    env* const base_;
+    OpStats stats_[kNumIOFileTypes][kNumIOOps];
+    std::atomic<uint32_t> next_file_id_;
+    std::mutex trace_mutex_;
+    WritableFile* trace_file_;
+    Clock::time_point trace_start_;
+    uint64_t trace_generation_ = 0;  // 每次StartTrace加1，0表示从未开始trace
+    std::string trace_buffer_;
+};
+
+//在e上重放trace：按记录打开文件，重新执行读（按原来的offset和长度）、写（写入同样长度的0）、flush、sync和close。
+//写入会覆盖e中的同名文件，应在数据库的副本或MemEnv上重放。
+//preserve_timing为true时按原来的开始时间间隔发起操作，否则连续执行。
+//trace中打开失败的文件上的操作被跳过。某个操作失败时继续重放其余的记录，
+//最后返回第一个失败的操作的状态；trace文件本身读取出错时返回该错误，全部成功返回OK
+inline Status ReplayIOTrace(env* e, const std::string& trace_path, bool preserve_timing = false) {
+    SequentialFile* trace_file;
+    Status s = e->NewSequentialFile(trace_path, &trace_file);
+    if (s != OK) {
+        return s;
+    }
+    IOTraceReader reader(trace_file);
+    struct ReplayFile {
+        std::unique_ptr<SequentialFile> sequential;
+        std::unique_ptr<RandomAccessFile> random;
+        std::unique_ptr<WritableFile> writable;
+    };
+    std::map<uint32_t, ReplayFile> files;
+    std::vector<char> scratch;
+    std::vector<char> zeros;
+    Status first_error = OK;
+    const auto replay_start = std::chrono::steady_clock::now();
+    IOTraceRecord record;
+    while ((s = reader.Next(&record)) == OK) {
+        if (record.type == IOTraceRecord::OPEN) {
+            ReplayFile& file = files[record.file_id];
+            switch (record.mode) {
+                case IOTraceOpenMode::SEQUENTIAL: {
+                    SequentialFile* f;
+                    if (e->NewSequentialFile(record.filename, &f) == OK) file.sequential.reset(f);
+                    break;
+                }
+                case IOTraceOpenMode::RANDOM_ACCESS: {
+                    RandomAccessFile* f;
+                    if (e->NewRandomAccessFile(record.filename, &f) == OK) file.random.reset(f);
+                    break;
+                }
+                case IOTraceOpenMode::WRITABLE:
+                case IOTraceOpenMode::APPENDABLE: {
+                    WritableFile* f;
+                    Status open = record.mode == IOTraceOpenMode::WRITABLE ? e->NewWritableFile(record.filename, &f)
+                                                                           : e->NewAppendableFile(record.filename, &f);
+                    if (open == OK) file.writable.reset(f);
+                    break;
+                }
+            }
+            continue;
+        }
+        auto it = files.find(record.file_id);
+        if (it == files.end()) {
+            continue;
+        }
+        ReplayFile& file = it->second;
+        if (preserve_timing) {
+            std::this_thread::sleep_until(replay_start + std::chrono::nanoseconds(record.start_nanos));
+        }
+        if (scratch.size() < record.length &&
+            (record.op == IOOp::READ || record.op == IOOp::RANDOM_READ || record.op == IOOp::MULTI_READ)) {
+            scratch.resize(record.length);
+        }
+        slice result;
+        Status op = OK;
+        switch (record.op) {
+            case IOOp::READ:
+                if (file.sequential != nullptr) op = file.sequential->Read(record.length, &result, scratch.data());
+                break;
+            case IOOp::RANDOM_READ:
+            case IOOp::MULTI_READ:
+                if (file.random != nullptr) op = file.random->Read(record.offset, &result, scratch.data(), record.length);
+                break;
+            case IOOp::APPEND:
+                if (file.writable != nullptr) {
+                    if (zeros.size() < record.length) {
+                        zeros.resize(record.length, 0);
+                    }
+                    op = file.writable->Append(slice(zeros.data(), record.length));
+                }
+                break;
+            case IOOp::FLUSH:
+                if (file.writable != nullptr) op = file.writable->FlushBUffer();
+                break;
+            case IOOp::SYNC:
+                if (file.writable != nullptr) op = file.writable->Fsync();
+                break;
+            case IOOp::CLOSE:
+                if (file.writable != nullptr) op = file.writable->Close();
+                files.erase(it);
+                break;
+        }
+        if (op != OK && first_error == OK) {
+            first_error = op;
+        }
+    }
+    for (auto& entry : files) {
+        if (entry.second.writable != nullptr) {
+            Status close = entry.second.writable->Close();
+            if (close != OK && first_error == OK) {
+                first_error = close;
+            }
+        }
+    }
+    return s == NotFound ? first_error : s;
+}
@@ -0,0 +1,216 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <unistd.h>
+//基于io_uring的批量读取。一次提交多个(offset, length)请求，由内核并发执行后统一收割，
+//NVMe上队列深度为1时大部分IOPS用不上，批量提交可以让多个读取重叠。
+//不依赖liburing，直接使用io_uring_setup/io_uring_enter系统调用。
+//内核不支持或被seccomp禁止时（例如部分容器）ThreadLocal()返回nullptr，调用者应退回到pread。
+//IORING_OP_READ需要5.6以上的内核，构造时通过IORING_REGISTER_PROBE确认内核支持该操作
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define TINYLEVELDB_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef TINYLEVELDB_IO_URING
+class IoUring {
+public:
+    //当前线程的io_uring实例，不可用时返回nullptr。每个线程一个实例，提交和收割都不需要加锁
+    static IoUring* ThreadLocal() {
+        static thread_local IoUring ring;
+        return ring.ok_ ? &ring : nullptr;
+    }
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    //从fd读取n个请求：第i个请求把offsets[i]处的lens[i]字节读入bufs[i]，
+    //results[i]为读到的字节数（到达文件末尾时可能小于lens[i]），出错时为-errno。
+    //ring出错时返回false，此时部分请求可能没有执行，调用者应全部改用pread
+    bool Read(int fd, const uint64_t* offsets, const size_t* lens, char* const* bufs,
+              ssize_t* results, size_t n) {
+        size_t submitted = 0;
+        size_t completed = 0;
+        unsigned to_submit = 0;  //已放入提交队列但内核尚未接收的请求数
+        while (completed < n) {
+            //队列有空位时尽量多提交
+            while (submitted < n && submitted - completed < sq_entries_) {
+                const unsigned tail = *sq_tail_;
+                const unsigned index = tail & *sq_mask_;
+                io_uring_sqe* sqe = &sqes_[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(bufs[submitted]);
+                sqe->len = static_cast<uint32_t>(lens[submitted]);
+                sqe->off = offsets[submitted];
+                sqe->user_data = submitted;
+                sq_array_[index] = index;
+                __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+                submitted++;
+                to_submit++;
+            }
+            int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1,
+                                               IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (ret < 0 && errno != EINTR) {
+                ok_ = false;  //ring已不可用，之后的读取都走pread
+                Drain(submitted - completed - to_submit);
+                return false;
+            }
+            if (ret > 0) {
+                to_submit -= static_cast<unsigned>(ret);
+            }
+            completed += Reap(results);
+        }
+        return true;
+    }
+
+private:
+    IoUring() : ok_(false), ring_fd_(-1), sq_ptr_(nullptr), cq_ptr_(nullptr), sqes_(nullptr) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, kQueueDepth, &p));
+        if (ring_fd_ < 0) {
+            return;
+        }
+        sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ptr_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            sq_ptr_ = nullptr;
+            return;
+        }
+        if (single_mmap) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            cq_ptr_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) {
+                cq_ptr_ = nullptr;
+                return;
+            }
+        }
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+        char* sq = static_cast<char*>(sq_ptr_);
+        char* cq = static_cast<char*>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        sq_entries_ = p.sq_entries;
+        ok_ = SupportsRead();
+    }
+    ~IoUring() {
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_ring_size_);
+        }
+        if (sq_ptr_ != nullptr) {
+            munmap(sq_ptr_, sq_ring_size_);
+        }
+        if (ring_fd_ >= 0) {
+            close(ring_fd_);
+        }
+    }
+
+    //内核是否支持IORING_OP_READ。不支持IORING_REGISTER_PROBE的内核（5.6以前）也不支持IORING_OP_READ
+    bool SupportsRead() const {
+        const size_t size = sizeof(io_uring_probe) + kMaxProbeOps * sizeof(io_uring_probe_op);
+        io_uring_probe* probe = static_cast<io_uring_probe*>(calloc(1, size));
+        if (probe == nullptr) {
+            return false;
+        }
+        const bool supported =
+            syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, kMaxProbeOps) >= 0 &&
+            probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+        free(probe);
+        return supported;
+    }
+
+    //收割所有已完成的请求，返回收割的数量
+    size_t Reap(ssize_t* results) {
+        size_t reaped = 0;
+        unsigned head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+            results[cqe->user_data] = cqe->res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return reaped;
+    }
+
+    //ring出错时等待已提交的请求结束，避免内核在调用者退回pread后仍写入缓冲区
+    void Drain(size_t inflight) {
+        while (inflight > 0) {
+            unsigned head = *cq_head_;
+            while (inflight > 0 && head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                head++;
+                inflight--;
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            if (inflight > 0 &&
+                syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+    static const unsigned kQueueDepth = 64;
+    static const unsigned kMaxProbeOps = 256;  //probe的ops数组长度，opcode是8位的
+
+    bool ok_;
+    int ring_fd_;
+    void* sq_ptr_;
+    void* cq_ptr_;
+    size_t sq_ring_size_;
+    size_t cq_ring_size_;
+    size_t sqes_size_;
+    unsigned sq_entries_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    io_uring_sqe* sqes_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+};
+#else
+//不支持io_uring的平台
+class IoUring {
+public:
+    static IoUring* ThreadLocal() { return nullptr; }
+    bool Read(int, const uint64_t*, const size_t*, char* const*, ssize_t*, size_t) {
+        return false;
+    }
+};
+#endif
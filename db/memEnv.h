@@ -0,0 +1,276 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "env.h"
+//完全在内存中的env，文件内容保存在进程内，不经过内核和磁盘。
+//用于benchmark时只测量引擎本身的CPU开销，以及需要确定性文件系统的恢复测试。
+//
+//文件按kBlockSize分块保存，追加时不需要搬移已有的数据。已打开的文件持有文件内容的引用，
+//RemoveFile和RenameFile之后仍然可以读写，与POSIX的unlink语义相同；LinkFile使两个文件名共享同一份内容。
+//目录只记录名字：创建文件时不检查父目录是否存在，GetChildren列出以"dir/"为前缀的直接子项。
+//Fsync等同于无操作，数据写入即"持久化"，需要模拟掉电时使用FaultInjectionEnv包装。
+//后台线程池和限速器沿用env的实现
+class MemEnv : public env {
+public:
+    //内存中没有mmap，mmap预算传0
+    MemEnv() : env(0) {}
+    ~MemEnv() override {
+        //后台任务可能还在访问文件，先于成员析构等待它们结束
+        JoinAllThreads();
+    }
+
+    Status NewSequentialFile(const std::string& filename, SequentialFile** result) override {
+        std::shared_ptr<FileState> file = FindFile(filename);
+        if (file == nullptr) {
+            *result = nullptr;
+            return IOError;
+        }
+        *result = new MemSequentialFile(std::move(file));
+        return OK;
+    }
+    Status NewRandomAccessFile(const std::string& filename, RandomAccessFile** result,
+                               bool = false) override {
+        std::shared_ptr<FileState> file = FindFile(filename);
+        if (file == nullptr) {
+            *result = nullptr;
+            return IOError;
+        }
+        *result = new MemRandomAccessFile(std::move(file));
+        return OK;
+    }
+    //use_direct_io和WritableFileOptions不生效，Append直接写入文件内容
+    Status NewWritableFile(const std::string& filename, WritableFile** result, bool = false,
+                           const WritableFileOptions& = WritableFileOptions()) override {
+        std::shared_ptr<FileState> file = std::make_shared<FileState>();
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            files_[filename] = file;
+        }
+        *result = new MemWritableFile(std::move(file));
+        (*result)->SetRateLimiter(rate_limiter_);
+        return OK;
+    }
+    Status NewAppendableFile(const std::string& filename, WritableFile** result,
+                             const WritableFileOptions& = WritableFileOptions::ForLogFile()) override {
+        std::shared_ptr<FileState> file;
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            std::shared_ptr<FileState>& slot = files_[filename];
+            if (slot == nullptr) {
+                slot = std::make_shared<FileState>();
+            }
+            file = slot;
+        }
+        *result = new MemWritableFile(std::move(file));
+        (*result)->SetRateLimiter(rate_limiter_);
+        return OK;
+    }
+
+    bool FileExists(const std::string& filename) override {
+        std::lock_guard<std::mutex> l(mutex_);
+        return files_.count(filename) != 0 || dirs_.count(filename) != 0;
+    }
+    Status GetChildren(const std::string& directory_path, std::vector<std::string>* result) override {
+        result->clear();
+        std::lock_guard<std::mutex> l(mutex_);
+        if (dirs_.count(directory_path) == 0 && !HasChildrenLocked(directory_path)) {
+            return IOError;
+        }
+        const std::string prefix = directory_path + "/";
+        std::set<std::string> children;  //子目录和其中的文件都会出现，去重
+        auto collect = [&](const std::string& name) {
+            if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0) {
+                const std::string rest = name.substr(prefix.size());
+                children.insert(rest.substr(0, rest.find('/')));
+            }
+        };
+        for (const auto& entry : files_) {
+            collect(entry.first);
+        }
+        for (const std::string& dir : dirs_) {
+            collect(dir);
+        }
+        result->assign(children.begin(), children.end());
+        return OK;
+    }
+    Status RemoveFile(const std::string& filename) override {
+        std::lock_guard<std::mutex> l(mutex_);
+        return files_.erase(filename) != 0 ? OK : IOError;
+    }
+    Status CreateDir(const std::string& dirname) override {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (files_.count(dirname) != 0 || !dirs_.insert(dirname).second) {
+            return IOError;
+        }
+        return OK;
+    }
+    //与rmdir相同，目录不为空时失败
+    Status RemoveDir(const std::string& dirname) override {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (dirs_.count(dirname) == 0 || HasChildrenLocked(dirname)) {
+            return IOError;
+        }
+        dirs_.erase(dirname);
+        return OK;
+    }
+    Status GetFileSize(const std::string& filename, uint64_t* size) override {
+        std::shared_ptr<FileState> file = FindFile(filename);
+        if (file == nullptr) {
+            *size = 0;
+            return IOError;
+        }
+        *size = file->Size();
+        return OK;
+    }
+    //to已存在时被覆盖
+    Status RenameFile(const std::string& from, const std::string& to) override {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto it = files_.find(from);
+        if (it == files_.end()) {
+            return IOError;
+        }
+        std::shared_ptr<FileState> file = std::move(it->second);
+        files_.erase(it);
+        files_[to] = std::move(file);
+        return OK;
+    }
+    Status LinkFile(const std::string& from, const std::string& to) override {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto it = files_.find(from);
+        if (it == files_.end() || files_.count(to) != 0) {
+            return IOError;
+        }
+        files_[to] = it->second;
+        return OK;
+    }
+
+private:
+    //一个文件的内容，由所有打开它的文件对象和files_中的文件名共享
+    class FileState {
+    public:
+        uint64_t Size() const {
+            std::lock_guard<std::mutex> l(mutex_);
+            return size_;
+        }
+        //从offset处最多读取n字节到scratch，返回读到的字节数
+        size_t Read(uint64_t offset, size_t n, char* scratch) const {
+            std::lock_guard<std::mutex> l(mutex_);
+            if (offset >= size_) {
+                return 0;
+            }
+            n = static_cast<size_t>(std::min<uint64_t>(n, size_ - offset));
+            size_t copied = 0;
+            while (copied < n) {
+                const uint64_t pos = offset + copied;
+                const size_t block_offset = static_cast<size_t>(pos % kBlockSize);
+                const size_t bytes = std::min(n - copied, kBlockSize - block_offset);
+                std::memcpy(scratch + copied, blocks_[pos / kBlockSize].get() + block_offset, bytes);
+                copied += bytes;
+            }
+            return n;
+        }
+        void Append(const slice& data) {
+            std::lock_guard<std::mutex> l(mutex_);
+            const char* src = data.data();
+            size_t left = data.size();
+            while (left > 0) {
+                const size_t block_offset = static_cast<size_t>(size_ % kBlockSize);
+                if (block_offset == 0) {
+                    blocks_.emplace_back(new char[kBlockSize]);
+                }
+                const size_t bytes = std::min(left, kBlockSize - block_offset);
+                std::memcpy(blocks_.back().get() + block_offset, src, bytes);
+                src += bytes;
+                left -= bytes;
+                size_ += bytes;
+            }
+        }
+
+    private:
+        static const size_t kBlockSize = 8 * 1024;
+        mutable std::mutex mutex_;
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        uint64_t size_ = 0;
+    };
+
+    class MemSequentialFile : public SequentialFile {
+    public:
+        explicit MemSequentialFile(std::shared_ptr<FileState> file) : file_(std::move(file)), pos_(0) {}
+        Status Read(size_t n, slice* result, char* scratch) override {
+            const size_t read = file_->Read(pos_, n, scratch);
+            pos_ += read;
+            *result = slice(scratch, read);
+            return OK;
+        }
+        Status Skip(uint64_t n) override {
+            pos_ = std::min(pos_ + n, file_->Size());
+            return OK;
+        }
+
+    private:
+        std::shared_ptr<FileState> file_;
+        uint64_t pos_;
+    };
+
+    class MemRandomAccessFile : public RandomAccessFile {
+    public:
+        explicit MemRandomAccessFile(std::shared_ptr<FileState> file) : file_(std::move(file)) {}
+        Status Read(uint64_t offset, slice* result, char* scratch, size_t n) const override {
+            *result = slice(scratch, file_->Read(offset, n, scratch));
+            return OK;
+        }
+
+    private:
+        std::shared_ptr<FileState> file_;
+    };
+
+    class MemWritableFile : public WritableFile {
+    public:
+        explicit MemWritableFile(std::shared_ptr<FileState> file) : file_(std::move(file)), closed_(false) {}
+        Status Append(const slice& data) override {
+            if (closed_) {
+                return IOError;
+            }
+            RateLimit(data.size());
+            file_->Append(data);
+            return OK;
+        }
+        Status FlushBUffer() override { return OK; }
+        Status Fsync() override { return OK; }
+        Status Close() override {
+            closed_ = true;
+            return OK;
+        }
+
+    private:
+        std::shared_ptr<FileState> file_;
+        bool closed_;
+    };
+
+    std::shared_ptr<FileState> FindFile(const std::string& filename) {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto it = files_.find(filename);
+        return it == files_.end() ? nullptr : it->second;
+    }
+    //REQUIRES: 持有mutex_
+    bool HasChildrenLocked(const std::string& dirname) const {
+        const std::string prefix = dirname + "/";
+        auto has_prefix = [&](const std::string& name) {
+            return name.compare(0, prefix.size(), prefix) == 0;
+        };
+        auto file = files_.lower_bound(prefix);
+        auto dir = dirs_.lower_bound(prefix);
+        return (file != files_.end() && has_prefix(file->first)) || (dir != dirs_.end() && has_prefix(*dir));
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<FileState>> files_;
+    std::set<std::string> dirs_;
+};
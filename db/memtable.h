@@ -5,7 +5,7 @@
 #include "arena.h"
 #include "skipList.h"
 #include "coding.h"
-enum ValueType { kTypeDeletion = 0x0, kTypeValue = 0x1 };
+#include "dbformat.h"
 class MemTable {
     public:
      // MemTables are reference counted.  The initial reference count
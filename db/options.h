@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+
+class Cache;
+class PersistentCache;
+class FilterPolicy;
+class PrefixExtractor;
+
+//filter block在sstable中的布局
+enum FilterLayout {
+    kOffsetFilter = 0,       //每2KB文件偏移生成一个filter（最初的格式）
+    kFullFilter = 1,         //整张表只生成一个filter
+    kPartitionedFilter = 2   //按data block边界切分成多个分区filter，外加一个分区索引；只有一个分区时退化为kFullFilter
+};
+
+//sstable读写相关的配置
+struct Options {
+    //为nullptr时不生成filter
+    const FilterPolicy* filter_policy = nullptr;
+
+    FilterLayout filter_layout = kOffsetFilter;
+
+    //kPartitionedFilter下每个分区至少包含的key数量，10 bits/key时约5KB一个分区
+    size_t filter_partition_keys = 4096;
+
+    //不为nullptr时，user key的前缀也会加入filter，用于前缀扫描时跳过sstable。
+    //只对kFullFilter和kPartitionedFilter布局生效
+    const PrefixExtractor* prefix_extractor = nullptr;
+
+    //为false时filter中只放前缀不放完整的key，filter更小但点查无法使用filter
+    bool whole_key_filtering = true;
+
+    //flush和compaction产生的sstable以及compaction读取的输入文件使用O_DIRECT，
+    //避免后台的大量读写污染前台读依赖的page cache
+    bool use_direct_io_for_flush_and_compaction = false;
+
+    //不为nullptr时，Table读出的data block和filter分区放入其中，多个Table可以共享一个block cache。
+    //缓存的key为(block_cache->NewId()分配给每个Table的id, block在文件中的偏移)
+    Cache* block_cache = nullptr;
+
+    //为true时index block和filter block也放入block_cache的高优先级池，占用计入缓存容量，
+    //被淘汰后按需重新读取；为false时它们在Table打开期间常驻内存
+    bool cache_index_and_filter_blocks = false;
+
+    //cache_index_and_filter_blocks为true时，L0文件的index和filter block在Table存活期间一直被引用，不会被淘汰。
+    //L0文件之间key范围重叠，每次点查都要访问所有L0文件的filter
+    bool pin_l0_filter_and_index_blocks_in_cache = false;
+
+    //不为nullptr时作为block_cache之下的第二层缓存：block cache未命中时先查persistent_cache，
+    //从sstable文件读出的data block和filter分区写入persistent_cache。适用于sstable在慢速磁盘、
+    //本地有快速SSD的部署
+    PersistentCache* persistent_cache = nullptr;
+
+    //TableCache最多同时打开的sstable数量，每个打开的sstable占用一个文件描述符（或一个mmap名额）
+    //以及常驻的index和filter。超出后按LRU关闭最久未使用的sstable
+    int max_open_files = 1000;
+
+    //打开sstable时提示内核按随机访问处理（关闭内核预读）。点查只读一个block，
+    //内核默认的预读是浪费；顺序扫描由迭代器自己按需预读，见ReadOptions::readahead_size
+    bool advise_random_on_open = true;
+};
+
+//单次读取的配置
+struct ReadOptions {
+    //为false时本次读取的block不放入block_cache和persistent_cache，已缓存的block仍然可以命中。
+    //全表扫描、导出等一次性的大范围读取应设为false，避免把热点数据挤出缓存
+    bool fill_cache = true;
+
+    //迭代器读取data block时的预读大小。为0时自动检测：连续读到相邻的block后开始预读，
+    //预读窗口从kInitialReadaheadSize起每次加倍，直到kMaxAutoReadaheadSize，访问不再连续时重新开始。
+    //不为0时从第一个block起就按这个固定大小预读，并提前提示内核读入下一个窗口
+    size_t readahead_size = 0;
+
+    static constexpr size_t kInitialReadaheadSize = 8 << 10;
+    static constexpr size_t kMaxAutoReadaheadSize = 256 << 10;
+    static constexpr size_t kCompactionReadaheadSize = 2 << 20;
+
+    //compaction读取输入文件：每个文件从头到尾读一遍，之后即被删除。
+    //使用大的固定预读，不填充缓存，读过的部分从page cache中丢弃
+    static ReadOptions ForCompaction(){
+        ReadOptions options;
+        options.fill_cache = false;
+        options.readahead_size = kCompactionReadaheadSize;
+        return options;
+    }
+};
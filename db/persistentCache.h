@@ -0,0 +1,267 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "env.h"
+#include "coding.h"
+#include "crc32c.h"
+//block cache之下的持久化缓存层，把block保存在本地的快速存储（NVMe SSD）上。
+//sstable放在较慢的大容量磁盘上时，block cache未命中的读取大多可以由这一层满足。
+//
+//缓存文件按段（segment）顺序追加写入，每条记录的格式为：
+//    crc32c(masked, 4字节) | key长度(fixed32) | data长度(fixed32) | key | data
+//crc覆盖key和data，读取时校验，不一致的记录当作未命中并从索引中移除。
+//索引（key -> 段、偏移、长度）只保存在内存中，打开时清空目录中旧的缓存文件。
+//总大小超过capacity时整段删除最早写入的段（FIFO），不做原地覆盖，避免SSD上的随机小写。
+//线程安全：索引和写入由mutex_保护，读取时只在锁内取得段的引用，pread在锁外进行
+class PersistentCache {
+public:
+    //dir为缓存文件所在的目录（不存在时创建），capacity为缓存文件的总大小上限，
+    //segment_size为单个缓存文件的大小
+    static Status Open(env* e, const std::string& dir, uint64_t capacity,
+                       PersistentCache** result, uint64_t segment_size = 64 << 20) {
+        *result = nullptr;
+        if (capacity == 0 || segment_size == 0) {
+            return InvalidArgument;
+        }
+        if (!e->FileExists(dir) && e->CreateDir(dir) != OK) {
+            return IOError;
+        }
+        std::vector<std::string> children;
+        Status s = e->GetChildren(dir, &children);
+        if (s != OK) {
+            return s;
+        }
+        for (const std::string& child : children) {
+            const size_t suffix_size = std::strlen(kSuffix);
+            if (child.size() > suffix_size &&
+                child.compare(child.size() - suffix_size, suffix_size, kSuffix) == 0) {
+                e->RemoveFile(dir + "/" + child);
+            }
+        }
+        PersistentCache* cache = new PersistentCache(e, dir, capacity, segment_size);
+        s = cache->NewSegment();
+        if (s != OK) {
+            delete cache;
+            return s;
+        }
+        *result = cache;
+        return OK;
+    }
+    PersistentCache(const PersistentCache&) = delete;
+    PersistentCache& operator=(const PersistentCache&) = delete;
+    ~PersistentCache() {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (writer_ != nullptr) {
+            writer_->Close();
+            delete writer_;
+        }
+        for (const std::shared_ptr<Segment>& segment : segments_) {
+            env_->RemoveFile(segment->filename);
+        }
+    }
+
+    //保存key->data，key已存在时新的记录覆盖旧的记录
+    Status Insert(const slice& key, const slice& data) {
+        const size_t record_size = kHeaderSize + key.size() + data.size();
+        std::string record;
+        record.reserve(record_size);
+        record.append(kHeaderSize, '\0');
+        record.append(key.data(), key.size());
+        record.append(data.data(), data.size());
+        coding::EncodeFixed32(&record[4], static_cast<uint32_t>(key.size()));
+        coding::EncodeFixed32(&record[8], static_cast<uint32_t>(data.size()));
+        uint32_t crc = crc32c::Value(record.data() + kHeaderSize, key.size() + data.size());
+        coding::EncodeFixed32(&record[0], crc32c::Mask(crc));
+
+        std::lock_guard<std::mutex> l(mutex_);
+        if (writer_offset_ + record_size > segment_size_ && writer_offset_ > 0) {
+            Status s = NewSegment();
+            if (s != OK) {
+                return s;
+            }
+        }
+        //写入内核后同一进程的pread即可读到，缓存内容丢失不影响正确性，因此不fsync
+        Status s = writer_->Append(slice(record.data(), record.size()));
+        if (s == OK) {
+            s = writer_->FlushBUffer();
+        }
+        if (s != OK) {
+            return s;
+        }
+        std::shared_ptr<Segment>& segment = segments_.back();
+        segment->keys.emplace_back(key.data(), key.size());
+        index_[segment->keys.back()] = Location{segment->number, writer_offset_, record_size};
+        writer_offset_ += record_size;
+        usage_ += record_size;
+        while (usage_ > capacity_ && segments_.size() > 1) {
+            DropOldestSegment();
+        }
+        return OK;
+    }
+
+    //找到key时把data读入*data，返回OK；未命中返回NotFound；记录损坏返回Corruption并移除该记录
+    Status Lookup(const slice& key, std::unique_ptr<char[]>* data, size_t* size) {
+        std::shared_ptr<Segment> segment;
+        Location loc;
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            auto it = index_.find(std::string(key.data(), key.size()));
+            if (it == index_.end()) {
+                return NotFound;
+            }
+            loc = it->second;
+            segment = FindSegment(loc.segment);
+            if (segment == nullptr) {
+                return NotFound;
+            }
+        }
+        std::unique_ptr<char[]> record(new char[loc.size]);
+        slice result;
+        Status s = segment->file->Read(loc.offset, &result, record.get(), loc.size);
+        if (s != OK) {
+            return s;
+        }
+        if (static_cast<size_t>(result.size()) != loc.size || !CheckRecord(result, key)) {
+            std::lock_guard<std::mutex> l(mutex_);
+            auto it = index_.find(std::string(key.data(), key.size()));
+            if (it != index_.end() && it->second.segment == loc.segment &&
+                it->second.offset == loc.offset) {
+                index_.erase(it);
+            }
+            return Corruption;
+        }
+        *size = loc.size - kHeaderSize - key.size();
+        data->reset(new char[*size]);
+        std::memcpy(data->get(), result.data() + kHeaderSize + key.size(), *size);
+        return OK;
+    }
+
+    void Erase(const slice& key) {
+        std::lock_guard<std::mutex> l(mutex_);
+        index_.erase(std::string(key.data(), key.size()));
+    }
+
+    //返回一个新的数字id，用作key的前缀区分各个使用者。
+    //Table已知文件编号时直接用文件编号作为前缀，NewId从2^63开始分配，不与文件编号冲突。
+    //文件编号只在一个数据库内唯一，因此一个PersistentCache只能供一个数据库使用
+    uint64_t NewId() {
+        std::lock_guard<std::mutex> l(mutex_);
+        return ++last_id_;
+    }
+
+    //缓存文件的总大小
+    uint64_t Usage() const {
+        std::lock_guard<std::mutex> l(mutex_);
+        return usage_;
+    }
+
+private:
+    static const size_t kHeaderSize = 12;
+    static constexpr const char* kSuffix = ".pcache";
+
+    struct Location {
+        uint64_t segment;
+        uint64_t offset;
+        size_t size;
+    };
+    struct Segment {
+        uint64_t number;
+        std::string filename;
+        std::unique_ptr<RandomAccessFile> file;
+        uint64_t size = 0;
+        std::vector<std::string> keys;  // 写入该段的key，删除该段时据此清理索引
+    };
+
+    PersistentCache(env* e, const std::string& dir, uint64_t capacity, uint64_t segment_size)
+        : env_(e), dir_(dir), capacity_(capacity), segment_size_(segment_size),
+          writer_(nullptr), writer_offset_(0), usage_(0), next_segment_(1), last_id_(uint64_t{1} << 63) {}
+
+    static bool CheckRecord(const slice& record, const slice& key) {
+        const char* p = record.data();
+        const uint32_t key_size = coding::DecodeFixed32(p + 4);
+        const uint32_t data_size = coding::DecodeFixed32(p + 8);
+        const size_t key_len = static_cast<size_t>(key.size());
+        if (key_size != key_len || kHeaderSize + key_size + data_size != static_cast<size_t>(record.size()) ||
+            std::memcmp(p + kHeaderSize, key.data(), key_len) != 0) {
+            return false;
+        }
+        const uint32_t crc = crc32c::Unmask(coding::DecodeFixed32(p));
+        return crc == crc32c::Value(p + kHeaderSize, key_size + data_size);
+    }
+
+    //REQUIRES: 持有mutex_
+    std::shared_ptr<Segment> FindSegment(uint64_t number) const {
+        if (segments_.empty() || number < segments_.front()->number) {
+            return nullptr;
+        }
+        return segments_[number - segments_.front()->number];
+    }
+
+    //关闭当前写入的段，开始写新的段。REQUIRES: 持有mutex_
+    Status NewSegment() {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "/%06llu", static_cast<unsigned long long>(next_segment_));
+        std::string fname = dir_ + buf + kSuffix;
+        WritableFile* writer;
+        Status s = env_->NewWritableFile(fname, &writer);
+        if (s != OK) {
+            return s;
+        }
+        //新建的段是空文件，env不会mmap空文件，返回的实现总能读到之后追加的内容
+        RandomAccessFile* reader;
+        s = env_->NewRandomAccessFile(fname, &reader);
+        if (s != OK) {
+            delete writer;
+            env_->RemoveFile(fname);
+            return s;
+        }
+        if (writer_ != nullptr) {
+            writer_->Close();
+            delete writer_;
+            segments_.back()->size = writer_offset_;
+        }
+        std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+        segment->number = next_segment_++;
+        segment->filename = fname;
+        segment->file.reset(reader);
+        segments_.push_back(segment);
+        writer_ = writer;
+        writer_offset_ = 0;
+        return OK;
+    }
+
+    //删除最早的段及其索引项，正在读取该段的线程持有引用，文件描述符在读取结束后关闭。
+    //REQUIRES: 持有mutex_，segments_.size() > 1
+    void DropOldestSegment() {
+        std::shared_ptr<Segment> segment = segments_.front();
+        segments_.pop_front();
+        for (const std::string& key : segment->keys) {
+            auto it = index_.find(key);
+            if (it != index_.end() && it->second.segment == segment->number) {
+                index_.erase(it);
+            }
+        }
+        usage_ -= segment->size;
+        env_->RemoveFile(segment->filename);
+    }
+
+    env* const env_;
+    const std::string dir_;
+    const uint64_t capacity_;
+    const uint64_t segment_size_;
+    mutable std::mutex mutex_;
+    std::deque<std::shared_ptr<Segment>> segments_;  // 按编号递增，最后一个是正在写入的段
+    std::unordered_map<std::string, Location> index_;
+    WritableFile* writer_;
+    uint64_t writer_offset_;  // 当前段已写入的字节数
+    uint64_t usage_;
+    uint64_t next_segment_;
+    uint64_t last_id_;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include "env.h"
+//从user key中截取前缀。配置后TableBuilder会把前缀加入filter，
+//前缀扫描（例如"某个用户的所有key"）可以先查filter跳过不含该前缀的sstable
+class PrefixExtractor {
+public:
+    virtual ~PrefixExtractor() = default;
+    //名字会记录在sstable的properties中，前缀规则变化时名字也必须变化
+    virtual const char* Name() const = 0;
+    //key是否有前缀，没有前缀的key不会加入filter
+    virtual bool InDomain(const slice& key) const = 0;
+    //REQUIRES: InDomain(key)
+    virtual slice Transform(const slice& key) const = 0;
+};
+
+//取固定长度的前缀
+class FixedPrefixExtractor : public PrefixExtractor {
+public:
+    explicit FixedPrefixExtractor(size_t prefix_len)
+        : prefix_len_(prefix_len), name_("leveldb.FixedPrefix." + std::to_string(prefix_len)) {}
+    const char* Name() const override { return name_.c_str(); }
+    bool InDomain(const slice& key) const override {
+        return static_cast<size_t>(key.size()) >= prefix_len_;
+    }
+    slice Transform(const slice& key) const override {
+        return slice(key.data(), prefix_len_);
+    }
+private:
+    size_t prefix_len_;
+    std::string name_;
+};
+
+//取到第一个分隔符为止（包含分隔符）的前缀，例如"tenant42:order:7"的前缀为"tenant42:"
+class DelimiterPrefixExtractor : public PrefixExtractor {
+public:
+    explicit DelimiterPrefixExtractor(char delimiter)
+        : delimiter_(delimiter), name_(std::string("leveldb.DelimiterPrefix.") + delimiter) {}
+    const char* Name() const override { return name_.c_str(); }
+    bool InDomain(const slice& key) const override {
+        return memchr(key.data(), delimiter_, key.size()) != nullptr;
+    }
+    slice Transform(const slice& key) const override {
+        const char* end = static_cast<const char*>(memchr(key.data(), delimiter_, key.size()));
+        return slice(key.data(), end - key.data() + 1);
+    }
+private:
+    char delimiter_;
+    std::string name_;
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+//I/O的优先级：HIGH为flush，LOW为compaction，USER为前台读写，不受限速
+enum class IOPriority { HIGH = 0, LOW = 1, USER = 2 };
+
+//限速器的统计
+struct RateLimiterStats {
+    uint64_t total_bytes[2] = {0, 0};     //按IOPriority（HIGH、LOW）累计获得的字节数
+    uint64_t total_requests[2] = {0, 0};  //按IOPriority（HIGH、LOW）累计的请求数
+    uint64_t waits = 0;                   //需要排队等待的请求数
+    int64_t bytes_per_sec = 0;            //当前的速率（auto_tuned时会变化）
+};
+
+//令牌桶限速器，后台的flush和compaction写入前从中获取令牌，把后台I/O平滑到bytes_per_sec以内，
+//避免后台写满磁盘带宽导致前台读的延迟尖刺。
+//
+//每个refill周期（默认100ms）补充bytes_per_sec*周期的令牌，周期内没用完的令牌不累积。
+//令牌不足时请求排队：HIGH队列优先于LOW队列，为防止LOW被饿死，每kFairness个周期先服务一次LOW队列。
+//flush通常是单线程顺序写，每次只有一个请求在排队，只靠排队顺序无法体现优先级，
+//因此每个周期按HIGH上个周期的用量（有积压时加倍）为HIGH预留令牌，LOW只能使用预留之外的部分。
+//排队的请求中由一个线程负责等到下个周期补充令牌并分配给队列中的请求，其余线程只等待被唤醒。
+//
+//auto_tuned为true时bytes_per_sec是上限，实际速率在[bytes_per_sec/20, bytes_per_sec]之间自动调整：
+//最近的周期中大部分都有请求排队（欠账多）时提高5%，很少排队时降低5%，
+//后台写入少时不占用带宽，积压时逐步放开
+class RateLimiter {
+public:
+    explicit RateLimiter(int64_t bytes_per_sec, int64_t refill_period_us = 100 * 1000,
+                         bool auto_tuned = false)
+        : refill_period_us_(refill_period_us),
+          max_bytes_per_sec_(bytes_per_sec),
+          auto_tuned_(auto_tuned),
+          rate_bytes_per_sec_(auto_tuned ? bytes_per_sec / 2 : bytes_per_sec),
+          refill_bytes_per_period_(CalculateRefillBytesPerPeriod(rate_bytes_per_sec_)),
+          available_bytes_(0),
+          high_reserve_(0),
+          high_bytes_this_period_(0),
+          next_refill_time_(Now()),
+          leader_(false),
+          refill_count_(0),
+          tune_periods_(0),
+          drained_periods_(0) {}
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    //修改速率。auto_tuned时修改的是速率上限
+    void SetBytesPerSecond(int64_t bytes_per_sec) {
+        std::lock_guard<std::mutex> l(mutex_);
+        max_bytes_per_sec_ = bytes_per_sec;
+        rate_bytes_per_sec_ = auto_tuned_ ? std::min(rate_bytes_per_sec_, bytes_per_sec) : bytes_per_sec;
+        refill_bytes_per_period_ = CalculateRefillBytesPerPeriod(rate_bytes_per_sec_);
+    }
+
+    //单次Request的上限，更大的I/O应拆分成多次请求
+    int64_t GetSingleBurstBytes() const {
+        std::lock_guard<std::mutex> l(mutex_);
+        return refill_bytes_per_period_;
+    }
+
+    //获取bytes字节的令牌，令牌不足时阻塞。pri为USER时直接返回。
+    //REQUIRES: bytes <= GetSingleBurstBytes()
+    void Request(int64_t bytes, IOPriority pri) {
+        if (pri == IOPriority::USER || bytes <= 0) {
+            return;
+        }
+        const int p = static_cast<int>(pri);
+        std::unique_lock<std::mutex> l(mutex_);
+        bytes = std::min(bytes, refill_bytes_per_period_);
+        stats_.total_bytes[p] += bytes;
+        stats_.total_requests[p]++;
+        //没有请求排队时无人负责补充令牌，由到达的请求补充
+        if (Now() >= next_refill_time_) {
+            Refill();
+        }
+        //HIGH的请求不必排在LOW的请求之后
+        const bool waiters = !queue_[0].empty() || (pri == IOPriority::LOW && !queue_[1].empty());
+        if (!waiters && CanGrant(bytes, pri)) {
+            Grant(bytes, pri);
+            return;
+        }
+        stats_.waits++;
+        Req r(bytes);
+        queue_[p].push_back(&r);
+        while (!r.granted) {
+            if (!leader_) {
+                //成为leader，等到下一个周期补充令牌
+                leader_ = true;
+                const auto wait_until = next_refill_time_;
+                r.cv.wait_until(l, wait_until);
+                if (Now() >= next_refill_time_) {
+                    Refill();
+                }
+                leader_ = false;
+                //交出leader，唤醒一个仍在等待的请求接替
+                WakeNextLeader();
+            } else {
+                r.cv.wait(l);
+            }
+        }
+    }
+
+    RateLimiterStats GetStats() const {
+        std::lock_guard<std::mutex> l(mutex_);
+        RateLimiterStats stats = stats_;
+        stats.bytes_per_sec = rate_bytes_per_sec_;
+        return stats;
+    }
+
+private:
+    static const int kFairness = 10;
+    static const int kAutoTuneIntervalPeriods = 100;
+    static const int kAllowedRangeFactor = 20;
+    static const int kAdjustPercent = 5;
+    static const int kHighWatermarkPercent = 90;
+    static const int kLowWatermarkPercent = 50;
+
+    struct Req {
+        explicit Req(int64_t bytes) : bytes(bytes), granted(false) {}
+        int64_t bytes;
+        bool granted;
+        std::condition_variable cv;
+    };
+
+    static std::chrono::steady_clock::time_point Now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    int64_t CalculateRefillBytesPerPeriod(int64_t rate) const {
+        return std::max<int64_t>(rate * refill_period_us_ / 1000000, 1);
+    }
+
+    //REQUIRES: 持有mutex_
+    void WakeNextLeader() {
+        for (std::deque<Req*>& queue : queue_) {
+            if (!queue.empty()) {
+                queue.front()->cv.notify_one();
+                return;
+            }
+        }
+    }
+
+    //补充一个周期的令牌并按优先级分配给排队的请求。REQUIRES: 持有mutex_
+    void Refill() {
+        next_refill_time_ = Now() + std::chrono::microseconds(refill_period_us_);
+        if (auto_tuned_) {
+            //上一个周期结束时仍有请求排队，说明令牌被用完（欠账）
+            tune_periods_++;
+            if (!queue_[0].empty() || !queue_[1].empty()) {
+                drained_periods_++;
+            }
+            if (tune_periods_ >= kAutoTuneIntervalPeriods) {
+                Tune();
+            }
+        }
+        //HIGH上个周期的用量作为本周期的预留，周期结束时仍有HIGH请求排队则加倍，使flush的速率能迅速上升
+        int64_t reserve = high_bytes_this_period_;
+        if (!queue_[0].empty()) {
+            reserve = std::max<int64_t>(reserve * 2, queue_[0].front()->bytes);
+        }
+        high_reserve_ = std::min(reserve, refill_bytes_per_period_);
+        high_bytes_this_period_ = 0;
+        available_bytes_ = refill_bytes_per_period_;
+        const bool low_first = (++refill_count_ % kFairness) == 0;
+        for (int i = 0; i < 2; i++) {
+            const int p = low_first ? 1 - i : i;
+            const IOPriority pri = static_cast<IOPriority>(p);
+            std::deque<Req*>& queue = queue_[p];
+            while (!queue.empty()) {
+                Req* next = queue.front();
+                //单次请求不超过一个周期的令牌，不部分满足，剩余的令牌留给周期内随后到达的HIGH请求
+                if (!CanGrant(next->bytes, pri) && !(low_first && pri == IOPriority::LOW &&
+                                                     available_bytes_ >= next->bytes)) {
+                    break;
+                }
+                Grant(next->bytes, pri);
+                next->granted = true;
+                queue.pop_front();
+                next->cv.notify_one();
+            }
+        }
+    }
+
+    //REQUIRES: 持有mutex_
+    bool CanGrant(int64_t bytes, IOPriority pri) const {
+        int64_t limit = available_bytes_;
+        if (pri == IOPriority::LOW) {
+            limit -= std::max<int64_t>(high_reserve_ - high_bytes_this_period_, 0);
+        }
+        return bytes <= limit;
+    }
+    //REQUIRES: 持有mutex_，CanGrant(bytes, pri)
+    void Grant(int64_t bytes, IOPriority pri) {
+        available_bytes_ -= bytes;
+        if (pri == IOPriority::HIGH) {
+            high_bytes_this_period_ += bytes;
+        }
+    }
+
+    //根据最近kAutoTuneIntervalPeriods个周期中欠账周期的比例调整速率。REQUIRES: 持有mutex_
+    void Tune() {
+        const int64_t drained_percent = drained_periods_ * 100 / tune_periods_;
+        const int64_t min_rate = std::max<int64_t>(max_bytes_per_sec_ / kAllowedRangeFactor, 1);
+        int64_t rate = rate_bytes_per_sec_;
+        if (drained_percent > kHighWatermarkPercent) {
+            rate = std::min(max_bytes_per_sec_, rate + std::max<int64_t>(rate * kAdjustPercent / 100, 1));
+        } else if (drained_percent < kLowWatermarkPercent) {
+            rate = std::max(min_rate, rate - rate * kAdjustPercent / 100);
+        }
+        if (rate != rate_bytes_per_sec_) {
+            rate_bytes_per_sec_ = rate;
+            refill_bytes_per_period_ = CalculateRefillBytesPerPeriod(rate);
+        }
+        tune_periods_ = 0;
+        drained_periods_ = 0;
+    }
+
+    const int64_t refill_period_us_;
+    mutable std::mutex mutex_;
+    int64_t max_bytes_per_sec_;
+    const bool auto_tuned_;
+    int64_t rate_bytes_per_sec_;
+    int64_t refill_bytes_per_period_;
+    int64_t available_bytes_;
+    int64_t high_reserve_;            //本周期为HIGH预留的令牌
+    int64_t high_bytes_this_period_;  //本周期HIGH已获得的令牌
+    std::chrono::steady_clock::time_point next_refill_time_;
+    bool leader_;  //是否已有线程在等待下一个周期
+    std::deque<Req*> queue_[2];  //按IOPriority（HIGH、LOW）排队的请求
+    uint64_t refill_count_;
+    int64_t tune_periods_;
+    int64_t drained_periods_;
+    RateLimiterStats stats_;
+};
@@ -0,0 +1,290 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "env.h"
+#include "coding.h"
+#include "filterPolicy.h"
+#include "hash64.h"
+
+// A standard Ribbon filter with 128-bit coefficient rows [Dillinger, Walzer
+// 2021].  Each key is a linear equation over GF(2): a random 128-bit row of
+// coefficients starting at a random slot, equal to the key's fingerprint.
+// Construction solves the banded system by incremental Gaussian elimination
+// and stores the solution; a lookup multiplies the key's row by the
+// solution and compares the product with the fingerprint.
+//
+// The solution uses kSpaceOverhead more slots than there are keys, and each
+// slot holds bits_per_key / (1 + kSpaceOverhead) fingerprint bits.  A
+// fractional width is realised by giving some 64-slot blocks one more
+// fingerprint bit than the others.  The false positive rate is therefore
+// about 2^-(bits_per_key / 1.05): 7 bits per key gives about 1%, which
+// the default 10-bits-per-key Bloom filter (about 1.2% here) needs 30% more
+// memory for.  Building costs several times more CPU than a Bloom filter,
+// and a filter has at least 128 slots, so filters over fewer than a few
+// hundred keys take more than bits_per_key per key.
+//
+// Filter layout: the solution as fixed64 words, block by block, with one
+// word per fingerprint bit of the block; then the seed as a fixed64, and
+// the block count, the first block with the extra bit and the smaller
+// per-block bit count as fixed32s.
+class RibbonFilterPolicy : public FilterPolicy {
+public:
+// Between one and 32 fingerprint bits per slot.
+explicit RibbonFilterPolicy(double bits_per_key = 7.0)
+    : columns_(std::min(std::max(bits_per_key / (1 + kSpaceOverhead), 1.0), 32.0)) {}
+
+const char* Name() const override { return "leveldb.RibbonFilter"; }
+
+void CreateFilter(const slice* keys, int n, std::string* dst) const override {
+    std::vector<uint64_t> hashes(n);
+    for (int i = 0; i < n; i++) {
+        hashes[i] = KeyHash(keys[i]);
+    }
+    CreateFilterFromHashes(hashes.data(), n, dst);
+}
+
+bool SupportsKeyHashes() const override { return true; }
+
+uint64_t HashKey(const slice& key) const override { return KeyHash(key); }
+
+void CreateFilterFromHashes(const uint64_t* key_hashes, int n,
+                            std::string* dst) const override {
+    // A duplicate key would be a redundant equation, but one that only
+    // collides on its start and coefficients would make banding fail.
+    std::vector<uint64_t> hashes(key_hashes, key_hashes + n);
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    const size_t size = hashes.size();
+    if (size == 0) {
+        AppendTrailer(0, 0, 0, 0, dst);
+        return;
+    }
+
+    uint32_t num_blocks = static_cast<uint32_t>(
+        (static_cast<size_t>(std::ceil(size * (1 + kSpaceOverhead))) + kBlockSlots - 1) / kBlockSlots);
+    // A row spans two blocks.
+    num_blocks = std::max<uint32_t>(num_blocks, kWidth / kBlockSlots);
+    std::vector<Row> coeff_rows;
+    std::vector<uint32_t> result_rows;
+    uint64_t seed = 0;
+    for (int attempt = 0;; attempt++) {
+        // Rarely banding fails at the chosen size; after a few seeds, grow
+        // the table a little instead of retrying forever.
+        if (attempt > 0 && attempt % kAttemptsPerSize == 0) {
+            num_blocks += num_blocks / 16 + 1;
+        }
+        seed = Mix64(0x9e3779b97f4a7c15ull * (attempt + 1));
+        const uint32_t num_slots = num_blocks * kBlockSlots;
+        coeff_rows.assign(num_slots, 0);
+        result_rows.assign(num_slots, 0);
+        bool ok = true;
+        for (size_t i = 0; ok && i < size; i++) {
+            const uint64_t h = Mix64(hashes[i] + seed);
+            ok = Band(Start(h, num_slots), Coefficients(h), Fingerprint(h),
+                      coeff_rows.data(), result_rows.data());
+        }
+        if (ok) break;
+    }
+
+    // Blocks from upper_start on have lower_columns + 1 fingerprint bits.
+    const uint32_t total_columns = static_cast<uint32_t>(std::lround(columns_ * num_blocks));
+    const uint32_t lower_columns = std::min(total_columns / num_blocks, 31u);
+    const uint32_t upper_start =
+        num_blocks - std::min(total_columns - lower_columns * num_blocks, num_blocks);
+
+    // Back substitution from the last slot up.  state[c] holds the
+    // solution bits of column c for the 128 slots starting at the current
+    // one, with the current slot in bit 0.
+    std::vector<uint64_t> solution(WordOffset(num_blocks, upper_start, lower_columns), 0);
+    Row state[32] = {0};
+    for (uint32_t i = num_blocks * kBlockSlots; i-- > 0;) {
+        const uint32_t block = i / kBlockSlots;
+        const uint32_t columns = lower_columns + (block >= upper_start ? 1 : 0);
+        uint64_t* words = &solution[WordOffset(block, upper_start, lower_columns)];
+        const Row coeffs = coeff_rows[i];
+        const uint32_t result = result_rows[i];
+        for (uint32_t c = 0; c < columns; c++) {
+            const Row shifted = state[c] << 1;
+            // An empty row leaves the slot free; it is set to 0.
+            const uint64_t bit = coeffs == 0 ? 0 : (Parity(coeffs & shifted) ^ ((result >> c) & 1));
+            state[c] = shifted | bit;
+            words[c] |= bit << (i % kBlockSlots);
+        }
+    }
+
+    for (uint64_t word : solution) {
+        coding::PutFixed64(dst, word);
+    }
+    AppendTrailer(seed, num_blocks, upper_start, lower_columns, dst);
+}
+
+bool KeyMayMatch(const slice& key, const slice& filter) const override {
+    Layout layout;
+    if (!ParseFilter(filter, &layout)) return true;  // Not a filter we wrote
+    if (layout.num_blocks == 0) return false;        // Filter over no keys
+    return Query(Mix64(KeyHash(key) + layout.seed), layout);
+}
+
+void KeysMayMatch(const slice* keys, int n, const slice& filter,
+                  bool* results) const override {
+    Layout layout;
+    if (!ParseFilter(filter, &layout) || layout.num_blocks == 0) {
+        FilterPolicy::KeysMayMatch(keys, n, filter, results);
+        return;
+    }
+    const uint32_t num_slots = layout.num_blocks * kBlockSlots;
+    uint64_t hashes[kFilterBatchSize];
+    for (int start = 0; start < n; start += kFilterBatchSize) {
+        const int count = std::min(n - start, kFilterBatchSize);
+        for (int i = 0; i < count; i++) {
+            hashes[i] = Mix64(KeyHash(keys[start + i]) + layout.seed);
+            const uint32_t block = Start(hashes[i], num_slots) / kBlockSlots;
+            PrefetchForRead(layout.data + 8 * WordOffset(block, layout.upper_start, layout.lower_columns));
+        }
+        for (int i = 0; i < count; i++) {
+            results[start + i] = Query(hashes[i], layout);
+        }
+    }
+}
+
+private:
+// Solution words hold the bits of one fingerprint column for 64 slots.
+typedef unsigned __int128 Row;
+static const uint32_t kWidth = 128;
+static const uint32_t kBlockSlots = 64;
+static const size_t kTrailerSize = 8 + 4 + 4 + 4;
+static const int kAttemptsPerSize = 4;
+// Extra slots over keys.  With 128-bit rows, banding then succeeds on the
+// first seed almost always.
+static constexpr double kSpaceOverhead = 0.05;
+
+struct Layout {
+    const char* data;  // the solution words
+    uint64_t seed;
+    uint32_t num_blocks;
+    uint32_t upper_start;
+    uint32_t lower_columns;
+};
+
+static void AppendTrailer(uint64_t seed, uint32_t num_blocks, uint32_t upper_start,
+                          uint32_t lower_columns, std::string* dst) {
+    coding::PutFixed64(dst, seed);
+    coding::PutFixed32(dst, num_blocks);
+    coding::PutFixed32(dst, upper_start);
+    coding::PutFixed32(dst, lower_columns);
+}
+
+static bool ParseFilter(const slice& filter, Layout* layout) {
+    const size_t len = filter.size();
+    if (len < kTrailerSize) return false;
+    const char* trailer = filter.data() + len - kTrailerSize;
+    layout->data = filter.data();
+    layout->seed = coding::DecodeFixed64(trailer);
+    layout->num_blocks = coding::DecodeFixed32(trailer + 8);
+    layout->upper_start = coding::DecodeFixed32(trailer + 12);
+    layout->lower_columns = coding::DecodeFixed32(trailer + 16);
+    if (layout->num_blocks == 1 || layout->upper_start > layout->num_blocks || layout->lower_columns > 31) {
+        return false;
+    }
+    return 8 * WordOffset(layout->num_blocks, layout->upper_start, layout->lower_columns) ==
+           len - kTrailerSize;
+}
+
+// Index of the first solution word of a block.
+static size_t WordOffset(uint32_t block, uint32_t upper_start, uint32_t lower_columns) {
+    return static_cast<size_t>(block) * lower_columns + (block > upper_start ? block - upper_start : 0);
+}
+
+// A key's row is 128 slots wide, so it starts in [0, num_slots - 128].
+static uint32_t Start(uint64_t h, uint32_t num_slots) {
+    return static_cast<uint32_t>(((h >> 32) * (num_slots - kWidth + 1)) >> 32);
+}
+
+// The first coefficient is always 1, so the row has a pivot at its start.
+static Row Coefficients(uint64_t h) {
+    return (static_cast<Row>(Mix64(h ^ 0x9fb21c651e98df25ull)) << 64) |
+           (Mix64(h ^ 0x2545f4914f6cdd1dull) | 1);
+}
+
+static uint32_t Fingerprint(uint64_t h) { return static_cast<uint32_t>(h); }
+
+// Adds one equation to the banded system.  Returns false if it contradicts
+// the equations already added.
+static bool Band(uint32_t start, Row coeffs, uint32_t result,
+                 Row* coeff_rows, uint32_t* result_rows) {
+    uint32_t i = start;
+    while (true) {
+        if (coeff_rows[i] == 0) {
+            coeff_rows[i] = coeffs;
+            result_rows[i] = result;
+            return true;
+        }
+        coeffs ^= coeff_rows[i];
+        result ^= result_rows[i];
+        if (coeffs == 0) {
+            return result == 0;
+        }
+        const uint64_t low = static_cast<uint64_t>(coeffs);
+        const int shift = low != 0 ? __builtin_ctzll(low) : 64 + __builtin_ctzll(static_cast<uint64_t>(coeffs >> 64));
+        coeffs >>= shift;
+        i += shift;
+    }
+}
+
+// The row covers the start block, the next one and, unless it starts on a
+// block boundary, part of a third.  Later blocks have at least as many
+// columns as the start block, whose column count the query uses.
+static bool Query(uint64_t h, const Layout& layout) {
+    const uint32_t start = Start(h, layout.num_blocks * kBlockSlots);
+    const uint32_t block = start / kBlockSlots;
+    const uint32_t offset = start % kBlockSlots;
+    const uint32_t columns = layout.lower_columns + (block >= layout.upper_start ? 1 : 0);
+    const char* words[3];
+    for (uint32_t b = 0; b < 3; b++) {
+        words[b] = (b == 2 && offset == 0)
+                       ? nullptr
+                       : layout.data + 8 * WordOffset(block + b, layout.upper_start, layout.lower_columns);
+    }
+    const Row coeffs = Coefficients(h);
+    const uint32_t fingerprint = Fingerprint(h);
+    for (uint32_t c = 0; c < columns; c++) {
+        const uint64_t w0 = coding::DecodeFixed64(words[0] + 8 * c);
+        const uint64_t w1 = coding::DecodeFixed64(words[1] + 8 * c);
+        uint64_t low = w0, high = w1;
+        if (offset != 0) {
+            const uint64_t w2 = coding::DecodeFixed64(words[2] + 8 * c);
+            low = (w0 >> offset) | (w1 << (kBlockSlots - offset));
+            high = (w1 >> offset) | (w2 << (kBlockSlots - offset));
+        }
+        const Row window = (static_cast<Row>(high) << 64) | low;
+        if (Parity(window & coeffs) != ((fingerprint >> c) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t Parity(Row x) {
+    return static_cast<uint64_t>(__builtin_parityll(static_cast<uint64_t>(x)) ^
+                                 __builtin_parityll(static_cast<uint64_t>(x >> 64)));
+}
+
+static uint64_t KeyHash(const slice& key) {
+    return Hash64(key.data(), key.size(), 0x7a3e5b9c1d2f4e6bull);
+}
+
+// murmur3 64-bit finalizer
+static uint64_t Mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+const double columns_;  // average fingerprint bits per slot
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include "env.h"
+#include "dbformat.h"
+#include "options.h"
+#include "SSTable.h"
+//在数据库之外生成可以直接导入（IngestExternalFile）的sstable。
+//key必须按user key严格递增的顺序写入，所有条目的sequence都是0，导入时再统一赋予global sequence
+class SstFileWriter {
+public:
+    SstFileWriter(const Options& options, env* e)
+        : options_(options), env_(e), file_(nullptr), builder_(nullptr) {}
+    SstFileWriter(const SstFileWriter&) = delete;
+    SstFileWriter& operator=(const SstFileWriter&) = delete;
+    ~SstFileWriter() {
+        delete builder_;
+        delete file_;
+    }
+
+    Status Open(const std::string& file_path) {
+        if (builder_ != nullptr) {
+            return InvalidArgument;
+        }
+        Status s = env_->NewWritableFile(file_path, &file_, false, WritableFileOptions::ForTableFile());
+        if (s != OK) {
+            return s;
+        }
+        builder_ = new TableBuilder(options_, file_);
+        last_user_key_.clear();
+        return OK;
+    }
+    Status Put(const slice& user_key, const slice& value) {
+        return Add(user_key, value, kTypeValue);
+    }
+    Status Delete(const slice& user_key) {
+        return Add(user_key, slice(), kTypeDeletion);
+    }
+    //写完footer并把文件刷到磁盘，之后该writer不能再使用
+    Status Finish() {
+        if (builder_ == nullptr) {
+            return InvalidArgument;
+        }
+        if (builder_->NumEntries() == 0) {
+            return InvalidArgument;  // 空文件无法导入
+        }
+        Status s = builder_->Finish();
+        if (s == OK) {
+            s = file_->Fsync();
+        }
+        delete builder_;
+        builder_ = nullptr;
+        delete file_;
+        file_ = nullptr;
+        return s;
+    }
+
+private:
+    Status Add(const slice& user_key, const slice& value, ValueType type) {
+        if (builder_ == nullptr) {
+            return InvalidArgument;
+        }
+        std::string key(user_key.data(), user_key.size());
+        if (builder_->NumEntries() > 0 && key <= last_user_key_) {
+            return InvalidArgument;  // user key必须严格递增
+        }
+        last_user_key_ = key;
+        ParsedInternalKey ikey;
+        ikey.user_key = user_key;
+        ikey.sequence = 0;
+        ikey.type = type;
+        std::string internal_key;
+        AppendInternalKey(&internal_key, ikey);
+        return builder_->Add(slice(internal_key), value);
+    }
+
+    Options options_;
+    env* env_;
+    WritableFile* file_;
+    TableBuilder* builder_;
+    std::string last_user_key_;
+};
@@ -0,0 +1,950 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SSTable.h"
+#include "cache.h"
+#include "dbformat.h"
+#include "persistentCache.h"
+//Table使用的filter，按filter的布局只有一个reader不为nullptr。
+//cache_index_and_filter_blocks为true时整个对象作为一个条目放入block cache
+struct TableFilter {
+    BlockContents contents;  // kOffsetFilter和kFullFilter的filter内容；kPartitionedFilter的分区索引由reader持有
+    FilterBlockReader* offset_reader = nullptr;                // kOffsetFilter
+    FullFilterBlockReader* full_reader = nullptr;              // kFullFilter
+    PartitionedFilterBlockReader* partitioned_reader = nullptr;  // kPartitionedFilter
+    size_t charge = 0;  // 占用的内存，用作缓存的charge
+
+    TableFilter(){
+        contents.data = slice();
+        contents.cachable = false;
+        contents.heap_allocated = false;
+    }
+    TableFilter(const TableFilter&) = delete;
+    TableFilter& operator=(const TableFilter&) = delete;
+    ~TableFilter(){
+        delete offset_reader;
+        delete full_reader;
+        delete partitioned_reader;
+        if(contents.heap_allocated){
+            delete[] contents.data.data();
+        }
+    }
+};
+
+//sstable的读取端。Open时读入footer、index_block和filter，之后每次查询最多再读一个filter分区和一个data block。
+//options.block_cache不为nullptr时，data block和filter分区通过block cache读取；
+//cache_index_and_filter_blocks为true时index block和filter也放入block cache的高优先级池
+class Table{
+public:
+    //file在Table析构前必须保持有效，由调用者释放。
+    //level为文件所在的层，-1表示未知；只有L0文件会按pin_l0_filter_and_index_blocks_in_cache常驻缓存。
+    //file_number为sstable的文件编号，0表示未知；已知时persistent_cache中的block在Table关闭重开后仍能命中
+    //global_seqno不为0时表示外部导入的文件：文件中所有key的sequence都是0，读取时统一视为global_seqno
+    static Status Open(const Options& options,RandomAccessFile* file,uint64_t file_size,Table** table,
+                       int level = -1,uint64_t file_number = 0,SequenceNumber global_seqno = 0){
+        *table = nullptr;
+        if(file_size < Footer::kEncodedLength){
+            return Corruption;
+        }
+        char footer_space[Footer::kEncodedLength];
+        slice footer_input;
+        Status s = file->Read(file_size - Footer::kEncodedLength,&footer_input,footer_space,Footer::kEncodedLength);
+        if(s != OK){
+            return s;
+        }
+        Footer footer;
+        s = footer.DecodeFrom(&footer_input);
+        if(s != OK){
+            return s;
+        }
+        if(options.advise_random_on_open){
+            file->Hint(AccessPattern::RANDOM);
+        }
+        Table* t = new Table(options,file,file_size,footer.index_handle(),level,file_number,global_seqno);
+        s = t->ReadIndex();
+        if(s != OK){
+            delete t;
+            return s;
+        }
+        t->ReadMeta(footer);
+        *table = t;
+        return OK;
+    }
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+    ~Table(){
+        if(filter_cache_handle_ != nullptr){
+            options_.block_cache->Release(filter_cache_handle_);
+        }else{
+            delete filter_;
+        }
+        if(index_cache_handle_ != nullptr){
+            options_.block_cache->Release(index_cache_handle_);
+        }else{
+            delete index_block_;
+        }
+    }
+    //filter认为key可能存在时返回true；表中没有可用的filter时总是返回true
+    bool KeyMayMatch(const slice& visible_key){
+        std::string stored;
+        if(!ToStoredKey(visible_key,&stored)){
+            return false;
+        }
+        const slice key(stored.data(),stored.size());
+        if(!props_.whole_key_filtering){
+            return true;
+        }
+        TableFilter* filter;
+        Cache::Handle* handle;
+        if(!GetFilter(&filter,&handle)){
+            return true;
+        }
+        bool may_match = true;
+        if(filter->offset_reader != nullptr){
+            //按偏移切分的filter需要先通过index找到key所在的data block
+            BlockHandle block_handle;
+            may_match = FindDataBlock(key,&block_handle) &&
+                        filter->offset_reader->KeyMayMatch(block_handle.offset(),ExtractUserKey(key));
+        }else{
+            may_match = FilterMayMatch(filter,key,ExtractUserKey(key));
+        }
+        ReleaseFilter(filter,handle);
+        return may_match;
+    }
+    //批量版本的KeyMayMatch，results[i]对应keys[i]，用于MultiGet等一次查询多个key的场景。
+    //先把所有key定位到各自的filter，再成批地哈希、预取、判断，使各个key的cache miss互相重叠。
+    //keys按顺序排列时，落在同一个filter（或分区）中的相邻key会合并成一批
+    void KeysMayMatch(const slice* keys,int n,bool* results){
+        if(global_seqno_ != 0){
+            std::vector<std::string> stored(n);
+            std::vector<slice> stored_keys(n);
+            std::vector<int> index;
+            for(int i = 0;i < n;i++){
+                results[i] = false;
+                if(ToStoredKey(keys[i],&stored[index.size()])){
+                    stored_keys[index.size()] = slice(stored[index.size()].data(),stored[index.size()].size());
+                    index.push_back(i);
+                }
+            }
+            std::unique_ptr<bool[]> stored_results(new bool[index.size()]);
+            StoredKeysMayMatch(stored_keys.data(),static_cast<int>(index.size()),stored_results.get());
+            for(size_t j = 0;j < index.size();j++){
+                results[index[j]] = stored_results[j];
+            }
+            return;
+        }
+        StoredKeysMayMatch(keys,n,results);
+    }
+    //查找与key完全相同的条目，找到返回OK，不存在返回NotFound。
+    //外部导入的文件中key的sequence读作global_seqno_，key需要带上这个sequence才能找到
+    Status InternalGet(const slice& visible_key,std::string* value,const ReadOptions& read_options = ReadOptions()){
+        std::string stored;
+        if(!ToStoredKey(visible_key,&stored)){
+            return NotFound;
+        }
+        const slice key(stored.data(),stored.size());
+        BlockHandle handle;
+        if(!FindDataBlock(key,&handle)){
+            return NotFound;
+        }
+        TableFilter* filter;
+        Cache::Handle* filter_handle;
+        if(props_.whole_key_filtering && GetFilter(&filter,&filter_handle)){
+            bool may_match = filter->offset_reader != nullptr
+                                 ? filter->offset_reader->KeyMayMatch(handle.offset(),ExtractUserKey(key))
+                                 : FilterMayMatch(filter,key,ExtractUserKey(key));
+            ReleaseFilter(filter,filter_handle);
+            if(!may_match){
+                return NotFound;
+            }
+        }
+        Block* block;
+        Cache::Handle* cache_handle;
+        Status s = ReadBlockCached(handle,Cache::Priority::LOW,&block,&cache_handle,read_options.fill_cache);
+        if(s != OK){
+            return s;
+        }
+        Iterator* iter = block->NewIterator();
+        std::string target(key.data(),key.size());
+        iter->Seek(target);
+        s = NotFound;
+        if(iter->Valid() && iter->key() == target){
+            *value = iter->value();
+            s = OK;
+        }
+        delete iter;
+        ReleaseBlock(block,cache_handle);
+        return s;
+    }
+    //批量版本的InternalGet，statuses[i]和values[i]对应keys[i]。
+    //先用filter批量排除不存在的key，再把需要的、不在block cache中的data block通过一次MultiRead并发读取，
+    //各个block的I/O互相重叠，而不是逐个等待
+    void MultiGet(const slice* visible_keys,int n,std::string* values,Status* statuses,
+                  const ReadOptions& read_options = ReadOptions()){
+        //ToStoredKey失败的key不可能存在，用空key占位并在下面跳过
+        std::vector<std::string> stored(n);
+        std::vector<slice> stored_keys(n);
+        std::unique_ptr<bool[]> may_match(new bool[n]);
+        for(int i = 0;i < n;i++){
+            may_match[i] = ToStoredKey(visible_keys[i],&stored[i]);
+            stored_keys[i] = slice(stored[i].data(),stored[i].size());
+        }
+        const slice* keys = stored_keys.data();
+        std::unique_ptr<bool[]> filter_match(new bool[n]);
+        StoredKeysMayMatch(keys,n,filter_match.get());
+        for(int i = 0;i < n;i++){
+            may_match[i] = may_match[i] && filter_match[i];
+        }
+        struct DataBlock{
+            BlockHandle handle;
+            Block* block = nullptr;
+            Cache::Handle* cache_handle = nullptr;
+            Status status = OK;
+        };
+        std::vector<DataBlock> blocks;
+        std::map<uint64_t,size_t> block_index;  //block偏移 -> blocks中的下标
+        std::vector<int> block_of(n,-1);
+        for(int i = 0;i < n;i++){
+            statuses[i] = NotFound;
+            BlockHandle handle;
+            if(!may_match[i] || !FindDataBlock(keys[i],&handle)){
+                continue;
+            }
+            auto it = block_index.find(handle.offset());
+            if(it == block_index.end()){
+                it = block_index.emplace(handle.offset(),blocks.size()).first;
+                blocks.emplace_back();
+                blocks.back().handle = handle;
+            }
+            block_of[i] = static_cast<int>(it->second);
+        }
+        std::vector<size_t> misses;
+        for(size_t b = 0;b < blocks.size();b++){
+            if(!LookupCachedBlock(blocks[b].handle,&blocks[b].block,&blocks[b].cache_handle)){
+                misses.push_back(b);
+            }
+        }
+        if(options_.persistent_cache != nullptr || misses.size() <= 1){
+            //只有一个block时没有可重叠的I/O；persistent_cache需要逐个查找
+            for(size_t b : misses){
+                DataBlock& d = blocks[b];
+                d.status = ReadBlockCached(d.handle,Cache::Priority::LOW,&d.block,&d.cache_handle,read_options.fill_cache);
+            }
+        }else{
+            std::vector<ReadRequest> reqs(misses.size());
+            const bool needs_scratch = file_->NeedsScratch();
+            for(size_t j = 0;j < misses.size();j++){
+                const BlockHandle& handle = blocks[misses[j]].handle;
+                reqs[j].offset = handle.offset();
+                reqs[j].len = static_cast<size_t>(handle.size()) + kBlockTrailerSize;
+                reqs[j].scratch = needs_scratch ? new char[reqs[j].len] : nullptr;
+            }
+            file_->MultiRead(reqs.data(),reqs.size());
+            for(size_t j = 0;j < misses.size();j++){
+                DataBlock& d = blocks[misses[j]];
+                if(reqs[j].status != OK){
+                    delete[] reqs[j].scratch;
+                    d.status = reqs[j].status;
+                    continue;
+                }
+                BlockContents contents;
+                d.status = ParseBlockRead(d.handle,reqs[j].scratch,reqs[j].result,&contents);
+                if(d.status == OK){
+                    NewCachedBlock(d.handle,contents,Cache::Priority::LOW,read_options.fill_cache,&d.block,&d.cache_handle);
+                }
+            }
+        }
+        for(int i = 0;i < n;i++){
+            if(block_of[i] < 0){
+                continue;
+            }
+            const DataBlock& d = blocks[block_of[i]];
+            if(d.status != OK){
+                statuses[i] = d.status;
+                continue;
+            }
+            Iterator* iter = d.block->NewIterator();
+            std::string target(keys[i].data(),keys[i].size());
+            iter->Seek(target);
+            if(iter->Valid() && iter->key() == target){
+                values[i] = iter->value();
+                statuses[i] = OK;
+            }
+            delete iter;
+        }
+        for(DataBlock& d : blocks){
+            if(d.block != nullptr){
+                ReleaseBlock(d.block,d.cache_handle);
+            }
+        }
+    }
+
+    //表中可能存在以prefix为前缀的user key时返回true。
+    //只有写入时使用了同名的prefix_extractor，filter中才有前缀，否则总是返回true
+    bool PrefixMayMatch(const slice& prefix){
+        if(options_.prefix_extractor == nullptr ||
+           props_.prefix_extractor_name != options_.prefix_extractor->Name()){
+            return true;
+        }
+        TableFilter* filter;
+        Cache::Handle* handle;
+        if(!GetFilter(&filter,&handle)){
+            return true;
+        }
+        bool may_match = FilterMayMatch(filter,prefix,prefix);
+        ReleaseFilter(filter,handle);
+        return may_match;
+    }
+    const TableProperties& properties() const { return props_; }
+
+    //返回的迭代器在Table析构前有效，由调用者delete
+    Iterator* NewIterator(const ReadOptions& read_options = ReadOptions());
+    //只遍历user key以prefix开头的条目，filter判断表中没有该前缀时直接返回空迭代器而不读取任何data block。
+    //REQUIRES: prefix是options.prefix_extractor提取出的前缀
+    Iterator* NewPrefixIterator(const slice& prefix);
+
+private:
+    friend class TableIterator;
+    Table(const Options& options,RandomAccessFile* file,uint64_t file_size,const BlockHandle& index_handle,int level,
+          uint64_t file_number,SequenceNumber global_seqno)
+        :options_(options),file_(file),file_size_(file_size),global_seqno_(global_seqno),
+         cache_id_(options.block_cache != nullptr ? options.block_cache->NewId() : 0),
+         persistent_cache_id_(file_number != 0 ? file_number :
+                              options.persistent_cache != nullptr ? options.persistent_cache->NewId() : 0),
+         cache_meta_(options.block_cache != nullptr && options.cache_index_and_filter_blocks),
+         pin_meta_(level == 0 && options.pin_l0_filter_and_index_blocks_in_cache),
+         index_handle_(index_handle),index_block_(nullptr),index_cache_handle_(nullptr),
+         has_filter_(false),filter_layout_(kOffsetFilter),
+         filter_(nullptr),filter_cache_handle_(nullptr){}
+
+    //读取index block。放入block cache时，只有需要常驻时才保留句柄，否则每次使用时再从缓存中取
+    Status ReadIndex(){
+        if(!cache_meta_){
+            BlockContents contents;
+            Status s = ReadBlock(file_,index_handle_,&contents);
+            if(s == OK){
+                index_block_ = new Block(contents);
+            }
+            return s;
+        }
+        Block* block;
+        Cache::Handle* handle;
+        Status s = ReadBlockCached(index_handle_,Cache::Priority::HIGH,&block,&handle);
+        if(s != OK){
+            return s;
+        }
+        if(pin_meta_ || handle == nullptr){
+            index_block_ = block;
+            index_cache_handle_ = handle;
+        }else{
+            ReleaseBlock(block,handle);
+        }
+        return OK;
+    }
+    //从metaindex_block中读取properties，并找出与当前filter policy匹配的filter加载，出错时当作没有filter
+    void ReadMeta(const Footer& footer){
+        BlockContents contents;
+        if(ReadBlock(file_,footer.metaindex_handle(),&contents) != OK){
+            return;
+        }
+        Block metaindex(contents);
+        Iterator* iter = metaindex.NewIterator();
+        //properties中记录了filter里放的是完整key还是前缀
+        iter->Seek(kPropertiesBlockName);
+        if(iter->Valid() && iter->key() == kPropertiesBlockName){
+            std::string handle_value = iter->value();
+            ReadProperties(handle_value);
+        }
+        if(options_.filter_policy == nullptr){
+            delete iter;
+            return;
+        }
+        const char* prefixes[] = {kFilterBlockPrefix,kFullFilterBlockPrefix,kPartitionedFilterBlockPrefix};
+        for(int layout = kOffsetFilter; layout <= kPartitionedFilter; layout++){
+            std::string name = std::string(prefixes[layout]) + options_.filter_policy->Name();
+            iter->Seek(name);
+            if(iter->Valid() && iter->key() == name){
+                std::string handle_value = iter->value();
+                slice input(handle_value.data(),handle_value.size());
+                if(filter_handle_.DecodeFrom(&input) == OK){
+                    has_filter_ = true;
+                    filter_layout_ = static_cast<FilterLayout>(layout);
+                }
+                break;
+            }
+        }
+        delete iter;
+        if(!has_filter_){
+            return;
+        }
+        //预先读入filter：不放入缓存或需要常驻时由Table持有，否则只是预热缓存
+        if(!cache_meta_){
+            filter_ = LoadFilter();
+            has_filter_ = (filter_ != nullptr);
+            return;
+        }
+        TableFilter* filter;
+        Cache::Handle* handle;
+        if(!GetFilter(&filter,&handle)){
+            has_filter_ = false;
+            return;
+        }
+        if(pin_meta_ || handle == nullptr){
+            filter_ = filter;
+            filter_cache_handle_ = handle;
+        }else{
+            ReleaseFilter(filter,handle);
+        }
+    }
+    void ReadProperties(const std::string& handle_value){
+        slice input(handle_value.data(),handle_value.size());
+        BlockHandle handle;
+        if(handle.DecodeFrom(&input) != OK){
+            return;
+        }
+        BlockContents contents;
+        if(ReadBlock(file_,handle,&contents) != OK){
+            return;
+        }
+        TableProperties props;
+        if(props.DecodeFrom(contents.data) == OK){
+            props_ = props;
+        }
+        if(contents.heap_allocated){
+            delete[] contents.data.data();
+        }
+    }
+    //读取filter_handle_处的filter，出错时返回nullptr
+    TableFilter* LoadFilter(){
+        BlockContents contents;
+        if(ReadBlock(file_,filter_handle_,&contents) != OK){
+            return nullptr;
+        }
+        TableFilter* filter = new TableFilter;
+        filter->charge = contents.data.size();
+        switch(filter_layout_){
+            case kOffsetFilter:
+                filter->contents = contents;
+                filter->offset_reader = new FilterBlockReader(options_.filter_policy,contents.data);
+                break;
+            case kFullFilter:
+                filter->contents = contents;
+                filter->full_reader = new FullFilterBlockReader(options_.filter_policy,contents.data);
+                break;
+            case kPartitionedFilter:
+                //分区索引交给Block管理，分区本身在查询时按需读取
+                filter->partitioned_reader = new PartitionedFilterBlockReader(contents);
+                filter->contents.cachable = contents.cachable;
+                break;
+        }
+        return filter;
+    }
+    //取得表的filter，没有filter时返回false。用完后调用ReleaseFilter
+    bool GetFilter(TableFilter** filter,Cache::Handle** handle){
+        *handle = nullptr;
+        if(filter_ != nullptr){
+            *filter = filter_;
+            return true;
+        }
+        if(!has_filter_){
+            return false;
+        }
+        Cache* cache = options_.block_cache;
+        char key_buf[kCacheKeySize];
+        slice key = CacheKey(cache_id_,filter_handle_,key_buf);
+        *handle = cache->Lookup(key);
+        if(*handle != nullptr){
+            *filter = reinterpret_cast<TableFilter*>(cache->Value(*handle));
+            return true;
+        }
+        //读取出错时本次当作没有filter，下次再重试
+        *filter = LoadFilter();
+        if(*filter == nullptr){
+            return false;
+        }
+        //直接指向mmap映射区的filter不占用堆内存，不放入缓存
+        if((*filter)->contents.cachable){
+            *handle = cache->Insert(key,*filter,(*filter)->charge,&DeleteCachedFilter,Cache::Priority::HIGH);
+        }
+        return true;
+    }
+    void ReleaseFilter(TableFilter* filter,Cache::Handle* handle){
+        if(handle != nullptr){
+            options_.block_cache->Release(handle);
+        }else if(filter != filter_){
+            delete filter;
+        }
+    }
+    //取得index block，用完后调用ReleaseBlock
+    Status GetIndexBlock(Block** block,Cache::Handle** handle){
+        if(index_block_ != nullptr){
+            *block = index_block_;
+            *handle = nullptr;
+            return OK;
+        }
+        return ReadBlockCached(index_handle_,Cache::Priority::HIGH,block,handle);
+    }
+    //读取handle处的block，依次查找block_cache、persistent_cache和文件，读出的block可缓存时放入block_cache。
+    //*cache_handle不为nullptr时block属于缓存。fill_cache为false时未命中读出的block不放入任何一层缓存。
+    //prefetch不为nullptr时从文件读取经过该预读缓冲区。用完后调用ReleaseBlock
+    Status ReadBlockCached(const BlockHandle& handle,Cache::Priority priority,Block** block,Cache::Handle** cache_handle,
+                           bool fill_cache = true,FilePrefetchBuffer* prefetch = nullptr){
+        if(LookupCachedBlock(handle,block,cache_handle)){
+            return OK;
+        }
+        BlockContents contents;
+        Status s = ReadBlockPersistentCached(handle,&contents,fill_cache,prefetch);
+        if(s != OK){
+            return s;
+        }
+        NewCachedBlock(handle,contents,priority,fill_cache,block,cache_handle);
+        return OK;
+    }
+    //在block_cache中查找handle处的block，找到时返回true
+    bool LookupCachedBlock(const BlockHandle& handle,Block** block,Cache::Handle** cache_handle){
+        *cache_handle = nullptr;
+        Cache* cache = options_.block_cache;
+        if(cache == nullptr){
+            return false;
+        }
+        char key_buf[kCacheKeySize];
+        *cache_handle = cache->Lookup(CacheKey(cache_id_,handle,key_buf));
+        if(*cache_handle == nullptr){
+            return false;
+        }
+        *block = reinterpret_cast<Block*>(cache->Value(*cache_handle));
+        return true;
+    }
+    //用读出的contents构造Block，可缓存时放入block_cache
+    void NewCachedBlock(const BlockHandle& handle,const BlockContents& contents,Cache::Priority priority,bool fill_cache,
+                        Block** block,Cache::Handle** cache_handle){
+        *cache_handle = nullptr;
+        *block = new Block(contents);
+        Cache* cache = options_.block_cache;
+        if(cache != nullptr && contents.cachable && fill_cache){
+            char key_buf[kCacheKeySize];
+            *cache_handle = cache->Insert(CacheKey(cache_id_,handle,key_buf),*block,contents.data.size(),
+                                          &DeleteCachedBlock,priority);
+        }
+    }
+    //读取handle处的block内容，设置了persistent_cache时先从中查找，未命中时从文件读取后写入
+    Status ReadBlockPersistentCached(const BlockHandle& handle,BlockContents* contents,bool fill_cache,
+                                     FilePrefetchBuffer* prefetch = nullptr){
+        PersistentCache* pcache = options_.persistent_cache;
+        if(pcache == nullptr){
+            return ReadBlock(file_,handle,contents,prefetch);
+        }
+        char key_buf[kCacheKeySize];
+        slice key = CacheKey(persistent_cache_id_,handle,key_buf);
+        std::unique_ptr<char[]> data;
+        size_t size;
+        if(pcache->Lookup(key,&data,&size) == OK){
+            contents->data = slice(data.release(),size);
+            contents->cachable = true;
+            contents->heap_allocated = true;
+            return OK;
+        }
+        Status s = ReadBlock(file_,handle,contents,prefetch);
+        if(s == OK && fill_cache){
+            pcache->Insert(key,contents->data);  //写入失败只是少了一次缓存
+        }
+        return s;
+    }
+    void ReleaseBlock(Block* block,Cache::Handle* cache_handle){
+        if(cache_handle != nullptr){
+            options_.block_cache->Release(cache_handle);
+        }else if(block != index_block_){
+            delete block;
+        }
+    }
+    static const size_t kCacheKeySize = 16;
+    //缓存的key：8字节的id加上8字节的block偏移
+    static slice CacheKey(uint64_t id,const BlockHandle& handle,char* buf){
+        coding::EncodeFixed64(buf,id);
+        coding::EncodeFixed64(buf + 8,handle.offset());
+        return slice(buf,kCacheKeySize);
+    }
+    //KeysMayMatch的实现，keys已经换成文件中实际存储的形式。
+    //定位data block和filter分区用internal key，filter中存放的是user key
+    void StoredKeysMayMatch(const slice* keys,int n,bool* results){
+        TableFilter* filter;
+        Cache::Handle* handle;
+        if(!props_.whole_key_filtering || !GetFilter(&filter,&handle)){
+            std::fill(results,results + n,true);
+            return;
+        }
+        std::vector<slice> user_keys(n);
+        for(int i = 0;i < n;i++){
+            user_keys[i] = ExtractUserKey(keys[i]);
+        }
+        if(filter->offset_reader != nullptr){
+            std::vector<uint64_t> offsets(n);
+            std::vector<slice> found_keys;
+            std::vector<int> found_index;
+            for(int i = 0;i < n;i++){
+                BlockHandle block_handle;
+                if(FindDataBlock(keys[i],&block_handle)){
+                    offsets[found_keys.size()] = block_handle.offset();
+                    found_keys.push_back(user_keys[i]);
+                    found_index.push_back(i);
+                }
+                results[i] = false;
+            }
+            std::unique_ptr<bool[]> found_results(new bool[found_keys.size()]);
+            filter->offset_reader->KeysMayMatch(offsets.data(),found_keys.data(),found_keys.size(),found_results.get());
+            for(size_t i = 0;i < found_keys.size();i++){
+                results[found_index[i]] = found_results[i];
+            }
+        }else if(filter->full_reader != nullptr){
+            filter->full_reader->KeysMayMatch(user_keys.data(),n,results);
+        }else{
+            PartitionedFilterBlockReader* reader = filter->partitioned_reader;
+            int i = 0;
+            while(i < n){
+                BlockHandle partition_handle;
+                if(!reader->FindPartition(keys[i],&partition_handle)){
+                    results[i++] = false;
+                    continue;
+                }
+                //同一分区中的相邻key只读取一次分区
+                int j = i + 1;
+                BlockHandle next;
+                while(j < n && reader->FindPartition(keys[j],&next) &&
+                      next.offset() == partition_handle.offset()){
+                    j++;
+                }
+                Block* partition;
+                Cache::Handle* partition_cache_handle;
+                if(ReadBlockCached(partition_handle,Cache::Priority::HIGH,&partition,&partition_cache_handle) != OK){
+                    std::fill(results + i,results + j,true);  //读取出错时当作可能存在
+                }else{
+                    FullFilterBlockReader(options_.filter_policy,partition->contents()).KeysMayMatch(user_keys.data() + i,j - i,results + i);
+                    ReleaseBlock(partition,partition_cache_handle);
+                }
+                i = j;
+            }
+        }
+        ReleaseFilter(filter,handle);
+    }
+    //把调用者看到的key（sequence为global_seqno_）换成文件中实际存储的key（sequence为0）。
+    //key的sequence不是global_seqno_时文件中不可能有这个key，返回false
+    bool ToStoredKey(const slice& key,std::string* stored) const{
+        stored->assign(key.data(),key.size());
+        if(global_seqno_ == 0){
+            return true;
+        }
+        if(stored->size() < 8){
+            return false;
+        }
+        const uint64_t tag = coding::DecodeFixed64(stored->data() + stored->size() - 8);
+        if((tag >> 8) != global_seqno_){
+            return false;
+        }
+        coding::EncodeFixed64(&(*stored)[stored->size() - 8],PackSequenceAndType(0,static_cast<ValueType>(tag & 0xff)));
+        return true;
+    }
+    //ToStoredKey的逆变换：把文件中的sequence 0换成global_seqno_
+    std::string ToVisibleKey(std::string key) const{
+        if(global_seqno_ != 0 && key.size() >= 8){
+            const uint64_t tag = coding::DecodeFixed64(key.data() + key.size() - 8);
+            coding::EncodeFixed64(&key[key.size() - 8],PackSequenceAndType(global_seqno_,static_cast<ValueType>(tag & 0xff)));
+        }
+        return key;
+    }
+    static void DeleteCachedBlock(const slice&,void* value){
+        delete reinterpret_cast<Block*>(value);
+    }
+    static void DeleteCachedFilter(const slice&,void* value){
+        delete reinterpret_cast<TableFilter*>(value);
+    }
+    //整表filter和分区filter的判断：用partition_key定位分区，在filter中查找filter_key。
+    //完整key的filter中两者分别是internal key和user key，前缀filter中都是前缀
+    bool FilterMayMatch(TableFilter* filter,const slice& partition_key,const slice& filter_key){
+        if(filter->full_reader != nullptr){
+            return filter->full_reader->KeyMayMatch(filter_key);
+        }
+        if(filter->partitioned_reader != nullptr){
+            BlockHandle handle;
+            if(!filter->partitioned_reader->FindPartition(partition_key,&handle)){
+                return false;
+            }
+            Block* partition;
+            Cache::Handle* cache_handle;
+            if(ReadBlockCached(handle,Cache::Priority::HIGH,&partition,&cache_handle) != OK){
+                return true;  //读取出错时当作可能存在
+            }
+            bool may_match = FullFilterBlockReader(options_.filter_policy,partition->contents()).KeyMayMatch(filter_key);
+            ReleaseBlock(partition,cache_handle);
+            return may_match;
+        }
+        return true;
+    }
+    //通过index_block找到可能包含key的data block，key大于表中所有key时返回false
+    bool FindDataBlock(const slice& key,BlockHandle* handle){
+        Block* index_block;
+        Cache::Handle* cache_handle;
+        if(GetIndexBlock(&index_block,&cache_handle) != OK){
+            return true;  //读取出错时交给后续读取data block报告错误
+        }
+        Iterator* iter = index_block->NewIterator();
+        iter->Seek(std::string(key.data(),key.size()));
+        bool found = false;
+        if(iter->Valid()){
+            std::string handle_value = iter->value();
+            slice input(handle_value.data(),handle_value.size());
+            found = (handle->DecodeFrom(&input) == OK);
+        }
+        delete iter;
+        ReleaseBlock(index_block,cache_handle);
+        return found;
+    }
+
+    Options options_;
+    RandomAccessFile* file_;
+    const uint64_t file_size_;
+    const SequenceNumber global_seqno_;  // 不为0时文件中的sequence 0读作global_seqno_
+    const uint64_t cache_id_;             // 在block cache中区分各个Table
+    const uint64_t persistent_cache_id_;  // 在persistent cache中区分各个sstable，已知文件编号时即为文件编号
+    const bool cache_meta_;    // index和filter放入block cache
+    const bool pin_meta_;      // cache_meta_时index和filter在Table存活期间常驻缓存
+    TableProperties props_;
+    BlockHandle index_handle_;
+    Block* index_block_;                 // Table持有或常驻缓存时不为nullptr
+    Cache::Handle* index_cache_handle_;  // index_block_常驻缓存时的句柄
+    bool has_filter_;
+    FilterLayout filter_layout_;
+    BlockHandle filter_handle_;
+    TableFilter* filter_;                 // Table持有或常驻缓存时不为nullptr
+    Cache::Handle* filter_cache_handle_;  // filter_常驻缓存时的句柄
+};
+
+//两层迭代器：外层遍历index_block，内层遍历当前data block，data block按需读取
+class TableIterator : public Iterator{
+public:
+    TableIterator(Table* table,const ReadOptions& read_options)
+        :table_(table),read_options_(read_options),index_block_(nullptr),index_cache_handle_(nullptr),index_iter_(nullptr),
+         data_block_(nullptr),data_cache_handle_(nullptr),data_iter_(nullptr),data_block_offset_(0),
+         prefetch_(table->file_size_,read_options.readahead_size,
+                   read_options.readahead_size > 0 && !read_options.fill_cache),
+         status_(OK){
+        //index block不常驻时，迭代器存活期间持有其缓存句柄
+        status_ = table->GetIndexBlock(&index_block_,&index_cache_handle_);
+        if(status_ == OK){
+            index_iter_ = index_block_->NewIterator();
+        }
+    }
+    ~TableIterator(){
+        SetDataBlock(nullptr,nullptr);
+        if(index_iter_ != nullptr){
+            delete index_iter_;
+            table_->ReleaseBlock(index_block_,index_cache_handle_);
+        }
+    }
+    bool Valid() const{
+        return data_iter_ != nullptr && data_iter_->Valid();
+    }
+    void SeekToFirst(){
+        if(index_iter_ == nullptr) return;
+        index_iter_->SeekToFirst();
+        InitDataBlock();
+        if(data_iter_ != nullptr) data_iter_->SeekToFirst();
+        SkipEmptyDataBlocksForward();
+    }
+    void SeekToLast(){
+        if(index_iter_ == nullptr) return;
+        index_iter_->SeekToLast();
+        InitDataBlock();
+        if(data_iter_ != nullptr) data_iter_->SeekToLast();
+        SkipEmptyDataBlocksBackward();
+    }
+    void Seek(const string& target){
+        if(index_iter_ == nullptr) return;
+        if(table_->global_seqno_ != 0 && target.size() >= 8){
+            //文件中存储的sequence是0，先定位到user key，再跳过读作global_seqno_后仍小于target的key
+            const string user_key = target.substr(0,target.size() - 8);
+            index_iter_->Seek(user_key);
+            InitDataBlock();
+            if(data_iter_ != nullptr) data_iter_->Seek(user_key);
+            SkipEmptyDataBlocksForward();
+            while(Valid() && key() < target){
+                Next();
+            }
+            return;
+        }
+        index_iter_->Seek(target);
+        InitDataBlock();
+        if(data_iter_ != nullptr) data_iter_->Seek(target);
+        SkipEmptyDataBlocksForward();
+    }
+    void Next(){
+        assert(Valid());
+        data_iter_->Next();
+        SkipEmptyDataBlocksForward();
+    }
+    void Prev(){
+        assert(Valid());
+        data_iter_->Prev();
+        SkipEmptyDataBlocksBackward();
+    }
+    string key() const{
+        return table_->ToVisibleKey(data_iter_->key());
+    }
+    string value() const{
+        return data_iter_->value();
+    }
+    string status() const{
+        return status_ == OK ? string() : string("IO error or corruption in data block");
+    }
+private:
+    void SkipEmptyDataBlocksForward(){
+        while(data_iter_ == nullptr || !data_iter_->Valid()){
+            if(!index_iter_->Valid()){
+                SetDataBlock(nullptr,nullptr);
+                return;
+            }
+            index_iter_->Next();
+            InitDataBlock();
+            if(data_iter_ != nullptr) data_iter_->SeekToFirst();
+        }
+    }
+    void SkipEmptyDataBlocksBackward(){
+        while(data_iter_ == nullptr || !data_iter_->Valid()){
+            if(!index_iter_->Valid()){
+                SetDataBlock(nullptr,nullptr);
+                return;
+            }
+            index_iter_->Prev();
+            InitDataBlock();
+            if(data_iter_ != nullptr) data_iter_->SeekToLast();
+        }
+    }
+    void SetDataBlock(Block* block,Cache::Handle* cache_handle){
+        delete data_iter_;
+        if(data_block_ != nullptr){
+            table_->ReleaseBlock(data_block_,data_cache_handle_);
+        }
+        data_block_ = block;
+        data_cache_handle_ = cache_handle;
+        data_iter_ = (block == nullptr) ? nullptr : block->NewIterator();
+    }
+    //读取index_iter_当前指向的data block，已经是当前block时不重复读取
+    void InitDataBlock(){
+        if(!index_iter_->Valid()){
+            SetDataBlock(nullptr,nullptr);
+            return;
+        }
+        std::string handle_value = index_iter_->value();
+        slice input(handle_value.data(),handle_value.size());
+        BlockHandle handle;
+        if(handle.DecodeFrom(&input) != OK){
+            status_ = Corruption;
+            SetDataBlock(nullptr,nullptr);
+            return;
+        }
+        if(data_block_ != nullptr && handle.offset() == data_block_offset_){
+            return;
+        }
+        Block* block;
+        Cache::Handle* cache_handle;
+        Status s = table_->ReadBlockCached(handle,Cache::Priority::LOW,&block,&cache_handle,read_options_.fill_cache,
+                                           &prefetch_);
+        if(s != OK){
+            status_ = s;
+            SetDataBlock(nullptr,nullptr);
+            return;
+        }
+        SetDataBlock(block,cache_handle);
+        data_block_offset_ = handle.offset();
+    }
+
+    Table* table_;
+    const ReadOptions read_options_;
+    Block* index_block_;
+    Cache::Handle* index_cache_handle_;
+    Iterator* index_iter_;  // 读取index block出错时为nullptr
+    Block* data_block_;
+    Cache::Handle* data_cache_handle_;
+    Iterator* data_iter_;
+    uint64_t data_block_offset_;  // data_block_在文件中的偏移
+    FilePrefetchBuffer prefetch_;  // 缓存未命中时读取data block的预读缓冲区
+    Status status_;
+};
+
+//在内部迭代器上限定user key的前缀，遇到第一个不以prefix开头的key即失效
+class PrefixIterator : public Iterator{
+public:
+    //iter为nullptr表示filter已经排除了该前缀，迭代器始终无效
+    PrefixIterator(Iterator* iter,const slice& prefix)
+        :iter_(iter),prefix_(prefix.data(),prefix.size()){}
+    ~PrefixIterator(){
+        delete iter_;
+    }
+    bool Valid() const{
+        if(iter_ == nullptr || !iter_->Valid()){
+            return false;
+        }
+        std::string key = iter_->key();
+        //key是internal key，需要去掉8字节tag后再比较前缀
+        size_t user_key_size = key.size() >= 8 ? key.size() - 8 : key.size();
+        return user_key_size >= prefix_.size() && key.compare(0,prefix_.size(),prefix_) == 0;
+    }
+    void SeekToFirst(){
+        if(iter_ != nullptr) iter_->Seek(prefix_);
+    }
+    void SeekToLast(){
+        if(iter_ == nullptr) return;
+        //找到第一个大于所有该前缀key的位置再退一步
+        std::string limit = prefix_;
+        while(!limit.empty() && static_cast<unsigned char>(limit.back()) == 0xff){
+            limit.pop_back();
+        }
+        if(limit.empty()){
+            iter_->SeekToLast();
+            return;
+        }
+        limit.back()++;
+        iter_->Seek(limit);
+        if(iter_->Valid()){
+            iter_->Prev();
+        }else{
+            iter_->SeekToLast();
+        }
+    }
+    void Seek(const string& target){
+        if(iter_ == nullptr) return;
+        iter_->Seek(target < prefix_ ? prefix_ : target);
+    }
+    void Next(){
+        iter_->Next();
+    }
+    void Prev(){
+        iter_->Prev();
+    }
+    string key() const{
+        return iter_->key();
+    }
+    string value() const{
+        return iter_->value();
+    }
+    string status() const{
+        return iter_ == nullptr ? string() : iter_->status();
+    }
+private:
+    Iterator* iter_;
+    std::string prefix_;
+};
+
+inline Iterator* Table::NewIterator(const ReadOptions& read_options){
+    return new TableIterator(this,read_options);
+}
+
+inline Iterator* Table::NewPrefixIterator(const slice& prefix){
+    if(!PrefixMayMatch(prefix)){
+        return new PrefixIterator(nullptr,prefix);
+    }
+    PrefixIterator* iter = new PrefixIterator(NewIterator(),prefix);
+    iter->SeekToFirst();
+    return iter;
+}
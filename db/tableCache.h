@@ -1,10 +1,22 @@
+#pragma once
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <chrono>
+#include <mutex>
+#include <vector>
 #include "env.h"
 #include "coding.h"
+#include "hash64.h"
+#include "cache.h"
+#include "filename.h"
+#include "table.h"
+#include "versionEdit.h"
 // LRU缓存实现
 
+inline uint32_t Hash(const char* data, size_t n, uint32_t seed);
+
 struct LRUHandle {
   void* value;
   void (*deleter)(const slice&, void* value);
@@ -14,6 +26,7 @@ struct LRUHandle {
   size_t charge;  // TODO(opt): 是否只允许使用uint32_t？
   size_t key_length;
   bool in_cache;     // 条目是否在缓存中。
+  bool high_pri;     // 是否属于高优先级池
   uint32_t refs;     // 引用计数，包括缓存引用（如果存在）。
   uint32_t hash;     // 键的哈希值；用于快速分片和比较
   char key_data[1];  // 键的起始部分
@@ -27,106 +40,295 @@ struct LRUHandle {
   }
 };
 
+// 链式哈希表，桶数为2的幂，平均链长不超过1。
+// 扩容是渐进式的：扩容时新旧两个桶数组同时存在，之后每次操作只把旧数组中的
+// kMigrateBucketsPerOp个桶迁移到新数组，单次操作的耗时不会随元素总数增长。
+// 桶数每次翻倍，迁移完成前元素数不会再翻倍，因此同一时刻最多只有一次扩容在进行
 class HandleTable {
  public:
-  HandleTable() : length_(0), elems_(0), list_(nullptr) { Resize(); }
-  ~HandleTable() { delete[] list_; }
+  HandleTable()
+      : length_(0), elems_(0), list_(nullptr),
+        old_length_(0), old_list_(nullptr), migrate_index_(0) {
+    Rehash(4);
+  }
+  ~HandleTable() {
+    free(list_);
+    free(old_list_);
+  }
 
   LRUHandle* Lookup(const slice& key, uint32_t hash) {
-    return FindPointer(key, hash)->next_hash;
+    MigrateSome();
+    return *FindPointer(key, hash);
   }
 
   LRUHandle* Insert(LRUHandle* h) {
-    LRUHandle* pre = FindPointer(h->key(), h->hash);
-    LRUHandle* old = pre->next_hash;
+    MigrateSome();
+    LRUHandle** ptr = FindPointer(h->key(), h->hash);
+    LRUHandle* old = *ptr;
     h->next_hash = (old == nullptr ? nullptr : old->next_hash);
-    pre->next_hash = h;
+    *ptr = h;
     if (old == nullptr) {
       ++elems_;
-      if (elems_ > length_) {
+      if (elems_ > length_ && old_list_ == nullptr) {
         // 由于每个缓存条目相对较大，我们的目标是保持较小的平均链表长度（<= 1）。
-        Resize();
+        StartGrow();
       }
     }
     return old;
   }
 
   LRUHandle* Remove(const slice& key, uint32_t hash) {
-    LRUHandle* pre = FindPointer(key, hash);
-    LRUHandle* result = pre->next_hash;
-    if(result == nullptr){
-      return pre->next_hash;
+    MigrateSome();
+    LRUHandle** ptr = FindPointer(key, hash);
+    LRUHandle* result = *ptr;
+    if (result != nullptr) {
+      *ptr = result->next_hash;
+      --elems_;
     }
-    pre->next_hash = result->next_hash;
-    --elems_;
     return result;
   }
 
+  // 按预计的元素数预先分配桶，避免缓存填满过程中的多次扩容。
+  // 会一次性重新散列已有的元素，应在缓存开始使用前调用。
+  // 桶数不超过kMaxReserveLength，更多的元素仍可插入，之后按需扩容
+  void Reserve(size_t expected_elems) {
+    FinishMigration();
+    const size_t target = std::min<size_t>(expected_elems, kMaxReserveLength);
+    uint32_t new_length = length_;
+    while (new_length < target) {
+      new_length *= 2;
+    }
+    if (new_length > length_) {
+      Rehash(new_length);
+    }
+  }
+
  private:
+  static const uint32_t kMigrateBucketsPerOp = 4;
+  static const uint32_t kMaxReserveLength = 1u << 30;
+
   uint32_t length_;
   uint32_t elems_;
   LRUHandle** list_;
+  // 扩容进行中时为旧的桶数组，[0, migrate_index_)中的桶已经迁移完，为空
+  uint32_t old_length_;
+  LRUHandle** old_list_;
+  uint32_t migrate_index_;
+
+  // 返回指向匹配key/hash的槽位的指针；没有匹配的条目时，
+  // 返回指向对应链表末尾nullptr的指针，Insert和Remove可直接修改它。
+  // 所在的旧桶尚未迁移时在旧桶中查找，新元素也插入旧桶，随旧桶一起迁移
+  LRUHandle** FindPointer(const slice& key, uint32_t hash) {
+    LRUHandle** ptr;
+    if (old_list_ != nullptr && (hash & (old_length_ - 1)) >= migrate_index_) {
+      ptr = &old_list_[hash & (old_length_ - 1)];
+    } else {
+      ptr = &list_[hash & (length_ - 1)];
+    }
+    while (*ptr != nullptr && ((*ptr)->hash != hash || key != (*ptr)->key())) {
+      ptr = &(*ptr)->next_hash;
+    }
+    return ptr;
+  }
+
+  // 大数组由calloc直接从操作系统取得已清零的页，不需要在扩容时memset整个数组
+  static LRUHandle** NewBuckets(uint32_t length) {
+    return static_cast<LRUHandle**>(calloc(length, sizeof(LRUHandle*)));
+  }
 
+  // 保留当前桶数组作为旧数组，分配两倍大小的新数组，之后逐步迁移
+  void StartGrow() {
+    old_list_ = list_;
+    old_length_ = length_;
+    migrate_index_ = 0;
+    length_ = old_length_ * 2;
+    list_ = NewBuckets(length_);
+  }
 
-  // 此处有个细节需要注意：返回的ptr是节点里的next指针的指针
-  LRUHandle* FindPointer(const slice& key, uint32_t hash) {
-    LRUHandle** ptr = &list_[hash & (length_ - 1)];
-    LRUHandle *start = *ptr;
-    while(start->next_hash != nullptr && 
-      (start->next_hash->hash != hash || key != (start->next_hash)->key())){
-      start = start->next_hash;
+  void MigrateBucket(uint32_t i) {
+    LRUHandle* h = old_list_[i];
+    while (h != nullptr) {
+      LRUHandle* next = h->next_hash;
+      LRUHandle** ptr = &list_[h->hash & (length_ - 1)];
+      h->next_hash = *ptr;
+      *ptr = h;
+      h = next;
     }
-    return start;
+    old_list_[i] = nullptr;
   }
 
-  void Resize() {
-    uint32_t new_length = 4;
-    while (new_length < elems_) {
-      new_length *= 2;
+  void MigrateSome(uint32_t n = kMigrateBucketsPerOp) {
+    if (old_list_ == nullptr) {
+      return;
+    }
+    for (; n > 0 && migrate_index_ < old_length_; n--) {
+      MigrateBucket(migrate_index_++);
     }
-    LRUHandle** new_list = new LRUHandle*[new_length];
-    memset(new_list, 0, sizeof(new_list[0]) * new_length);
+    if (migrate_index_ == old_length_) {
+      free(old_list_);
+      old_list_ = nullptr;
+      old_length_ = 0;
+    }
+  }
+
+  void FinishMigration() {
+    if (old_list_ != nullptr) {
+      MigrateSome(old_length_);
+    }
+  }
+
+  // 一次性把所有元素散列到new_length个桶中。REQUIRES: 没有进行中的扩容
+  void Rehash(uint32_t new_length) {
+    assert(old_list_ == nullptr);
+    LRUHandle** new_list = NewBuckets(new_length);
     uint32_t count = 0;
     for (uint32_t i = 0; i < length_; i++) {
       LRUHandle* h = list_[i];
-      while (h->next_hash!= nullptr) {
-        LRUHandle* node = h->next_hash;
-        h->next_hash = node->next_hash;
-        uint32_t hash = node->hash;
-        LRUHandle* ptr = new_list[hash & (new_length - 1)];
-        node->next_hash = ptr->next;
-        ptr->next_hash = node;
+      while (h != nullptr) {
+        LRUHandle* next = h->next_hash;
+        LRUHandle** ptr = &new_list[h->hash & (new_length - 1)];
+        h->next_hash = *ptr;
+        *ptr = h;
+        h = next;
         count++;
       }
     }
     assert(elems_ == count);
-    delete[] list_;
+    free(list_);
     list_ = new_list;
     length_ = new_length;
   }
 };
 
+// TinyLFU准入策略使用的访问频率估计，count-min sketch的变体。
+// 每个计数器4位，16个计数器打包在一个uint64_t中；一个key对应4个计数器（各取hash的不同位），
+// 估计值取其中的最小值。累计的访问次数达到计数器数量的10倍时所有计数器减半，
+// 使估计值反映最近的访问频率，过去的热点会逐渐冷却
+class FrequencySketch {
+ public:
+  FrequencySketch() : mask_(0), additions_(0), sample_size_(0) {}
+
+  // 按预计的条目数设置计数器数量，并清空所有计数
+  void SetCapacity(size_t entries) {
+    size_t counters = 1024;
+    while (counters < entries) {
+      counters *= 2;
+    }
+    table_.assign(counters / 16, 0);
+    mask_ = table_.size() - 1;
+    additions_ = 0;
+    sample_size_ = counters * 10;
+  }
+
+  void Increment(uint32_t hash) {
+    if (table_.empty()) {
+      return;
+    }
+    bool added = false;
+    for (int i = 0; i < 4; i++) {
+      added |= IncrementAt(Index(hash, i), Offset(hash, i));
+    }
+    if (added && ++additions_ >= sample_size_) {
+      Reset();
+    }
+  }
+
+  int Estimate(uint32_t hash) const {
+    if (table_.empty()) {
+      return 0;
+    }
+    int frequency = 15;
+    for (int i = 0; i < 4; i++) {
+      const int count = static_cast<int>((table_[Index(hash, i)] >> Offset(hash, i)) & 0xf);
+      frequency = std::min(frequency, count);
+    }
+    return frequency;
+  }
+
+ private:
+  // 第i个计数器所在的字：每一行用不同的种子重新混合hash
+  size_t Index(uint32_t hash, int i) const {
+    static const uint64_t kSeeds[4] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                       0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+    uint64_t h = (hash + kSeeds[i]) * kSeeds[i];
+    h += h >> 32;
+    return static_cast<size_t>(h) & mask_;
+  }
+  // 第i个计数器在字中的位偏移，4行分别使用字中不同的四分之一
+  static int Offset(uint32_t hash, int i) {
+    return ((hash >> (i * 8)) & 3) * 4 + i * 16;
+  }
+  bool IncrementAt(size_t index, int offset) {
+    const uint64_t mask = uint64_t{0xf} << offset;
+    if ((table_[index] & mask) != mask) {
+      table_[index] += uint64_t{1} << offset;
+      return true;
+    }
+    return false;
+  }
+  // 所有计数器减半
+  void Reset() {
+    for (uint64_t& word : table_) {
+      word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    additions_ /= 2;
+  }
+
+  std::vector<uint64_t> table_;
+  size_t mask_;
+  size_t additions_;
+  size_t sample_size_;
+};
+
+// 单个分片的锁统计，用于观察分片间的竞争情况
+struct CacheShardStats {
+  uint64_t lock_acquisitions = 0;  // 加锁次数
+  uint64_t lock_contentions = 0;   // 加锁时锁已被占用的次数
+  uint64_t lock_wait_nanos = 0;    // 等待锁的总时间
+};
+
 // 单个分片的LRU缓存。
-class LRUCache {
+// 按cache line对齐，使相邻分片的锁和统计不会落在同一个cache line上（避免伪共享）
+class alignas(64) LRUCache {
  public:
   LRUCache();
   ~LRUCache();
 
   // 与构造函数分开，以便调用者可以轻松创建LRUCache数组
   void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  // 高优先级池的容量，高优先级条目的总charge不超过它时，只淘汰低优先级条目。
+  // 为0时不区分优先级，所有条目按同一个LRU顺序淘汰
+  void SetHighPriorityPoolCapacity(size_t capacity) { high_pri_capacity_ = capacity; }
+  // 打开TinyLFU准入策略：缓存已满时，新的低优先级条目只有在估计的访问频率高于
+  // 将被淘汰的条目时才放入缓存，否则Insert返回的句柄不进入缓存。
+  // 访问频率由Lookup记录（包括未命中的Lookup），sketch按capacity/estimated_charge个条目设置大小
+  void EnableAdmissionPolicy(size_t estimated_charge) {
+    admission_ = true;
+    sketch_.SetCapacity(capacity_ / std::max<size_t>(estimated_charge, 1));
+  }
 
   // 类似于Cache方法，但带有额外的“hash”参数。
   LRUHandle* Insert(const slice& key, uint32_t hash, void* value,
                         size_t charge,
-                        void (*deleter)(const slice& key, void* value));
+                        void (*deleter)(const slice& key, void* value),
+                        bool high_pri = false);
   LRUHandle* Lookup(const slice& key, uint32_t hash);
   void Release(LRUHandle* handle);
   void Erase(const slice& key, uint32_t hash);
   void Prune();// 清理未被引用的条目：
+  // 按预计的条目数预先分配哈希表
+  void Reserve(size_t expected_entries) {
+    std::unique_lock<std::mutex> l = Lock();
+    table_.Reserve(expected_entries);
+  }
   size_t TotalCharge() const {
-    // MutexLock l(&mutex_);
+    std::unique_lock<std::mutex> l = Lock();
     return usage_;
   }
+  CacheShardStats GetStats() const {
+    std::lock_guard<std::mutex> l(mutex_);
+    return stats_;
+  }
 
  private:
   void LRU_Remove(LRUHandle* e);
@@ -135,14 +337,43 @@ class LRUCache {
   void Unref(LRUHandle* e);
   bool FinishErase(LRUHandle* e) ;
   // EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // 下一个要淘汰的条目，所有条目都在使用中时返回nullptr
+  LRUHandle* NextVictim();
+  // EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // 准入策略是否拒绝新条目e
+  bool RejectByAdmission(const LRUHandle* e);
+  // EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // 淘汰未被引用的条目直到usage_不超过capacity_
+  void EvictIfNeeded();
+  // EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // 加锁并记录统计：先try_lock，只有锁被占用时才计时，无竞争时几乎没有额外开销
+  std::unique_lock<std::mutex> Lock() const {
+    std::unique_lock<std::mutex> l(mutex_, std::try_to_lock);
+    if (!l.owns_lock()) {
+      const auto start = std::chrono::steady_clock::now();
+      l.lock();
+      stats_.lock_contentions++;
+      stats_.lock_wait_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+    stats_.lock_acquisitions++;
+    return l;
+  }
 
   // 在使用前初始化。
   size_t capacity_;
+  size_t high_pri_capacity_;
+  bool admission_;
 
   // mutex_ 保护以下状态。
-  // mutable port::Mutex mutex_;
+  mutable std::mutex mutex_;
+  mutable CacheShardStats stats_;
+  //GUARDED_BY(mutex_);
   size_t usage_ ;
   //GUARDED_BY(mutex_);
+  size_t high_pri_usage_;  // 缓存中高优先级条目的charge之和
+  //GUARDED_BY(mutex_);
 
   // LRU链表的虚拟头节点。
   // lru.prev是最新的条目，lru.next是最旧的条目。
@@ -150,6 +381,10 @@ class LRUCache {
   LRUHandle lru_ ;
   // GUARDED_BY(mutex_);
 
+  // 高优先级条目的LRU链表，结构与lru_相同
+  LRUHandle lru_high_;
+  // GUARDED_BY(mutex_);
+
   // 使用中的链表的虚拟头节点。
   // 条目正在被客户端使用，具有refs >= 2且in_cache==true。
   LRUHandle in_use_;
@@ -157,29 +392,37 @@ class LRUCache {
 
   HandleTable table_;
   //  GUARDED_BY(mutex_);
+
+  FrequencySketch sketch_;
+  //  GUARDED_BY(mutex_);
 };
 
-LRUCache::LRUCache() : capacity_(0), usage_(0) {
+inline LRUCache::LRUCache()
+    : capacity_(0), high_pri_capacity_(0), admission_(false), usage_(0), high_pri_usage_(0) {
   // 创建空的循环链表。
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  lru_high_.next = &lru_high_;
+  lru_high_.prev = &lru_high_;
   in_use_.next = &in_use_;
   in_use_.prev = &in_use_;
 }
 
-LRUCache::~LRUCache() {
+inline LRUCache::~LRUCache() {
   assert(in_use_.next == &in_use_);  // 如果调用者有未释放的句柄，则报错
-  for (LRUHandle* e = lru_.next; e != &lru_;) {
-    LRUHandle* next = e->next;
-    assert(e->in_cache);
-    e->in_cache = false;
-    assert(e->refs == 1);  // lru_链表的不变量。
-    Unref(e);
-    e = next;
+  for (LRUHandle* list : {&lru_, &lru_high_}) {
+    for (LRUHandle* e = list->next; e != list;) {
+      LRUHandle* next = e->next;
+      assert(e->in_cache);
+      e->in_cache = false;
+      assert(e->refs == 1);  // lru_链表的不变量。
+      Unref(e);
+      e = next;
+    }
   }
 }
 
-void LRUCache::Ref(LRUHandle* e) {
+inline void LRUCache::Ref(LRUHandle* e) {
   if (e->refs == 1 && e->in_cache) {  // 如果在lru_链表中，则移动到in_use_链表。
     LRU_Remove(e);
     LRU_Append(&in_use_, e);
@@ -187,7 +430,7 @@ void LRUCache::Ref(LRUHandle* e) {
   e->refs++;
 }
 
-void LRUCache::Unref(LRUHandle* e) {
+inline void LRUCache::Unref(LRUHandle* e) {
   assert(e->refs > 0);
   e->refs--;
   if (e->refs == 0) {  // 释放。
@@ -195,18 +438,19 @@ void LRUCache::Unref(LRUHandle* e) {
     (*e->deleter)(e->key(), e->value);
     free(e);
   } else if (e->in_cache && e->refs == 1) {
-    // 不再使用；移动到lru_链表。
+    // 不再使用；移动到lru_（或lru_high_）链表。
+    // 没有高优先级池时高优先级条目与普通条目一起按LRU顺序淘汰
     LRU_Remove(e);
-    LRU_Append(&lru_, e);
+    LRU_Append(e->high_pri && high_pri_capacity_ > 0 ? &lru_high_ : &lru_, e);
   }
 }
 
-void LRUCache::LRU_Remove(LRUHandle* e) {
+inline void LRUCache::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
 }
 
-void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
+inline void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
   // 通过插入到*list之前，使“e”成为最新的条目
   e->next = list;
   e->prev = list->prev;
@@ -214,8 +458,11 @@ void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
   e->next->prev = e;
 }
 
-LRUHandle* LRUCache::Lookup(const slice& key, uint32_t hash) {
-  // MutexLock l(&mutex_);
+inline LRUHandle* LRUCache::Lookup(const slice& key, uint32_t hash) {
+  std::unique_lock<std::mutex> l = Lock();
+  if (admission_) {
+    sketch_.Increment(hash);
+  }
   LRUHandle* e = table_.Lookup(key, hash);
   if (e != nullptr) {
     Ref(e);
@@ -223,16 +470,17 @@ LRUHandle* LRUCache::Lookup(const slice& key, uint32_t hash) {
   return e;
 }
 
-void LRUCache::Release(LRUHandle* handle) {
-  // MutexLock l(&mutex_);
+inline void LRUCache::Release(LRUHandle* handle) {
+  std::unique_lock<std::mutex> l = Lock();
   Unref(reinterpret_cast<LRUHandle*>(handle));
 }
 
-LRUHandle* LRUCache::Insert(const slice& key, uint32_t hash, void* value,
+inline LRUHandle* LRUCache::Insert(const slice& key, uint32_t hash, void* value,
                                 size_t charge,
                                 void (*deleter)(const slice& key,
-                                                void* value)) {
-  // MutexLock l(&mutex_);
+                                                void* value),
+                                bool high_pri) {
+  std::unique_lock<std::mutex> l = Lock();
 
   LRUHandle* e =
       reinterpret_cast<LRUHandle*>(malloc(sizeof(LRUHandle) - 1 + key.size()));
@@ -242,126 +490,213 @@ LRUHandle* LRUCache::Insert(const slice& key, uint32_t hash, void* value,
   e->key_length = key.size();
   e->hash = hash;
   e->in_cache = false;
+  e->high_pri = high_pri;
   e->refs = 1;  // 用于返回的句柄。
   memcpy(e->key_data, key.data(), key.size());
+  // next由key()中的断言读取（准入判断就会调用key()），因此必须先初始化
+  e->next = nullptr;
 
-  if (capacity_ > 0) {
+  if (capacity_ > 0 && !RejectByAdmission(e)) {
     e->refs++;  // 用于缓存的引用。
     e->in_cache = true;
     LRU_Append(&in_use_, e);
     usage_ += charge;
+    if (high_pri) {
+      high_pri_usage_ += charge;
+    }
     FinishErase(table_.Insert(e));
-  } else {  // 不缓存。（支持capacity_==0并关闭缓存。）
-    // next由key()中的断言读取，因此必须初始化
-    e->next = nullptr;
+  }  // 否则不缓存。（支持capacity_==0并关闭缓存，或准入策略拒绝。）
+  EvictIfNeeded();
+
+  return reinterpret_cast<LRUHandle*>(e);
+}
+
+inline LRUHandle* LRUCache::NextVictim() {
+  // 高优先级池未超出容量时，只要还有低优先级条目就先淘汰它们
+  if (lru_high_.next != &lru_high_ &&
+      (high_pri_usage_ > high_pri_capacity_ || lru_.next == &lru_)) {
+    return lru_high_.next;
   }
-  while (usage_ > capacity_ && lru_.next != &lru_) {
-    LRUHandle* old = lru_.next;
+  if (lru_.next != &lru_) {
+    return lru_.next;
+  }
+  return nullptr;
+}
+
+inline bool LRUCache::RejectByAdmission(const LRUHandle* e) {
+  // 高优先级条目、缓存未满和替换已有key的插入总是接受
+  if (!admission_ || e->high_pri || usage_ + e->charge <= capacity_ ||
+      table_.Lookup(e->key(), e->hash) != nullptr) {
+    return false;
+  }
+  LRUHandle* victim = NextVictim();
+  return victim != nullptr && sketch_.Estimate(e->hash) <= sketch_.Estimate(victim->hash);
+}
+
+inline void LRUCache::EvictIfNeeded() {
+  while (usage_ > capacity_) {
+    LRUHandle* old = NextVictim();
+    if (old == nullptr) {
+      break;  // 所有条目都在使用中
+    }
     assert(old->refs == 1);
     bool erased = FinishErase(table_.Remove(old->key(), old->hash));
     if (!erased) {  // 避免在编译NDEBUG时未使用变量
       assert(erased);
     }
   }
-
-  return reinterpret_cast<LRUHandle*>(e);
 }
 
 // 如果e != nullptr，完成从缓存中移除*e的操作；它已经从哈希表中移除。
 // 返回e是否不为nullptr。
-bool LRUCache::FinishErase(LRUHandle* e) {
+inline bool LRUCache::FinishErase(LRUHandle* e) {
   if (e != nullptr) {
     assert(e->in_cache);
     LRU_Remove(e);
     e->in_cache = false;
     usage_ -= e->charge;
+    if (e->high_pri) {
+      high_pri_usage_ -= e->charge;
+    }
     Unref(e);
   }
   return e != nullptr;
 }
 
-void LRUCache::Erase(const slice& key, uint32_t hash) {
-  // MutexLock l(&mutex_);
+inline void LRUCache::Erase(const slice& key, uint32_t hash) {
+  std::unique_lock<std::mutex> l = Lock();
   FinishErase(table_.Remove(key, hash));
 }
 
-void LRUCache::Prune() {
-  // MutexLock l(&mutex_);
-  while (lru_.next != &lru_) {
-    LRUHandle* e = lru_.next;
-    assert(e->refs == 1);
-    bool erased = FinishErase(table_.Remove(e->key(), e->hash));
-    if (!erased) {  // 避免在编译NDEBUG时未使用变量
-      assert(erased);
+inline void LRUCache::Prune() {
+  std::unique_lock<std::mutex> l = Lock();
+  for (LRUHandle* list : {&lru_, &lru_high_}) {
+    while (list->next != list) {
+      LRUHandle* e = list->next;
+      assert(e->refs == 1);
+      bool erased = FinishErase(table_.Remove(e->key(), e->hash));
+      if (!erased) {  // 避免在编译NDEBUG时未使用变量
+        assert(erased);
+      }
     }
   }
 }
 
 static const int kNumShardBits = 4;
 static const int kNumShards = 1 << kNumShardBits;
-
-class ShardedLRUCache {
+// 默认为高优先级条目预留的容量比例
+static const double kDefaultHighPriPoolRatio = 0.5;
+
+// 分片的LRU缓存，各分片有各自的锁，可以被多个线程同时使用。
+// 分片数在构造时指定（2^num_shard_bits），读多、线程多时应增大分片数以减少锁竞争。
+// high_pri_pool_ratio为容量中预留给高优先级条目的比例：高优先级条目总量不超过它时只淘汰普通条目；
+// 为0表示不预留，高优先级条目与普通条目一起按LRU淘汰，而不是被优先淘汰。
+// admission_estimated_charge不为0时打开TinyLFU准入策略（见LRUCache::EnableAdmissionPolicy），
+// 其值为条目的平均charge（例如block大小），用于确定频率sketch的大小
+class ShardedLRUCache : public Cache {
  private:
-  LRUCache shard_[kNumShards];
-  // port::Mutex id_mutex_;
+  const int num_shard_bits_;
+  LRUCache* shard_;
+  std::mutex id_mutex_;
   uint64_t last_id_;
 
+  // 取Hash64的高32位：最高几位决定分片，低位用于分片内的哈希表
   static inline uint32_t HashSlice(const slice& s) {
-    return Hash(s.data_, s.size(), 0);
+    return static_cast<uint32_t>(Hash64(s.data_, s.size(), 0) >> 32);
   }
 
-  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  uint32_t Shard(uint32_t hash) const {
+    return num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0;
+  }
 
  public:
-  explicit ShardedLRUCache(size_t capacity) : last_id_(0) {
-    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
-    for (int s = 0; s < kNumShards; s++) {
+  explicit ShardedLRUCache(size_t capacity, int num_shard_bits = kNumShardBits,
+                           double high_pri_pool_ratio = kDefaultHighPriPoolRatio,
+                           size_t admission_estimated_charge = 0)
+      : num_shard_bits_(num_shard_bits),
+        shard_(new LRUCache[1 << num_shard_bits]),
+        last_id_(0) {
+    assert(num_shard_bits >= 0 && num_shard_bits < 20);
+    const int num_shards = NumShards();
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    for (int s = 0; s < num_shards; s++) {
       shard_[s].SetCapacity(per_shard);
+      shard_[s].SetHighPriorityPoolCapacity(
+          static_cast<size_t>(per_shard * high_pri_pool_ratio));
+      if (admission_estimated_charge > 0) {
+        shard_[s].EnableAdmissionPolicy(admission_estimated_charge);
+      }
     }
   }
-  ~ShardedLRUCache(){}
-  LRUHandle* Insert(const slice& key, void* value, size_t charge,
-                 void (*deleter)(const slice& key, void* value))  {
+  ShardedLRUCache(const ShardedLRUCache&) = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+  ~ShardedLRUCache() override { delete[] shard_; }
+  int NumShards() const { return 1 << num_shard_bits_; }
+  Handle* Insert(const slice& key, void* value, size_t charge,
+                 void (*deleter)(const slice& key, void* value),
+                 Priority priority = Priority::LOW) override {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return reinterpret_cast<Handle*>(shard_[Shard(hash)].Insert(
+        key, hash, value, charge, deleter, priority == Priority::HIGH));
   }
-  LRUHandle* Lookup(const slice& key) {
+  Handle* Lookup(const slice& key) override {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Lookup(key, hash);
+    return reinterpret_cast<Handle*>(shard_[Shard(hash)].Lookup(key, hash));
   }
-  void Release(LRUHandle* handle) {
-    LRUHandle* h = (handle);
-    shard_[Shard(h->hash)].Release(handle);
+  void Release(Handle* handle) override {
+    LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
+    shard_[Shard(h->hash)].Release(h);
   }
-  void Erase(const slice& key) {
+  void Erase(const slice& key) override {
     const uint32_t hash = HashSlice(key);
     shard_[Shard(hash)].Erase(key, hash);
   }
-  void* Value(LRUHandle* handle) {
-    return (handle)->value;
+  void* Value(Handle* handle) override {
+    return reinterpret_cast<LRUHandle*>(handle)->value;
   }
-  uint64_t NewId() {
-    // MutexLock l(&id_mutex_);
+  uint64_t NewId() override {
+    std::lock_guard<std::mutex> l(id_mutex_);
     return ++(last_id_);
   }
-  void Prune() {
-    for (int s = 0; s < kNumShards; s++) {
+  void Prune() override {
+    for (int s = 0; s < NumShards(); s++) {
       shard_[s].Prune();
     }
   }
-  size_t TotalCharge() const {
+  size_t TotalCharge() const override {
     size_t total = 0;
-    for (int s = 0; s < kNumShards; s++) {
+    for (int s = 0; s < NumShards(); s++) {
       total += shard_[s].TotalCharge();
     }
     return total;
   }
+  // 按预计的条目总数预先分配各分片的哈希表，避免填充过程中扩容，应在开始使用前调用
+  void Reserve(size_t expected_entries) {
+    const size_t per_shard = (expected_entries + NumShards() - 1) / NumShards();
+    for (int s = 0; s < NumShards(); s++) {
+      shard_[s].Reserve(per_shard);
+    }
+  }
+  // 每个分片的锁统计，(*stats)[i]对应第i个分片
+  void GetShardStats(std::vector<CacheShardStats>* stats) const {
+    stats->resize(NumShards());
+    for (int s = 0; s < NumShards(); s++) {
+      (*stats)[s] = shard_[s].GetStats();
+    }
+  }
 };
 
 
-ShardedLRUCache* NewLRUCache(size_t capacity) { return new ShardedLRUCache(capacity); }
+// 参数含义见ShardedLRUCache。默认为高优先级条目（index和filter）预留一半容量，
+// 大范围扫描读入的data block不会把它们挤出缓存；传入0则所有条目一起按LRU淘汰
+inline ShardedLRUCache* NewLRUCache(size_t capacity, int num_shard_bits = kNumShardBits,
+                                    double high_pri_pool_ratio = kDefaultHighPriPoolRatio,
+                                    size_t admission_estimated_charge = 0) {
+  return new ShardedLRUCache(capacity, num_shard_bits, high_pri_pool_ratio,
+                             admission_estimated_charge);
+}
 
-uint32_t Hash(const char* data, size_t n, uint32_t seed) {
+inline uint32_t Hash(const char* data, size_t n, uint32_t seed) {
   // 类似于murmur hash
   const uint32_t m = 0xc6a4a793;
   const uint32_t r = 24;
@@ -392,4 +727,201 @@ uint32_t Hash(const char* data, size_t n, uint32_t seed) {
       break;
   }
   return h;
-}
\ No newline at end of file
+}
+
+// 打开的sstable的缓存：file number -> Table及其RandomAccessFile。
+// 打开一个sstable需要打开文件、读footer、解析index和filter，点查时每次都重新打开代价很高。
+// 条目存放在ShardedLRUCache中，每个Table的charge为1，容量即同时打开的文件数上限
+class TableCache {
+ public:
+  // options.block_cache等选项会传给每个打开的Table。
+  // 为其他文件（WAL、MANIFEST等）预留kNumNonTableCacheFiles个文件描述符
+  TableCache(const std::string& dbname, const Options& options, env* e)
+      : env_(e),
+        dbname_(dbname),
+        options_(options),
+        cache_(NewTableLRUCache(options.max_open_files)) {}
+  TableCache(const TableCache&) = delete;
+  TableCache& operator=(const TableCache&) = delete;
+  ~TableCache() { delete cache_; }
+
+  // 在file_number对应的sstable中查找key，找到返回OK，不存在返回NotFound
+  Status Get(uint64_t file_number, uint64_t file_size, const slice& key,
+             std::string* value, int level = -1,
+             const ReadOptions& read_options = ReadOptions()) {
+    return Get(file_number, file_size, 0, key, value, level, read_options);
+  }
+  // 按文件的元信息查找，外部导入的文件中key的sequence按f.global_seqno处理
+  Status Get(const FileMetaData& f, const slice& key, std::string* value,
+             int level = -1, const ReadOptions& read_options = ReadOptions()) {
+    return Get(f.number, f.file_size, f.global_seqno, key, value, level, read_options);
+  }
+
+  // 返回file_number对应sstable的迭代器，迭代器存活期间该Table不会被关闭。
+  // tableptr不为nullptr时设置为底层的Table，其生命周期与迭代器相同
+  Iterator* NewIterator(uint64_t file_number, uint64_t file_size,
+                        Table** tableptr = nullptr, int level = -1,
+                        const ReadOptions& read_options = ReadOptions()) {
+    return NewIterator(file_number, file_size, 0, tableptr, level, read_options);
+  }
+  Iterator* NewIterator(const FileMetaData& f, Table** tableptr = nullptr,
+                        int level = -1,
+                        const ReadOptions& read_options = ReadOptions()) {
+    return NewIterator(f.number, f.file_size, f.global_seqno, tableptr, level,
+                       read_options);
+  }
+
+  // 关闭file_number对应的sstable。compaction删除文件前调用，
+  // 仍被迭代器引用的Table在迭代器释放后才真正关闭
+  void Evict(uint64_t file_number) {
+    char buf[sizeof(file_number)];
+    coding::EncodeFixed64(buf, file_number);
+    cache_->Erase(slice(buf, sizeof(buf)));
+  }
+
+  // 当前打开的sstable数量
+  size_t NumOpenTables() const { return cache_->TotalCharge(); }
+
+ private:
+  Status Get(uint64_t file_number, uint64_t file_size,
+             SequenceNumber global_seqno, const slice& key, std::string* value,
+             int level, const ReadOptions& read_options) {
+    Cache::Handle* handle = nullptr;
+    Status s = FindTable(file_number, file_size, level, global_seqno, &handle);
+    if (s == OK) {
+      Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+      s = t->InternalGet(key, value, read_options);
+      cache_->Release(handle);
+    }
+    return s;
+  }
+
+  Iterator* NewIterator(uint64_t file_number, uint64_t file_size,
+                        SequenceNumber global_seqno, Table** tableptr, int level,
+                        const ReadOptions& read_options) {
+    if (tableptr != nullptr) {
+      *tableptr = nullptr;
+    }
+    Cache::Handle* handle = nullptr;
+    Status s = FindTable(file_number, file_size, level, global_seqno, &handle);
+    if (s != OK) {
+      return new ErrorIterator(s);
+    }
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    if (tableptr != nullptr) {
+      *tableptr = t;
+    }
+    return new CachedTableIterator(t->NewIterator(read_options), cache_, handle);
+  }
+
+  static const int kNumNonTableCacheFiles = 10;
+
+  // 各分片容量向上取整，分片过多时总数会明显超出max_open_files，因此容量小时减少分片数，
+  // 保证每个分片至少kMinEntriesPerShard个条目
+  static Cache* NewTableLRUCache(int max_open_files) {
+    static const int kMinEntriesPerShard = 64;
+    const int entries = std::max(max_open_files - kNumNonTableCacheFiles, 1);
+    int shard_bits = kNumShardBits;
+    while (shard_bits > 0 && (entries >> shard_bits) < kMinEntriesPerShard) {
+      shard_bits--;
+    }
+    ShardedLRUCache* cache = NewLRUCache(entries, shard_bits);
+    cache->Reserve(entries);  // 条目数已知
+    return cache;
+  }
+
+  struct TableAndFile {
+    RandomAccessFile* file;
+    Table* table;
+  };
+
+  // 迭代器释放时归还Table的句柄
+  class CachedTableIterator : public Iterator {
+   public:
+    CachedTableIterator(Iterator* iter, Cache* cache, Cache::Handle* handle)
+        : iter_(iter), cache_(cache), handle_(handle) {}
+    ~CachedTableIterator() override {
+      delete iter_;
+      cache_->Release(handle_);
+    }
+    bool Valid() const override { return iter_->Valid(); }
+    void SeekToFirst() override { iter_->SeekToFirst(); }
+    void SeekToLast() override { iter_->SeekToLast(); }
+    void Seek(const string& target) override { iter_->Seek(target); }
+    void Next() override { iter_->Next(); }
+    void Prev() override { iter_->Prev(); }
+    string key() const override { return iter_->key(); }
+    string value() const override { return iter_->value(); }
+    string status() const override { return iter_->status(); }
+
+   private:
+    Iterator* iter_;
+    Cache* cache_;
+    Cache::Handle* handle_;
+  };
+
+  // 打开sstable失败时返回的空迭代器
+  class ErrorIterator : public Iterator {
+   public:
+    explicit ErrorIterator(Status s) : status_(s) {}
+    bool Valid() const override { return false; }
+    void SeekToFirst() override {}
+    void SeekToLast() override {}
+    void Seek(const string&) override {}
+    void Next() override { assert(false); }
+    void Prev() override { assert(false); }
+    string key() const override { assert(false); return string(); }
+    string value() const override { assert(false); return string(); }
+    string status() const override {
+      return status_ == IOError ? string("IO error opening table")
+                                : string("corruption opening table");
+    }
+
+   private:
+    Status status_;
+  };
+
+  static void DeleteEntry(const slice&, void* value) {
+    TableAndFile* tf = reinterpret_cast<TableAndFile*>(value);
+    delete tf->table;
+    delete tf->file;
+    delete tf;
+  }
+
+  // 查找file_number对应的Table，未打开时打开并放入缓存。打开失败的结果不缓存，下次重试。
+  // 文件的global_seqno在导入后不再改变，打开时设置一次即可
+  Status FindTable(uint64_t file_number, uint64_t file_size, int level,
+                   SequenceNumber global_seqno, Cache::Handle** handle) {
+    char buf[sizeof(file_number)];
+    coding::EncodeFixed64(buf, file_number);
+    slice key(buf, sizeof(buf));
+    *handle = cache_->Lookup(key);
+    if (*handle != nullptr) {
+      return OK;
+    }
+    std::string fname = TableFileName(dbname_, file_number);
+    RandomAccessFile* file = nullptr;
+    Status s = env_->NewRandomAccessFile(fname, &file);
+    if (s != OK) {
+      return s;
+    }
+    Table* table = nullptr;
+    s = Table::Open(options_, file, file_size, &table, level, file_number,
+                    global_seqno);
+    if (s != OK) {
+      assert(table == nullptr);
+      delete file;
+      return s;
+    }
+    TableAndFile* tf = new TableAndFile;
+    tf->file = file;
+    tf->table = table;
+    *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
+    return OK;
+  }
+
+  env* const env_;
+  const std::string dbname_;
+  const Options options_;
+  Cache* cache_;
+};
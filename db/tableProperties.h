@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "env.h"
+#include "coding.h"
+#include "dbformat.h"
+//sstable的属性，由TableBuilder统计并写入properties meta block。
+//compaction打分、大小估算和墓碑密度判断只需读取这一个小block，无需扫描data block
+struct TableProperties {
+    uint64_t num_entries = 0;      // 键值对数量
+    uint64_t num_deletions = 0;    // 删除标记（kTypeDeletion）数量
+    uint64_t raw_key_size = 0;     // 所有key的原始字节数
+    uint64_t raw_value_size = 0;   // 所有value的原始字节数
+    uint64_t data_size = 0;        // data block总大小（含trailer）
+    uint64_t index_size = 0;       // index block大小
+    uint64_t filter_size = 0;      // filter block大小
+    SequenceNumber smallest_seqno = kMaxSequenceNumber;
+    SequenceNumber largest_seqno = 0;
+    std::string smallest_key;      // 表中最小的internal key
+    std::string largest_key;       // 表中最大的internal key
+    std::string prefix_extractor_name;  // 加入filter的前缀规则，为空表示filter中没有前缀
+    bool whole_key_filtering = true;    // filter中是否包含完整的user key
+
+    //墓碑密度，用于触发以清理删除标记为目的的compaction
+    double DeletionRatio() const {
+        return num_entries == 0 ? 0.0 : static_cast<double>(num_deletions) / num_entries;
+    }
+
+    void EncodeTo(std::string* dst) const {
+        coding::PutFixed64(dst, num_entries);
+        coding::PutFixed64(dst, num_deletions);
+        coding::PutFixed64(dst, raw_key_size);
+        coding::PutFixed64(dst, raw_value_size);
+        coding::PutFixed64(dst, data_size);
+        coding::PutFixed64(dst, index_size);
+        coding::PutFixed64(dst, filter_size);
+        coding::PutFixed64(dst, smallest_seqno);
+        coding::PutFixed64(dst, largest_seqno);
+        coding::PutFixed32(dst, smallest_key.size());
+        dst->append(smallest_key);
+        coding::PutFixed32(dst, largest_key.size());
+        dst->append(largest_key);
+        coding::PutFixed32(dst, prefix_extractor_name.size());
+        dst->append(prefix_extractor_name);
+        dst->push_back(whole_key_filtering ? 1 : 0);
+    }
+
+    Status DecodeFrom(const slice& input) {
+        const size_t kFixedSize = 9 * sizeof(uint64_t);
+        if (static_cast<size_t>(input.size()) < kFixedSize + 2 * sizeof(uint32_t)) {
+            return Corruption;
+        }
+        const char* p = input.data();
+        const char* limit = p + input.size();
+        uint64_t* fields[] = {&num_entries, &num_deletions, &raw_key_size,
+                              &raw_value_size, &data_size, &index_size,
+                              &filter_size, &smallest_seqno, &largest_seqno};
+        for (uint64_t* field : fields) {
+            *field = coding::DecodeFixed64(p);
+            p += sizeof(uint64_t);
+        }
+        std::string* keys[] = {&smallest_key, &largest_key};
+        for (std::string* key : keys) {
+            if (limit - p < static_cast<ptrdiff_t>(sizeof(uint32_t))) return Corruption;
+            uint32_t len = coding::DecodeFixed32(p);
+            p += sizeof(uint32_t);
+            if (static_cast<size_t>(limit - p) < len) return Corruption;
+            key->assign(p, len);
+            p += len;
+        }
+        //prefix_extractor_name和whole_key_filtering是后来加入的字段，旧文件中没有
+        prefix_extractor_name.clear();
+        whole_key_filtering = true;
+        if (limit - p >= static_cast<ptrdiff_t>(sizeof(uint32_t) + 1)) {
+            uint32_t len = coding::DecodeFixed32(p);
+            p += sizeof(uint32_t);
+            if (static_cast<size_t>(limit - p) < len + 1) return Corruption;
+            prefix_extractor_name.assign(p, len);
+            p += len;
+            whole_key_filtering = (*p != 0);
+        }
+        return OK;
+    }
+};
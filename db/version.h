@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include "env.h"
+#include "dbformat.h"
+#include "versionEdit.h"
+static const int kNumLevels = 7;
+
+//某一时刻每一层包含的sstable文件
+class Version {
+public:
+    Version() = default;
+    Version(const Version&) = delete;
+    Version& operator=(const Version&) = delete;
+
+    //level层中是否有文件的user key范围与[smallest_user_key,largest_user_key]相交
+    bool OverlapInLevel(int level, const slice& smallest_user_key,
+                        const slice& largest_user_key) const {
+        std::string smallest(smallest_user_key.data(), smallest_user_key.size());
+        std::string largest(largest_user_key.data(), largest_user_key.size());
+        for (const FileMetaData* f : files_[level]) {
+            slice file_smallest = ExtractUserKey(slice(f->smallest.data(), f->smallest.size()));
+            slice file_largest = ExtractUserKey(slice(f->largest.data(), f->largest.size()));
+            if (std::string(file_largest.data(), file_largest.size()) < smallest ||
+                std::string(file_smallest.data(), file_smallest.size()) > largest) {
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    int NumFiles(int level) const { return files_[level].size(); }
+
+    std::vector<FileMetaData*> files_[kNumLevels];
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "dbformat.h"
+//一个sstable文件的元信息
+struct FileMetaData {
+    FileMetaData() : refs(0), number(0), file_size(0), global_seqno(0) {}
+    int refs;
+    uint64_t number;
+    uint64_t file_size;    // 文件大小（字节）
+    std::string smallest;  // 表中最小的internal key
+    std::string largest;   // 表中最大的internal key
+    //外部导入的文件中所有key的sequence都是0，读取时统一视为global_seqno；普通文件为0
+    SequenceNumber global_seqno;
+};
+
+//对Version的一次增量修改：新增和删除的文件
+class VersionEdit {
+public:
+    void AddFile(int level, const FileMetaData& f) {
+        new_files_.push_back(std::make_pair(level, f));
+    }
+    void RemoveFile(int level, uint64_t file) {
+        deleted_files_.push_back(std::make_pair(level, file));
+    }
+    const std::vector<std::pair<int, FileMetaData>>& new_files() const { return new_files_; }
+    const std::vector<std::pair<int, uint64_t>>& deleted_files() const { return deleted_files_; }
+
+    //编码格式：若干条记录，每条以4字节tag开头
+    //  kDeletedFile: level(4) number(8)
+    //  kNewFile:     level(4) number(8) file_size(8) smallest largest global_seqno(8)
+    //smallest和largest是4字节长度加内容
+    void EncodeTo(std::string* dst) const {
+        for (const auto& deleted : deleted_files_) {
+            coding::PutFixed32(dst, kDeletedFile);
+            coding::PutFixed32(dst, static_cast<uint32_t>(deleted.first));
+            coding::PutFixed64(dst, deleted.second);
+        }
+        for (const auto& added : new_files_) {
+            const FileMetaData& f = added.second;
+            coding::PutFixed32(dst, kNewFile);
+            coding::PutFixed32(dst, static_cast<uint32_t>(added.first));
+            coding::PutFixed64(dst, f.number);
+            coding::PutFixed64(dst, f.file_size);
+            PutLengthPrefixed(dst, f.smallest);
+            PutLengthPrefixed(dst, f.largest);
+            coding::PutFixed64(dst, f.global_seqno);
+        }
+    }
+    //src格式错误时返回Corruption，此时edit的内容不确定
+    Status DecodeFrom(const slice& src) {
+        new_files_.clear();
+        deleted_files_.clear();
+        const char* p = src.data();
+        const char* limit = p + src.size();
+        while (p != limit) {
+            uint32_t tag, level;
+            if (!GetFixed32(&p, limit, &tag) || !GetFixed32(&p, limit, &level)) {
+                return Corruption;
+            }
+            if (tag == kDeletedFile) {
+                uint64_t number;
+                if (!GetFixed64(&p, limit, &number)) {
+                    return Corruption;
+                }
+                RemoveFile(static_cast<int>(level), number);
+            } else if (tag == kNewFile) {
+                FileMetaData f;
+                if (!GetFixed64(&p, limit, &f.number) || !GetFixed64(&p, limit, &f.file_size) ||
+                    !GetLengthPrefixed(&p, limit, &f.smallest) || !GetLengthPrefixed(&p, limit, &f.largest) ||
+                    !GetFixed64(&p, limit, &f.global_seqno)) {
+                    return Corruption;
+                }
+                AddFile(static_cast<int>(level), f);
+            } else {
+                return Corruption;
+            }
+        }
+        return OK;
+    }
+
+private:
+    enum Tag : uint32_t { kDeletedFile = 1, kNewFile = 2 };
+
+    static void PutLengthPrefixed(std::string* dst, const std::string& value) {
+        coding::PutFixed32(dst, static_cast<uint32_t>(value.size()));
+        dst->append(value);
+    }
+    static bool GetFixed32(const char** p, const char* limit, uint32_t* value) {
+        if (limit - *p < 4) {
+            return false;
+        }
+        *value = coding::DecodeFixed32(*p);
+        *p += 4;
+        return true;
+    }
+    static bool GetFixed64(const char** p, const char* limit, uint64_t* value) {
+        if (limit - *p < 8) {
+            return false;
+        }
+        *value = coding::DecodeFixed64(*p);
+        *p += 8;
+        return true;
+    }
+    static bool GetLengthPrefixed(const char** p, const char* limit, std::string* value) {
+        uint32_t len;
+        if (!GetFixed32(p, limit, &len) || static_cast<uint64_t>(limit - *p) < len) {
+            return false;
+        }
+        value->assign(*p, len);
+        *p += len;
+        return true;
+    }
+
+    std::vector<std::pair<int, FileMetaData>> new_files_;
+    std::vector<std::pair<int, uint64_t>> deleted_files_;
+};
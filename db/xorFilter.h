@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "env.h"
+#include "coding.h"
+#include "filterPolicy.h"
+#include "hash64.h"
+
+// A static XOR filter with 8-bit fingerprints [Graf, Lemire 2020].
+// Every key maps to three slots, one in each third of the array, and the
+// XOR of the three slots equals the key's fingerprint.  It needs about
+// 1.23 * 8 = 9.84 bits per key for a false positive rate of 1/256 (0.39%),
+// where a Bloom filter needs about 11.5 bits per key for the same rate
+// (about 15% more), and a lookup reads exactly three bytes.  The
+// fingerprint width is fixed, so at the 1% rate of the default Bloom
+// filter it saves almost nothing; RibbonFilterPolicy (ribbonFilter.h) has a
+// bits-per-key setting for that.
+//
+// Filter layout: 3 * block_length fingerprint bytes, then the seed as a
+// fixed64 and block_length as a fixed32.
+class XorFilterPolicy : public FilterPolicy {
+public:
+// Keys are hashed with Hash64(); filters written with the 32-bit Hash()
+// under the old name "leveldb.XorFilter8" are not read.
+const char* Name() const override { return "leveldb.XorFilter8v2"; }
+
+void CreateFilter(const slice* keys, int n, std::string* dst) const override {
+    std::vector<uint64_t> hashes(n);
+    for (int i = 0; i < n; i++) {
+        hashes[i] = KeyHash(keys[i]);
+    }
+    CreateFilterFromHashes(hashes.data(), n, dst);
+}
+
+bool SupportsKeyHashes() const override { return true; }
+
+uint64_t HashKey(const slice& key) const override { return KeyHash(key); }
+
+void CreateFilterFromHashes(const uint64_t* key_hashes, int n,
+                            std::string* dst) const override {
+    // Duplicate keys would never peel, so work on distinct hashes.
+    std::vector<uint64_t> hashes(key_hashes, key_hashes + n);
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    const size_t size = hashes.size();
+
+    const uint32_t block_length = static_cast<uint32_t>((32 + 1.23 * size) / 3);
+    const size_t capacity = 3 * static_cast<size_t>(block_length);
+    std::vector<uint8_t> fingerprints(capacity, 0);
+
+    // Peeling state: number of keys in each slot and the XOR of their hashes.
+    std::vector<uint32_t> count(capacity);
+    std::vector<uint64_t> xor_mask(capacity);
+    std::vector<uint32_t> queue(capacity);
+    std::vector<uint64_t> stack_hash(size);
+    std::vector<uint32_t> stack_slot(size);
+    uint64_t seed = 0;
+    for (int attempt = 0;; attempt++) {
+        seed = Mix64(0x9e3779b97f4a7c15ull * (attempt + 1));
+        std::fill(count.begin(), count.end(), 0);
+        std::fill(xor_mask.begin(), xor_mask.end(), 0);
+        for (uint64_t base : hashes) {
+            uint64_t h = Mix64(base + seed);
+            for (int j = 0; j < 3; j++) {
+                uint32_t slot = Slot(h, j, block_length);
+                count[slot]++;
+                xor_mask[slot] ^= h;
+            }
+        }
+        size_t queue_size = 0;
+        for (size_t i = 0; i < capacity; i++) {
+            if (count[i] == 1) queue[queue_size++] = i;
+        }
+        size_t stack_size = 0;
+        while (queue_size > 0) {
+            uint32_t slot = queue[--queue_size];
+            if (count[slot] != 1) continue;
+            uint64_t h = xor_mask[slot];
+            stack_hash[stack_size] = h;
+            stack_slot[stack_size] = slot;
+            stack_size++;
+            for (int j = 0; j < 3; j++) {
+                uint32_t other = Slot(h, j, block_length);
+                count[other]--;
+                xor_mask[other] ^= h;
+                if (count[other] == 1) queue[queue_size++] = other;
+            }
+        }
+        if (stack_size == size) {
+            // Assign in reverse peeling order so each key's own slot is
+            // written after the other two are final.
+            while (stack_size > 0) {
+                stack_size--;
+                uint64_t h = stack_hash[stack_size];
+                uint32_t slot = stack_slot[stack_size];
+                uint8_t f = Fingerprint(h);
+                for (int j = 0; j < 3; j++) {
+                    uint32_t other = Slot(h, j, block_length);
+                    if (other != slot) f ^= fingerprints[other];
+                }
+                fingerprints[slot] = f;
+            }
+            break;
+        }
+    }
+
+    dst->append(reinterpret_cast<const char*>(fingerprints.data()), capacity);
+    coding::PutFixed64(dst, seed);
+    coding::PutFixed32(dst, block_length);
+}
+
+bool KeyMayMatch(const slice& key, const slice& filter) const override {
+    const size_t len = filter.size();
+    if (len < kTrailerSize) return true;  // Not a filter we wrote
+    const char* trailer = filter.data() + len - kTrailerSize;
+    const uint64_t seed = coding::DecodeFixed64(trailer);
+    const uint32_t block_length = coding::DecodeFixed32(trailer + 8);
+    if (3 * static_cast<size_t>(block_length) != len - kTrailerSize) return true;
+    if (block_length == 0) return false;  // Filter over no keys
+
+    const uint8_t* fingerprints = reinterpret_cast<const uint8_t*>(filter.data());
+    const uint64_t h = Mix64(KeyHash(key) + seed);
+    uint8_t f = Fingerprint(h);
+    f ^= fingerprints[Slot(h, 0, block_length)];
+    f ^= fingerprints[Slot(h, 1, block_length)];
+    f ^= fingerprints[Slot(h, 2, block_length)];
+    return f == 0;
+}
+
+void KeysMayMatch(const slice* keys, int n, const slice& filter,
+                  bool* results) const override {
+    const size_t len = filter.size();
+    if (len < kTrailerSize) {
+        FilterPolicy::KeysMayMatch(keys, n, filter, results);
+        return;
+    }
+    const char* trailer = filter.data() + len - kTrailerSize;
+    const uint64_t seed = coding::DecodeFixed64(trailer);
+    const uint32_t block_length = coding::DecodeFixed32(trailer + 8);
+    if (3 * static_cast<size_t>(block_length) != len - kTrailerSize || block_length == 0) {
+        FilterPolicy::KeysMayMatch(keys, n, filter, results);
+        return;
+    }
+    const uint8_t* fingerprints = reinterpret_cast<const uint8_t*>(filter.data());
+    uint64_t hashes[kFilterBatchSize];
+    uint32_t slots[kFilterBatchSize][3];
+    for (int start = 0; start < n; start += kFilterBatchSize) {
+        const int count = std::min(n - start, kFilterBatchSize);
+        for (int i = 0; i < count; i++) {
+            hashes[i] = Mix64(KeyHash(keys[start + i]) + seed);
+            for (int j = 0; j < 3; j++) {
+                slots[i][j] = Slot(hashes[i], j, block_length);
+                PrefetchForRead(fingerprints + slots[i][j]);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            uint8_t f = Fingerprint(hashes[i]);
+            f ^= fingerprints[slots[i][0]];
+            f ^= fingerprints[slots[i][1]];
+            f ^= fingerprints[slots[i][2]];
+            results[start + i] = (f == 0);
+        }
+    }
+}
+
+private:
+static const size_t kTrailerSize = 8 + 4;
+
+static uint64_t KeyHash(const slice& key) {
+    return Hash64(key.data(), key.size(), 0x5bd1e995bc9f1d34ull);
+}
+
+// murmur3 64-bit finalizer
+static uint64_t Mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint8_t Fingerprint(uint64_t h) {
+    return static_cast<uint8_t>(h ^ (h >> 32));
+}
+
+// The j-th slot of a key lives in the j-th third of the array.
+static uint32_t Slot(uint64_t h, int j, uint32_t block_length) {
+    uint32_t r = static_cast<uint32_t>((h << (21 * j)) | (h >> ((64 - 21 * j) & 63)));
+    return static_cast<uint32_t>((static_cast<uint64_t>(r) * block_length) >> 32) +
+           j * block_length;
+}
+};
@@ -0,0 +1,160 @@
+//ShardedLRUCache的并发benchmark：多个线程对同一个缓存随机地Lookup和Insert，
+//输出总吞吐量、命中率以及各分片锁的竞争统计，用于评估分片数和线程数对锁竞争的影响。
+//
+//用法：cache_bench [--threads=N] [--ops_per_thread=N] [--keys=N] [--capacity=N]
+//                   [--shard_bits=N] [--lookup_percent=N] [--value_size=N]
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../db/tableCache.h"
+
+namespace {
+
+struct BenchOptions {
+    int threads = 16;
+    uint64_t ops_per_thread = 1000000;
+    uint64_t keys = 1 << 20;       //key的取值范围
+    size_t capacity = 1 << 19;     //缓存容量，每个条目的charge为1，即缓存的条目数
+    int shard_bits = kNumShardBits;
+    int lookup_percent = 90;       //Lookup占全部操作的百分比，其余为Insert
+    size_t value_size = 0;         //每个值额外分配的字节数，模拟block的内存占用
+};
+
+//解析"--name=value"形式的参数，name匹配时把value写入*value并返回true
+bool ParseFlag(const char* arg, const char* name, uint64_t* value) {
+    const size_t len = strlen(name);
+    if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, len) != 0 || arg[2 + len] != '=') {
+        return false;
+    }
+    char* end;
+    *value = strtoull(arg + 3 + len, &end, 10);
+    return *end == '\0';
+}
+
+bool ParseArgs(int argc, char** argv, BenchOptions* options) {
+    for (int i = 1; i < argc; i++) {
+        uint64_t v;
+        if (ParseFlag(argv[i], "threads", &v) && v > 0) {
+            options->threads = static_cast<int>(v);
+        } else if (ParseFlag(argv[i], "ops_per_thread", &v)) {
+            options->ops_per_thread = v;
+        } else if (ParseFlag(argv[i], "keys", &v) && v > 0) {
+            options->keys = v;
+        } else if (ParseFlag(argv[i], "capacity", &v)) {
+            options->capacity = static_cast<size_t>(v);
+        } else if (ParseFlag(argv[i], "shard_bits", &v) && v < 20) {
+            options->shard_bits = static_cast<int>(v);
+        } else if (ParseFlag(argv[i], "lookup_percent", &v) && v <= 100) {
+            options->lookup_percent = static_cast<int>(v);
+        } else if (ParseFlag(argv[i], "value_size", &v)) {
+            options->value_size = static_cast<size_t>(v);
+        } else {
+            fprintf(stderr, "unknown or invalid argument: %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void DeleteValue(const slice&, void* value) {
+    delete[] static_cast<char*>(value);
+}
+
+//每个线程的计数，单独一个cache line避免线程之间伪共享
+struct alignas(64) ThreadResult {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t inserts = 0;
+};
+
+void RunThread(const BenchOptions& options, ShardedLRUCache* cache, int index, ThreadResult* result) {
+    std::mt19937_64 random(301 + index);
+    char key[8];
+    for (uint64_t i = 0; i < options.ops_per_thread; i++) {
+        const uint64_t r = random();
+        coding::EncodeFixed64(key, r % options.keys);
+        const slice k(key, sizeof(key));
+        if (static_cast<int>((r >> 32) % 100) < options.lookup_percent) {
+            result->lookups++;
+            Cache::Handle* handle = cache->Lookup(k);
+            if (handle != nullptr) {
+                result->hits++;
+                cache->Release(handle);
+            }
+        } else {
+            result->inserts++;
+            char* value = new char[options.value_size + 1];
+            cache->Release(cache->Insert(k, value, 1, &DeleteValue));
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!ParseArgs(argc, argv, &options)) {
+        return 1;
+    }
+    ShardedLRUCache* cache = NewLRUCache(options.capacity, options.shard_bits);
+    cache->Reserve(options.capacity);
+
+    //先把缓存填满，使测量期间的Lookup有稳定的命中率
+    char key[8];
+    for (uint64_t i = 0; i < options.capacity && i < options.keys; i++) {
+        coding::EncodeFixed64(key, i);
+        cache->Release(cache->Insert(slice(key, sizeof(key)), new char[options.value_size + 1], 1, &DeleteValue));
+    }
+    std::vector<CacheShardStats> before;
+    cache->GetShardStats(&before);
+
+    std::vector<ThreadResult> results(options.threads);
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.threads; i++) {
+        threads.emplace_back(RunThread, std::cref(options), cache, i, &results[i]);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ThreadResult total;
+    for (const ThreadResult& r : results) {
+        total.lookups += r.lookups;
+        total.hits += r.hits;
+        total.inserts += r.inserts;
+    }
+    std::vector<CacheShardStats> after;
+    cache->GetShardStats(&after);
+    CacheShardStats locks;
+    uint64_t max_shard_wait = 0;
+    for (size_t s = 0; s < after.size(); s++) {
+        const uint64_t wait = after[s].lock_wait_nanos - before[s].lock_wait_nanos;
+        locks.lock_acquisitions += after[s].lock_acquisitions - before[s].lock_acquisitions;
+        locks.lock_contentions += after[s].lock_contentions - before[s].lock_contentions;
+        locks.lock_wait_nanos += wait;
+        max_shard_wait = std::max(max_shard_wait, wait);
+    }
+
+    const uint64_t ops = total.lookups + total.inserts;
+    printf("threads: %d  shards: %d  capacity: %zu  keys: %" PRIu64 "  lookup: %d%%\n", options.threads,
+           1 << options.shard_bits, options.capacity, options.keys, options.lookup_percent);
+    printf("ops: %" PRIu64 "  time: %.3f s  throughput: %.0f ops/s  hit rate: %.2f%%\n", ops, seconds,
+           ops / seconds, total.lookups > 0 ? 100.0 * total.hits / total.lookups : 0.0);
+    printf("lock acquisitions: %" PRIu64 "  contentions: %" PRIu64 " (%.2f%%)\n", locks.lock_acquisitions,
+           locks.lock_contentions,
+           locks.lock_acquisitions > 0 ? 100.0 * locks.lock_contentions / locks.lock_acquisitions : 0.0);
+    printf("lock wait: total %.3f ms  per contention %.0f ns  busiest shard %.3f ms\n",
+           locks.lock_wait_nanos / 1e6,
+           locks.lock_contentions > 0 ? static_cast<double>(locks.lock_wait_nanos) / locks.lock_contentions : 0.0,
+           max_shard_wait / 1e6);
+    delete cache;
+    return 0;
+}